@@ -302,6 +302,7 @@ main(int argc, char *argv[])
     closure_field(StgTSO, flags);
     closure_field(StgTSO, dirty);
     closure_field(StgTSO, bq);
+    closure_field(StgTSO, stm_stamp);
     closure_field_("StgTSO_cccs", StgTSO, prof.cccs);
     closure_field(StgTSO, stackobj);
 
@@ -443,6 +444,9 @@ main(int argc, char *argv[])
     struct_field(snEntry,sn_obj);
     struct_field(snEntry,addr);
 
+    struct_size(spEntry);
+    struct_field(spEntry,addr);
+
 #ifdef mingw32_HOST_OS
     struct_size(StgAsyncIOResult);
     struct_field(StgAsyncIOResult, reqID);
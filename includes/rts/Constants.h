@@ -277,6 +277,13 @@
  */
 #define TSO_SQUEEZED 128
 
+/*
+ * TSO_STEALABLE: the thread is in its Capability's steal_queue, where
+ * other Capabilities may take it (see scheduleOfferWork() in
+ * rts/Schedule.c).
+ */
+#define TSO_STEALABLE 256
+
 /* -----------------------------------------------------------------------------
    RET_DYN stack frames
    -------------------------------------------------------------------------- */
@@ -314,4 +321,27 @@
 
 #define MAX_SPARE_WORKERS 6
 
+/* -----------------------------------------------------------------------------
+   Stable pointer table segments
+
+   The stable pointer table is a directory of fixed-size segments, so
+   that growing it never moves existing entries.  A StablePtr is an
+   index whose top bits select the segment and whose bottom
+   STABLE_PTR_SEGMENT_BITS bits select the entry within it.  Used by
+   deRefStablePtr and stg_deRefStablePtrzh.
+   -------------------------------------------------------------------------- */
+
+#define STABLE_PTR_SEGMENT_BITS 10
+#define STABLE_PTR_SEGMENT_SIZE (1 << STABLE_PTR_SEGMENT_BITS)
+#define STABLE_PTR_SEGMENT_MASK (STABLE_PTR_SEGMENT_SIZE - 1)
+
+/* -----------------------------------------------------------------------------
+   NUMA nodes
+
+   The most NUMA nodes the RTS will use; the node mask given with
+   +RTS --numa is truncated to this many bits.
+   -------------------------------------------------------------------------- */
+
+#define MAX_NUMA_NODES 16
+
 #endif /* RTS_CONSTANTS_H */
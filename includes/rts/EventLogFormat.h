@@ -158,8 +158,12 @@
                                          par_n_threads,
                                          par_max_copied, par_tot_copied) */
 #define EVENT_GC_GLOBAL_SYNC      54 /* ()                     */
+#define EVENT_NURSERY_SIZE        55 /* (heap_capset, size_bytes) */
+#define EVENT_MUT_LIST_SIZE       56 /* (heap_capset, size_bytes) */
+#define EVENT_STM_COUNTERS        57 /* (commits, aborts, retries) */
+#define EVENT_STEAL_THREAD        58 /* (thread, victim_cap)   */
 
-/* Range 55 - 59 is available for new GHC and common events */
+/* Range 59 - 59 is available for new GHC and common events */
 
 /* Range 60 - 80 is used by eden for parallel tracing
  * see http://www.mathematik.uni-marburg.de/~eden/
@@ -172,7 +176,7 @@
  * ranges higher than this are reserved but not currently emitted by ghc.
  * This must match the size of the EventDesc[] array in EventLog.c
  */
-#define NUM_GHC_EVENT_TAGS        55
+#define NUM_GHC_EVENT_TAGS        59
 
 #if 0  /* DEPRECATED EVENTS: */
 /* we don't actually need to record the thread, it's implicit */
@@ -55,6 +55,34 @@ struct GC_FLAGS {
     Time    idleGCDelayTime;    /* units: TIME_RESOLUTION */
 
     StgWord heapBase;           /* address to ask the OS for memory */
+
+    nat     decommit;           /* what to do with surplus free memory */
+#define DECOMMIT_NONE  0        /* keep it */
+#define DECOMMIT_EAGER 1        /* MADV_DONTNEED: return it at once */
+#define DECOMMIT_LAZY  2        /* MADV_FREE: let the OS take it back */
+    nat     retainFree;         /* in *blocks*: free memory to keep */
+    rtsBool retainFreeAuto;     /* keep as much free as is in use */
+
+    rtsBool numa;               /* Use NUMA */
+    StgWord numaMask;           /* NUMA nodes we may use, one bit per node */
+
+    rtsBool concurrentMark;     /* mark the oldest generation concurrently
+                                 * with the mutator */
+
+    nat     compactBudget;      /* in *blocks*: instead of compacting the
+                                 * oldest generation, sweep it and copy at
+                                 * most this much live data out of its
+                                 * fragmented blocks per major GC (0: off) */
+
+    nat     nurseryChunkSize;   /* in *blocks*: divide the allocation area
+                                 * into chunks of this size (0: off) */
+
+    rtsBool adaptiveNursery;    /* size the allocation area from the cache
+                                 * size and the survival rate, not -A */
+
+    nat     reusePinned;        /* percent: allocate pinned objects into
+                                 * the holes in pinned blocks that are
+                                 * less full than this (0: off) */
 };
 
 struct DEBUG_FLAGS {  
@@ -74,6 +102,7 @@ struct DEBUG_FLAGS {
     rtsBool squeeze;        /* 'z'  stack squeezing & lazy blackholing */
     rtsBool hpc; 	    /* 'c' coverage */
     rtsBool sparks; 	    /* 'r' */
+    rtsBool numa;           /* --debug-numa: fake NUMA topology */
 };
 
 struct COST_CENTRE_FLAGS {
@@ -154,13 +183,17 @@ struct MISC_FLAGS {
     rtsBool machineReadable;
     StgWord linkerMemBase;       /* address to ask the OS for memory
                                   * for the linker, NULL ==> off */
+    nat     ioManager;           /* how the non-threaded RTS waits for I/O */
+#define IO_MANAGER_SELECT 0
+#define IO_MANAGER_EPOLL  1
 };
 
 #ifdef THREADED_RTS
 struct PAR_FLAGS {
   nat            nNodes;         /* number of threads to run simultaneously */
   rtsBool        migrate;        /* migrate threads between capabilities */
-  nat            maxLocalSparks;
+  nat            maxLocalSparks; /* initial size of a spark pool */
+  nat            sparkPoolLimit; /* a spark pool may grow up to this */
   rtsBool        parGcEnabled;   /* enable parallel GC */
   nat            parGcGen;       /* do parallel GC in this generation
                                   * and higher only */
@@ -178,7 +211,27 @@ struct PAR_FLAGS {
                                   * non-load-balancing parallel GC.
                                   * (zero disables) */
 
+  rtsBool        parGcNoSyncWithoutAlloc;
+                                 /* do not try to wake up a Capability
+                                  * that has not allocated since the
+                                  * last GC when doing a
+                                  * non-load-balancing parallel GC. */
+
   rtsBool        setAffinity;    /* force thread affinity with CPUs */
+
+  rtsBool        stmVersionClock; /* validate STM reads against a global
+                                   * version clock */
+
+  nat            stmContention;  /* what to do when an STM transaction
+                                  * has to be re-run */
+#define STM_CM_NONE    0         /* re-run it at once */
+#define STM_CM_BACKOFF 1         /* back off for longer each time */
+#define STM_CM_AGE     2         /* ... and serialize the oldest one
+                                  * that keeps failing */
+#define STM_CM_ABORTS  3         /* ... and serialize the one that has
+                                  * failed the most */
+  nat            stmSerializeAfter; /* aborts before a transaction asks
+                                     * to be serialized */
 };
 #endif /* THREADED_RTS */
 
@@ -24,17 +24,33 @@ StgStablePtr getStablePtr  (StgPtr p);
 typedef struct { 
   StgPtr  addr;			/* Haskell object, free list, or NULL */
   StgPtr  old;			/* old Haskell object, used during GC */
-  StgWord ref;			/* used for reference counting */
   StgClosure *sn_obj;		/* the StableName object (or NULL) */
+  StgWord link;			/* next entry in the same generation */
 } snEntry;
 
-extern DLL_IMPORT_RTS snEntry *stable_ptr_table;
+typedef struct {
+  StgPtr  addr;			/* Haskell object, or free list link */
+} spEntry;
+
+/* A free stable pointer entry holds the index of the next free entry,
+ * shifted left by one with the low bit set.  Live entries always hold
+ * an untagged, hence word-aligned, closure pointer.
+ */
+#define SPT_ENTRY_IS_FREE(e) (((StgWord)(e)->addr & 1) != 0)
+
+extern DLL_IMPORT_RTS spEntry **stable_ptr_table;
+extern DLL_IMPORT_RTS snEntry *stable_name_table;
 
 EXTERN_INLINE
-StgPtr deRefStablePtr(StgStablePtr sp)
+StgPtr deRefStablePtr(StgStablePtr stable_ptr)
 {
-    ASSERT(stable_ptr_table[(StgWord)sp].ref > 0);
-    return stable_ptr_table[(StgWord)sp].addr;
+    StgWord sp = (StgWord)stable_ptr;
+    spEntry *e;
+
+    e = &stable_ptr_table[sp >> STABLE_PTR_SEGMENT_BITS]
+                         [sp & STABLE_PTR_SEGMENT_MASK];
+    ASSERT(!SPT_ENTRY_IS_FREE(e));
+    return e->addr;
 }
 
 #endif /* RTS_STABLE_H */
@@ -45,6 +45,17 @@ StgRegTable * resumeThread  (void *);
 int    cmp_thread      (StgPtr tso1, StgPtr tso2);
 int    rts_getThreadId (StgPtr tso);
 
+// Scheduling priorities: a runnable thread runs before the less urgent
+// threads on its Capability.  New threads get the priority of the
+// thread that forked them, or THREAD_PRIORITY_DEFAULT.  These must be
+// called from Haskell, with an unsafe foreign call.
+#define THREAD_PRIORITY_MIN     0
+#define THREAD_PRIORITY_DEFAULT 4
+#define THREAD_PRIORITY_MAX     7
+
+void   rts_setThreadPriority (StgPtr tso, HsInt priority);
+HsInt  rts_getThreadPriority (StgPtr tso);
+
 #if !defined(mingw32_HOST_OS)
 pid_t  forkProcess     (HsStablePtr *entry);
 #else
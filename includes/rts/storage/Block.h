@@ -76,7 +76,7 @@ typedef struct bdescr_ {
 
     StgWord16 gen_no;          // gen->no, cached
     StgWord16 dest_no;         // number of destination generation
-    StgWord16 _pad1;
+    StgWord16 node;            // which NUMA node this block is on
 
     StgWord16 flags;           // block flags, see below
 
@@ -119,6 +119,16 @@ typedef struct bdescr_ {
 #define BF_KNOWN     128
 /* Block was swept in the last generation */
 #define BF_SWEPT     256
+/* Free megablock group whose memory has been given back to the OS */
+#define BF_DECOMMITTED 512
+/* Block is in the snapshot of a concurrent mark of the old generation */
+#define BF_SNAPSHOT  1024
+/* Large object in the snapshot that the concurrent mark has reached */
+#define BF_SNAPSHOT_MARKED 2048
+/* Pinned block whose objects are being marked during this GC */
+#define BF_PINNED_MARKS 4096
+/* Pinned block whose holes a capability is allocating into */
+#define BF_PINNED_REUSED 8192
 
 /* Finding the block descriptor for a given block -------------------------- */
 
@@ -247,9 +257,13 @@ extern void initBlockAllocator(void);
 bdescr *allocGroup(nat n);
 bdescr *allocBlock(void);
 
+// allocate on a particular logical NUMA node (allocGroup uses node 0)
+bdescr *allocGroupOnNode(nat node, nat n);
+
 // versions that take the storage manager lock for you:
 bdescr *allocGroup_lock(nat n);
 bdescr *allocBlock_lock(void);
+bdescr *allocGroupOnNode_lock(nat node, nat n);
 
 /* De-Allocation ----------------------------------------------------------- */
 
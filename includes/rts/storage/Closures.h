@@ -412,6 +412,8 @@ struct StgTRecHeader_ {
   struct StgTRecHeader_     *enclosing_trec;
   StgTRecChunk              *current_chunk;
   StgInvariantCheckQueue    *invariants_to_check;
+  StgArrWords               *index;  // TVar index, see get_trec_index()
+  StgWord                    read_version; // see --stm-clock in STM.c
   TRecState                  state;
 };
 
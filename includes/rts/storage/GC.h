@@ -88,6 +88,10 @@ typedef struct generation_ {
     nat collections;
     nat par_collections;
     nat failed_promotions;
+    memcount n_pinned_blocks;           // small-object pinned blocks
+    memcount n_pinned_waste_words;      // ... and the space in them that
+                                        // no live object uses, as of the
+                                        // last GC of this generation
 
     // ------------------------------------
     // Fields below are used during GC only
@@ -200,6 +204,10 @@ typedef struct _GCStats {
   StgDouble gc_wall_seconds;
   StgDouble cpu_seconds;
   StgDouble wall_seconds;
+  StgWord64 current_bytes_decommitted;     // free heap given back to the OS
+  StgWord64 cumulative_bytes_decommitted;  // ... summed over all GCs
+  StgWord64 current_bytes_pinned;          // blocks of small pinned objects
+  StgWord64 current_bytes_pinned_wasted;   // ... not used by live objects
 } GCStats;
 void getGCStats (GCStats *s);
 
@@ -213,6 +221,15 @@ typedef struct _ParGCStats {
 } ParGCStats;
 void getParGCStats (ParGCStats *s);
 
+typedef struct _StmStats {
+  StgWord64 commits;       // top-level transactions committed
+  StgWord64 aborts;        // ... that failed and were re-run
+  StgWord64 retries;       // ... that blocked in retry#
+  StgWord64 serialized;    // re-runs serialized by the contention manager
+  StgWord64 max_aborts;    // most re-runs of any one atomically block
+} StmStats;
+void getStmStats (StmStats *s);
+
 /*
 typedef struct _TaskStats {
   StgWord64 mut_time;
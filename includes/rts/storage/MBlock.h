@@ -18,6 +18,7 @@ extern lnat mblocks_allocated;
 extern void initMBlocks(void);
 extern void * getMBlock(void);
 extern void * getMBlocks(nat n);
+extern void * getMBlocksOnNode(nat node, nat n);
 extern void freeMBlocks(void *addr, nat n);
 extern void freeAllMBlocks(void);
 
@@ -168,6 +168,32 @@ typedef struct StgTSO_ {
      */
     StgWord32  tot_stack_size;
 
+    /*
+     * The number of times this thread has been run since it arrived
+     * on its current Capability, up to STEAL_AFFINITY_SLICES.  Threads
+     * that have been here for a while are offered to idle
+     * Capabilities last (see scheduleOfferWork()).
+     */
+    StgWord32  slices;
+
+    /*
+     * The scheduling priority, THREAD_PRIORITY_MIN to
+     * THREAD_PRIORITY_MAX, and the number of more urgent threads that
+     * have been put ahead of this one on the run queue since it got
+     * there (see insertOnRunQueue()).
+     */
+    StgWord32  priority;
+    StgWord32  overtaken;
+
+    /*
+     * The STM contention manager's view of the thread's current
+     * atomically block: zero before it starts, then a time stamp taken
+     * when it first fails to commit; and the number of times it has
+     * been re-run (see stmStartTransaction()).
+     */
+    StgWord    stm_stamp;
+    StgWord32  stm_aborts;
+
 } *StgTSOPtr;
 
 typedef struct StgStack_ {
@@ -222,9 +248,11 @@ void dirty_STACK (Capability *cap, StgStack *stack);
 	
         BlockedOnMsgThrowTo    MessageThrowTo *     TSO->blocked_exception
 
-        BlockedOnRead          NULL                 blocked_queue
-        BlockedOnWrite         NULL		    blocked_queue
-        BlockedOnDelay         NULL                 blocked_queue
+        BlockedOnRead          NULL                 blocked_queue, or the
+                                                    epoll fd_waiters
+        BlockedOnWrite         NULL		    blocked_queue, or the
+                                                    epoll fd_waiters
+        BlockedOnDelay         NULL                 the sleepers heap
 	BlockedOnGA            closure TSO blocks on   BQ of that closure
 	BlockedOnGA_NoSend     closure TSO blocks on   BQ of that closure
 
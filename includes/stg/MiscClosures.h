@@ -137,6 +137,8 @@ RTS_ENTRY(stg_END_STM_WATCH_QUEUE);
 RTS_ENTRY(stg_END_INVARIANT_CHECK_QUEUE);
 RTS_ENTRY(stg_END_STM_CHUNK_LIST);
 RTS_ENTRY(stg_NO_TREC);
+RTS_ENTRY(stg_NO_TREC_INDEX);
+RTS_ENTRY(stg_STM_AWOKEN);
 
 /* closures */
 
@@ -149,6 +151,8 @@ RTS_CLOSURE(stg_END_STM_WATCH_QUEUE_closure);
 RTS_CLOSURE(stg_END_INVARIANT_CHECK_QUEUE_closure);
 RTS_CLOSURE(stg_END_STM_CHUNK_LIST_closure);
 RTS_CLOSURE(stg_NO_TREC_closure);
+RTS_CLOSURE(stg_NO_TREC_INDEX_closure);
+RTS_CLOSURE(stg_STM_AWOKEN_closure);
 
 RTS_ENTRY(stg_NO_FINALIZER_entry);
 
@@ -467,7 +471,6 @@ extern StgWord rts_breakpoint_io_action[];
 
 // Schedule.c
 extern StgWord RTS_VAR(blocked_queue_hd), RTS_VAR(blocked_queue_tl);
-extern StgWord RTS_VAR(sleeping_queue);
 extern StgWord RTS_VAR(blackhole_queue);
 extern StgWord RTS_VAR(sched_mutex);
 
@@ -488,6 +491,7 @@ extern StgWord RTS_VAR(RtsFlags); // bogus type
 
 // Stable.c
 extern StgWord RTS_VAR(stable_ptr_table);
+extern StgWord RTS_VAR(stable_name_table);
 
 // Profiling.c
 extern unsigned int RTS_VAR(era);
@@ -19,6 +19,26 @@
  */
 RTS_PRIVATE void awaitEvent(rtsBool wait);  /* In posix/Select.c or
                                              * win32/AwaitEvent.c */
+
+#if !defined(mingw32_HOST_OS)
+/* The epoll backend of posix/Select.c keeps the threads blocked on
+ * I/O in per-fd queues of its own, rather than on blocked_queue_hd,
+ * and threads in threadDelay are kept in a heap ordered by wakeup
+ * time.  These let the scheduler and the GC get at them.
+ *
+ * Called from STG :  NO
+ * Locks assumed   :  sched_mutex
+ */
+RTS_PRIVATE void    initAwaitEvent  (void);
+RTS_PRIVATE void    resetAwaitEvent (void);  /* in the child of a fork() */
+RTS_PRIVATE void    exitAwaitEvent  (void);
+RTS_PRIVATE void    markAwaitEvent  (evac_fn evac, void *user);
+RTS_PRIVATE rtsBool emptyFdWaiters  (void);
+RTS_PRIVATE void    removeThreadFromFdWaiters (Capability *cap, StgTSO *tso);
+RTS_PRIVATE rtsBool emptySleepingThreads (void);
+RTS_PRIVATE void    removeThreadFromSleepers (StgTSO *tso);
+#endif
+
 #endif
 
 #endif /* AWAITEVENT_H */
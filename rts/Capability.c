@@ -24,6 +24,7 @@
 #include "Sparks.h"
 #include "Trace.h"
 #include "sm/GC.h" // for gcWorkerThread()
+#include "sm/OSMem.h"
 #include "STM.h"
 #include "RtsUtils.h"
 
@@ -34,6 +35,8 @@
 Capability MainCapability;
 
 nat n_capabilities = 0;
+nat n_numa_nodes = 1;
+nat numa_map[MAX_NUMA_NODES];
 nat enabled_capabilities = 0;
 Capability *capabilities = NULL;
 
@@ -75,6 +78,39 @@ globalWorkToDo (void)
 #endif
 
 #if defined(THREADED_RTS)
+// Having stolen a spark from robbed, move up to half of the sparks it
+// has left into our own pool as well.  The spark thread can then run
+// them one after another without going back to robbed for each one,
+// which matters when there are many small sparks.
+static void
+stealMoreSparks (Capability *cap, Capability *robbed)
+{
+  StgClosurePtr spark;
+  long n, room;
+
+  n = sparkPoolSize(robbed->sparks) / 2;
+
+  // never more than fits without growing our pool, so that the
+  // pushes below cannot fail and lose a spark
+  room = (long)cap->sparks->size - 1 - sparkPoolSize(cap->sparks);
+  if (n > room) {
+      n = room;
+  }
+
+  for (; n > 0; n--) {
+      spark = tryStealSpark(robbed->sparks);
+      if (spark == NULL) {
+          break;
+      }
+      if (fizzledSpark(spark)) {
+          cap->spark_stats.fizzled++;
+          traceEventSparkFizzle(cap);
+          continue;
+      }
+      pushWSDeque(cap->sparks, spark);
+  }
+}
+
 StgClosure *
 findSpark (Capability *cap)
 {
@@ -148,6 +184,8 @@ findSpark (Capability *cap)
           if (spark != NULL) {
               cap->spark_stats.converted++;
               traceEventSparkSteal(cap, robbed->no);
+
+              stealMoreSparks(cap, robbed);
               
               return spark;
           }
@@ -226,6 +264,7 @@ initCapability( Capability *cap, nat i )
     nat g;
 
     cap->no = i;
+    cap->node = capNoToNumaNode(i);
     cap->in_haskell        = rtsFalse;
     cap->idle              = 0;
     cap->disabled          = rtsFalse;
@@ -243,12 +282,16 @@ initCapability( Capability *cap, nat i )
     cap->returning_tasks_tl = NULL;
     cap->inbox              = (Message*)END_TSO_QUEUE;
     cap->sparks             = allocSparkPool();
+    cap->steal_queue        = newWSDeque(STEAL_QUEUE_SIZE);
     cap->spark_stats.created    = 0;
     cap->spark_stats.dud        = 0;
     cap->spark_stats.overflowed = 0;
     cap->spark_stats.converted  = 0;
     cap->spark_stats.gcd        = 0;
     cap->spark_stats.fizzled    = 0;
+    cap->stable_ptr_free        = 0;
+    cap->n_stable_ptr_free      = 0;
+    initBlockCache(&cap->block_cache, cap->node);
 #endif
     cap->total_allocated        = 0;
 
@@ -272,9 +315,20 @@ initCapability( Capability *cap, nat i )
     cap->free_trec_chunks = END_STM_CHUNK_LIST;
     cap->free_trec_headers = NO_TREC;
     cap->transaction_tokens = 0;
+    cap->stm_stats.commits = 0;
+    cap->stm_stats.aborts = 0;
+    cap->stm_stats.retries = 0;
+    cap->stm_stats.serialized = 0;
+    cap->stm_stats.max_aborts = 0;
+    cap->stm_wakeups = NULL;
+    cap->stm_wakeups_size = 0;
     cap->context_switch = 0;
     cap->pinned_object_block = NULL;
+    cap->pinned_object_limit = NULL;
+    cap->pinned_object_holes = NULL;
     cap->pinned_object_blocks = NULL;
+    cap->large_objects = NULL;
+    initLargeCache(&cap->large_cache);
 
 #ifdef PROFILING
     cap->r.rCCCS = CCS_SYSTEM;
@@ -288,6 +342,48 @@ initCapability( Capability *cap, nat i )
 #if defined(THREADED_RTS)
     traceSparkCounters(cap);
 #endif
+    traceStmCounters(cap);
+}
+
+/* ---------------------------------------------------------------------------
+ * Work out the logical NUMA nodes from the OS and +RTS --numa.  This has
+ * to happen before the capabilities and the storage manager are
+ * initialised, since both place memory on nodes.
+ * ------------------------------------------------------------------------- */
+
+static void
+initNumaNodes (void)
+{
+    StgWord mask;
+    nat physical;
+
+    n_numa_nodes = 1;
+    numa_map[0] = 0;
+
+    if (!RtsFlags.GcFlags.numa) return;
+
+    mask = RtsFlags.GcFlags.numaMask;
+#ifdef DEBUG
+    // --debug-numa: take the nodes we were given at face value
+    if (!RtsFlags.DebugFlags.numa)
+#endif
+    {
+        mask &= osNumaMask();
+    }
+
+    n_numa_nodes = 0;
+    for (physical = 0; physical < MAX_NUMA_NODES; physical++) {
+        if (mask & ((StgWord)1 << physical)) {
+            numa_map[n_numa_nodes++] = physical;
+        }
+    }
+
+    if (n_numa_nodes == 0) {
+        errorBelch("--numa: none of the requested NUMA nodes are available");
+        stg_exit(EXIT_FAILURE);
+    }
+
+    debugTrace(DEBUG_sched, "using %d NUMA node(s)", n_numa_nodes);
 }
 
 /* ---------------------------------------------------------------------------
@@ -306,6 +402,8 @@ initCapabilities( void )
     traceCapsetCreate(CAPSET_OSPROCESS_DEFAULT, CapsetTypeOsProcess);
     traceCapsetCreate(CAPSET_CLOCKDOMAIN_DEFAULT, CapsetTypeClockdomain);
 
+    initNumaNodes();
+
 #if defined(THREADED_RTS)
 
 #ifndef REG_Base
@@ -500,6 +598,7 @@ releaseCapability_ (Capability* cap,
     // anything else to do, give the Capability to a worker thread.
     if (always_wakeup || 
         !emptyRunQueue(cap) || !emptyInbox(cap) ||
+        !looksEmptyWSDeque(cap->steal_queue) ||
         (!cap->disabled && !emptySparkPoolCap(cap)) || globalWorkToDo()) {
 	if (cap->spare_workers) {
 	    giveCapabilityToTask(cap, cap->spare_workers);
@@ -689,6 +788,7 @@ yieldCapability (Capability** pCap, Task *task)
         gcWorkerThread(cap);
         traceEventGcEnd(cap);
         traceSparkCounters(cap);
+        traceStmCounters(cap);
         // See Note [migrated bound threads 2]
         if (task->cap == cap) return;
     }
@@ -932,6 +1032,7 @@ shutdownCapability (Capability *cap USED_IF_THREADS,
         }
 
         traceSparkCounters(cap);
+        traceStmCounters(cap);
 	RELEASE_LOCK(&cap->lock);
 	break;
     }
@@ -963,8 +1064,12 @@ freeCapability (Capability *cap)
 {
     stgFree(cap->mut_lists);
     stgFree(cap->saved_mut_lists);
+    if (cap->stm_wakeups != NULL) {
+        stgFree(cap->stm_wakeups);
+    }
 #if defined(THREADED_RTS)
     freeSparkPool(cap->sparks);
+    freeWSDeque(cap->steal_queue);
 #endif
     traceCapsetRemoveCap(CAPSET_OSPROCESS_DEFAULT, cap->no);
     traceCapsetRemoveCap(CAPSET_CLOCKDOMAIN_DEFAULT, cap->no);
@@ -1017,10 +1122,14 @@ markCapability (evac_fn evac, void *user, Capability *cap,
     if (!no_mark_sparks) {
         traverseSparkQueue (evac, user, cap);
     }
+    // scheduleDoGC() has put the offered threads back on the run queue
+    ASSERT(looksEmptyWSDeque(cap->steal_queue));
 #endif
 
-    // Free STM structures for this Capability
+    // Free STM structures for this Capability, except for the
+    // watch queue entries that it keeps for re-use
     stmPreGCHook(cap);
+    evac(user, (StgClosure **)(void *)&cap->free_tvar_watch_queues);
 }
 
 void
@@ -24,6 +24,8 @@
 #include "sm/GC.h" // for evac_fn
 #include "Task.h"
 #include "Sparks.h"
+#include "STM.h"
+#include "sm/BlockAlloc.h" // for BlockCache, LargeCache
 
 #include "BeginPrivate.h"
 
@@ -36,6 +38,9 @@ struct Capability_ {
 
     nat no;  // capability number.
 
+    nat node;  // the logical NUMA node this capability's memory comes
+               // from; see capNoToNumaNode().
+
     // The Task currently holding this Capability.  This task has
     // exclusive access to the contents of this Capability (apart from
     // returning_tasks_hd/returning_tasks_tl).
@@ -76,9 +81,22 @@ struct Capability_ {
 
     // block for allocating pinned objects into
     bdescr *pinned_object_block;
+    // the end of the space to allocate into in pinned_object_block,
+    // and the rest of its holes if we are reusing it (see Pinned.c)
+    StgPtr pinned_object_limit;
+    StgPtr pinned_object_holes;
     // full pinned object blocks allocated since the last GC
     bdescr *pinned_object_blocks;
 
+    // large objects allocated since the last GC (doubly linked); the
+    // GC moves them to g0->large_objects, so allocate() doesn't have
+    // to take sm_mutex to link them in.
+    bdescr *large_objects;
+
+    // the groups of large objects that died in the last GC, for
+    // allocate() to reuse
+    LargeCache large_cache;
+
     // Context switch flag.  When non-zero, this means: stop running
     // Haskell code, and switch threads.
     int context_switch;
@@ -119,8 +137,24 @@ struct Capability_ {
 
     SparkPool *sparks;
 
+    // Runnable threads that we have offered to idle Capabilities,
+    // which steal them from the other end (see scheduleOfferWork()).
+    // We must not touch a thread while it is in here; reclaimThread()
+    // takes it back first.
+    WSDeque *steal_queue;
+
     // Stats on spark creation/conversion
     SparkCounters spark_stats;
+
+    // Free stable pointer slots owned by this Capability, linked
+    // through the entries themselves (see Stable.c).  Only the
+    // running_task may touch these, so no lock is needed.
+    StgWord stable_ptr_free;
+    nat n_stable_ptr_free; // count of above
+
+    // Free blocks for allocate() and friends, so that they don't
+    // have to take sm_mutex for every small block group.
+    BlockCache block_cache;
 #endif
     // Total words allocated by this cap since rts start
     lnat total_allocated;
@@ -131,6 +165,9 @@ struct Capability_ {
     StgTRecChunk *free_trec_chunks;
     StgTRecHeader *free_trec_headers;
     nat transaction_tokens;
+    StmCounters stm_stats;
+    StgTSO **stm_wakeups;        // threads for a commit to wake up
+    nat stm_wakeups_size;
 } // typedef Capability is defined in RtsAPI.h
   // Capabilities are stored in an array, so make sure that adjacent
   // Capabilities don't share any cache-lines:
@@ -210,6 +247,16 @@ INLINE_HEADER void releaseCapability_ (Capability* cap STG_UNUSED,
 
 extern nat enabled_capabilities;
 
+// NUMA nodes.  Logical node n is OS node numa_map[n]; with +RTS
+// --numa the logical nodes are the ones in RtsFlags.GcFlags.numaMask,
+// otherwise there is a single logical node 0.  Capabilities are
+// spread round-robin over the logical nodes.
+//
+extern nat n_numa_nodes;
+extern nat numa_map[MAX_NUMA_NODES];
+
+#define capNoToNumaNode(n) ((n) % n_numa_nodes)
+
 // Array of all the capabilities
 //
 extern Capability *capabilities;
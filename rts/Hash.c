@@ -1,11 +1,12 @@
 /*-----------------------------------------------------------------------------
  *
  * (c) The AQUA Project, Glasgow University, 1995-1998
- * (c) The GHC Team, 1999
+ * (c) The GHC Team, 1999-2011
  *
- * Dynamically expanding linear hash tables, as described in
- * Per-\AAke Larson, ``Dynamic Hash Tables,'' CACM 31(4), April 1988,
- * pp. 446 -- 457.
+ * Dynamically expanding hash tables, using open addressing with
+ * linear probing and Robin Hood insertion, as described in
+ * Pedro Celis, ``Robin Hood Hashing,'' PhD thesis, University of
+ * Waterloo, 1986.
  * -------------------------------------------------------------------------- */
 
 #include "PosixSource.h"
@@ -16,87 +17,85 @@
 
 #include <string.h>
 
-#define HSEGSIZE    1024    /* Size of a single hash table segment */
-			    /* Also the minimum size of a hash table */
-#define HDIRSIZE    1024    /* Size of the segment directory */
-			    /* Maximum hash table size is HSEGSIZE * HDIRSIZE */
-#define HLOAD	    5	    /* Maximum average load of a single hash bucket */
-
-#define HCHUNK	    (1024 * sizeof(W_) / sizeof(HashList))
-			    /* Number of HashList cells to allocate in one go */
+#define HINITSIZE   64      /* Initial number of slots; a power of 2 */
+#define HLOAD_NUM   4       /* Maximum load is HLOAD_NUM/HLOAD_DEN: */
+#define HLOAD_DEN   5       /*   we expand before we get fuller than that */
 
+/* -----------------------------------------------------------------------------
+ * The table is a flat, power-of-2 sized array of slots.  Each slot
+ * caches the full hash of its key, which saves calling the compare
+ * function (strcmp, for string tables) on a mismatch and re-hashing
+ * when the table expands.  A hash of 0 marks an empty slot; hashKey()
+ * never returns 0.
+ *
+ * Robin Hood insertion keeps every key within a short distance of
+ * its home slot (hash & mask): a new entry takes the place of any
+ * entry that is closer to home than it is, and that entry moves on
+ * instead.  A lookup can then stop as soon as it sees an entry closer
+ * to home than the key would be.  Removal shifts the following
+ * entries back, so there are no tombstones.
+ *
+ * The same key may be inserted several times.  As with the old
+ * chained table, lookupHashTable() and removeHashTable(table,key,NULL)
+ * find the most recently inserted entry: entries with equal keys
+ * share a home slot, and we keep them in probe order newest first.
+ * -------------------------------------------------------------------------- */
 
-/* Linked list of (key, data) pairs for separate chaining */
-typedef struct hashlist {
+typedef struct {
     StgWord key;
     void *data;
-    struct hashlist *next;  /* Next cell in bucket chain (same hash value) */
-} HashList;
+    StgWord hash;           /* hash of key, 0 if the slot is empty */
+} HashSlot;
 
-typedef struct chunklist {
-  HashList *chunk;
-  struct chunklist *next;
-} HashListChunk;
+/* The kind of keys, so that the common cases don't have to go
+ * through the hash and compare function pointers. */
+typedef enum {
+    HASH_KEY_WORD,
+    HASH_KEY_STR,
+    HASH_KEY_OTHER
+} HashKeyKind;
 
 struct hashtable {
-    int split;		    /* Next bucket to split when expanding */
-    int max;		    /* Max bucket of smaller table */
-    int mask1;		    /* Mask for doing the mod of h_1 (smaller table) */
-    int mask2;		    /* Mask for doing the mod of h_2 (larger table) */
-    int kcount;		    /* Number of keys */
-    int bcount;		    /* Number of buckets */
-    HashList **dir[HDIRSIZE];	/* Directory of segments */
-    HashList *freeList;         /* free list of HashLists */
-    HashListChunk *chunks;
+    HashSlot *slots;            /* Array of size slots */
+    StgWord size;               /* Number of slots, a power of 2 */
+    StgWord mask;               /* size - 1 */
+    StgWord kcount;             /* Number of keys */
+    HashKeyKind kind;
     HashFunction *hash;         /* hash function */
     CompareFunction *compare;   /* key comparison function */
 };
 
 /* -----------------------------------------------------------------------------
- * Hash first using the smaller table.  If the bucket is less than the
- * next bucket to be split, re-hash using the larger table.
+ * Hash functions.  These return the full hash of the key; the table
+ * masks it down to the number of slots itself.
  * -------------------------------------------------------------------------- */
 
 int
-hashWord(HashTable *table, StgWord key)
+hashWord(HashTable *table STG_UNUSED, StgWord key)
 {
-    int bucket;
-
-    /* Strip the boring zero bits */
-    key /= sizeof(StgWord);
-
-    /* Mod the size of the hash table (a power of 2) */
-    bucket = key & table->mask1;
-
-    if (bucket < table->split) {
-	/* Mod the size of the expanded hash table (also a power of 2) */
-	bucket = key & table->mask2;
-    }
-    return bucket;
+    /* Fibonacci hashing: multiply by 2^w/phi and keep the top half,
+     * which depends on every bit of the key, including the ones above
+     * the boring zero bits at the bottom of a pointer. */
+#if SIZEOF_VOID_P == 8
+    return (int)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+#else
+    StgWord h = key * 0x9E3779B9UL;
+    return (int)(h ^ (h >> 16));
+#endif
 }
 
 int
-hashStr(HashTable *table, char *key)
+hashStr(HashTable *table STG_UNUSED, char *key)
 {
-    int h, bucket;
+    /* FNV-1a */
+    StgWord32 h = 2166136261U;
     char *s;
 
-    s = key;
-    for (h=0; *s; s++) {
-	h *= 128;
-	h += *s;
-	h = h % 1048583;	/* some random large prime */
+    for (s = key; *s; s++) {
+        h ^= (StgWord8)*s;
+        h *= 16777619U;
     }
-
-    /* Mod the size of the hash table (a power of 2) */
-    bucket = h & table->mask1;
-
-    if (bucket < table->split) {
-	/* Mod the size of the expanded hash table (also a power of 2) */
-	bucket = h & table->mask2;
-    }
-
-    return bucket;
+    return (int)h;
 }
 
 static int
@@ -111,195 +110,249 @@ compareStr(StgWord key1, StgWord key2)
     return (strcmp((char *)key1, (char *)key2) == 0);
 }
 
+/* The kind argument is always a constant at the call sites below, so
+ * each of lookup/insert/remove gets a specialised copy per kind. */
 
-/* -----------------------------------------------------------------------------
- * Allocate a new segment of the dynamically growing hash table.
- * -------------------------------------------------------------------------- */
+STATIC_INLINE StgWord
+hashKey(HashTable *table, StgWord key, HashKeyKind kind)
+{
+    StgWord h;
+
+    switch (kind) {
+    case HASH_KEY_WORD:
+        h = (StgWord)(StgWord32)hashWord(table, key);
+        break;
+    case HASH_KEY_STR:
+        h = (StgWord)(StgWord32)hashStr(table, (char *)key);
+        break;
+    default:
+        h = (StgWord)(StgWord32)table->hash(table, key);
+        break;
+    }
+    return h == 0 ? 1 : h;
+}
 
-static void
-allocSegment(HashTable *table, int segment)
+STATIC_INLINE rtsBool
+equalKey(HashTable *table, StgWord key1, StgWord key2, HashKeyKind kind)
 {
-    table->dir[segment] = stgMallocBytes(HSEGSIZE * sizeof(HashList *), 
-					 "allocSegment");
+    switch (kind) {
+    case HASH_KEY_WORD:
+        return key1 == key2;
+    case HASH_KEY_STR:
+        return strcmp((char *)key1, (char *)key2) == 0;
+    default:
+        return table->compare(key1, key2) != 0;
+    }
 }
 
+/* Distance of the entry in slot i from its home slot */
+#define PROBE_DIST(table,i) (((i) - (table)->slots[i].hash) & (table)->mask)
 
 /* -----------------------------------------------------------------------------
- * Expand the larger hash table by one bucket, and split one bucket
- * from the smaller table into two parts.  Only the bucket referenced
- * by @table->split@ is affected by the expansion.
+ * Put an entry into the table, which must have room for it.
+ *
+ * If 'newest' is set, the entry goes in front of any entries with an
+ * equal key; otherwise it goes behind them.  expand() re-inserts
+ * entries in their existing probe order, so it needs the latter.
  * -------------------------------------------------------------------------- */
 
-static void
-expand(HashTable *table)
+STATIC_INLINE void
+insertSlot(HashTable *table, HashSlot ins, rtsBool newest, HashKeyKind kind)
 {
-    int oldsegment;
-    int oldindex;
-    int newbucket;
-    int newsegment;
-    int newindex;
-    HashList *hl;
-    HashList *next;
-    HashList *old, *new;
-
-    if (table->split + table->max >= HDIRSIZE * HSEGSIZE)
-	/* Wow!  That's big.  Too big, so don't expand. */
-	return;
-
-    /* Calculate indices of bucket to split */
-    oldsegment = table->split / HSEGSIZE;
-    oldindex = table->split % HSEGSIZE;
-
-    newbucket = table->max + table->split;
-
-    /* And the indices of the new bucket */
-    newsegment = newbucket / HSEGSIZE;
-    newindex = newbucket % HSEGSIZE;
-
-    if (newindex == 0)
-	allocSegment(table, newsegment);
-
-    if (++table->split == table->max) {
-	table->split = 0;
-	table->max *= 2;
-	table->mask1 = table->mask2;
-	table->mask2 = table->mask2 << 1 | 1;
+    HashSlot tmp;
+    StgWord i, dist, sdist;
+
+    i = ins.hash & table->mask;
+    dist = 0;
+
+    for (;;) {
+        if (table->slots[i].hash == 0) {
+            table->slots[i] = ins;
+            return;
+        }
+        sdist = PROBE_DIST(table,i);
+        if (sdist < dist
+            || (newest && sdist == dist
+                && table->slots[i].hash == ins.hash
+                && equalKey(table, table->slots[i].key, ins.key, kind))) {
+            tmp = table->slots[i];
+            table->slots[i] = ins;
+            ins = tmp;
+            dist = sdist;
+            /* the displaced entry is newer than any entries with an
+             * equal key further along */
+            newest = rtsTrue;
+        }
+        i = (i + 1) & table->mask;
+        dist++;
     }
-    table->bcount++;
-
-    /* Split the bucket, paying no attention to the original order */
-
-    old = new = NULL;
-    for (hl = table->dir[oldsegment][oldindex]; hl != NULL; hl = next) {
-	next = hl->next;
-	if (table->hash(table, hl->key) == newbucket) {
-	    hl->next = new;
-	    new = hl;
-	} else {
-	    hl->next = old;
-	    old = hl;
-	}
-    }
-    table->dir[oldsegment][oldindex] = old;
-    table->dir[newsegment][newindex] = new;
-
-    return;
 }
 
-void *
-lookupHashTable(HashTable *table, StgWord key)
-{
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
-
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
+/* -----------------------------------------------------------------------------
+ * Double the size of the table.
+ * -------------------------------------------------------------------------- */
 
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next)
-	if (table->compare(hl->key, key))
-	    return hl->data;
+static void
+expand(HashTable *table)
+{
+    HashSlot *old_slots;
+    StgWord old_size, old_mask, start, i, n;
+
+    old_slots = table->slots;
+    old_size  = table->size;
+    old_mask  = table->mask;
+
+    table->size = old_size * 2;
+    table->mask = table->size - 1;
+    table->slots = stgMallocBytes(table->size * sizeof(HashSlot), "expand");
+    memset(table->slots, 0, table->size * sizeof(HashSlot));
+
+    /* Start just after an empty slot, so that we visit each run of
+     * entries in probe order; the load factor guarantees that there is
+     * one. */
+    for (start = 0; old_slots[start].hash != 0; start++)
+        ;
+
+    for (n = 0; n < old_size; n++) {
+        i = (start + n) & old_mask;
+        if (old_slots[i].hash != 0) {
+            insertSlot(table, old_slots[i], rtsFalse, table->kind);
+        }
+    }
 
-    /* It's not there */
-    return NULL;
+    stgFree(old_slots);
 }
 
 /* -----------------------------------------------------------------------------
- * We allocate the hashlist cells in large chunks to cut down on malloc
- * overhead.  Although we keep a free list of hashlist cells, we make
- * no effort to actually return the space to the malloc arena.
+ * Lookup, insertion and removal
  * -------------------------------------------------------------------------- */
 
-static HashList *
-allocHashList (HashTable *table)
+/* Index of the newest slot holding key (and data, unless data is
+ * NULL), or table->size if there isn't one. */
+STATIC_INLINE StgWord
+findSlot(HashTable *table, StgWord key, void *data, HashKeyKind kind)
 {
-    HashList *hl, *p;
-    HashListChunk *cl;
-
-    if ((hl = table->freeList) != NULL) {
-        table->freeList = hl->next;
-    } else {
-        hl = stgMallocBytes(HCHUNK * sizeof(HashList), "allocHashList");
-	cl = stgMallocBytes(sizeof (*cl), "allocHashList: chunkList");
-        cl->chunk = hl;
-        cl->next = table->chunks;
-        table->chunks = cl;
-
-        table->freeList = hl + 1;
-        for (p = table->freeList; p < hl + HCHUNK - 1; p++)
-	    p->next = p + 1;
-	p->next = NULL;
+    StgWord h, i, dist;
+
+    h = hashKey(table, key, kind);
+    i = h & table->mask;
+
+    for (dist = 0; ; dist++) {
+        if (table->slots[i].hash == 0 || PROBE_DIST(table,i) < dist) {
+            /* It's not there */
+            return table->size;
+        }
+        if (table->slots[i].hash == h
+            && equalKey(table, table->slots[i].key, key, kind)
+            && (data == NULL || table->slots[i].data == data)) {
+            return i;
+        }
+        i = (i + 1) & table->mask;
     }
-    return hl;
 }
 
-static void
-freeHashList (HashTable *table, HashList *hl)
+STATIC_INLINE void *
+lookup_(HashTable *table, StgWord key, HashKeyKind kind)
 {
-    hl->next = table->freeList;
-    table->freeList = hl;
+    StgWord i;
+
+    i = findSlot(table, key, NULL, kind);
+    if (i == table->size) {
+        return NULL;
+    }
+    return table->slots[i].data;
 }
 
-void
-insertHashTable(HashTable *table, StgWord key, void *data)
+void *
+lookupHashTable(HashTable *table, StgWord key)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
+    switch (table->kind) {
+    case HASH_KEY_WORD:
+        return lookup_(table, key, HASH_KEY_WORD);
+    case HASH_KEY_STR:
+        return lookup_(table, key, HASH_KEY_STR);
+    default:
+        return lookup_(table, key, HASH_KEY_OTHER);
+    }
+}
+
+STATIC_INLINE void
+insert_(HashTable *table, StgWord key, void *data, HashKeyKind kind)
+{
+    HashSlot ins;
 
     // Disable this assert; sometimes it's useful to be able to
     // overwrite entries in the hash table.
     // ASSERT(lookupHashTable(table, key) == NULL);
 
-    /* When the average load gets too high, we expand the table */
-    if (++table->kcount >= HLOAD * table->bcount)
-	expand(table);
+    /* When the load gets too high, we expand the table */
+    if ((table->kcount + 1) * HLOAD_DEN > table->size * HLOAD_NUM) {
+        expand(table);
+    }
+
+    ins.key  = key;
+    ins.data = data;
+    ins.hash = hashKey(table, key, kind);
+    insertSlot(table, ins, rtsTrue, kind);
+    table->kcount++;
+}
+
+void
+insertHashTable(HashTable *table, StgWord key, void *data)
+{
+    switch (table->kind) {
+    case HASH_KEY_WORD:
+        insert_(table, key, data, HASH_KEY_WORD);
+        break;
+    case HASH_KEY_STR:
+        insert_(table, key, data, HASH_KEY_STR);
+        break;
+    default:
+        insert_(table, key, data, HASH_KEY_OTHER);
+        break;
+    }
+}
 
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
+STATIC_INLINE void *
+remove_(HashTable *table, StgWord key, void *data, HashKeyKind kind)
+{
+    StgWord i, j;
+    void *removed;
+
+    i = findSlot(table, key, data, kind);
+    if (i == table->size) {
+        /* It's not there */
+        ASSERT(data == NULL);
+        return NULL;
+    }
 
-    hl = allocHashList(table);
+    removed = table->slots[i].data;
 
-    hl->key = key;
-    hl->data = data;
-    hl->next = table->dir[segment][index];
-    table->dir[segment][index] = hl;
+    /* Shift the rest of the run back by one, until we reach an empty
+     * slot or an entry that is already in its home slot. */
+    j = (i + 1) & table->mask;
+    while (table->slots[j].hash != 0 && PROBE_DIST(table,j) != 0) {
+        table->slots[i] = table->slots[j];
+        i = j;
+        j = (j + 1) & table->mask;
+    }
+    table->slots[i].hash = 0;
+    table->kcount--;
 
+    return removed;
 }
 
 void *
 removeHashTable(HashTable *table, StgWord key, void *data)
 {
-    int bucket;
-    int segment;
-    int index;
-    HashList *hl;
-    HashList *prev = NULL;
-
-    bucket = table->hash(table, key);
-    segment = bucket / HSEGSIZE;
-    index = bucket % HSEGSIZE;
-
-    for (hl = table->dir[segment][index]; hl != NULL; hl = hl->next) {
-	if (table->compare(hl->key,key) && (data == NULL || hl->data == data)) {
-	    if (prev == NULL)
-		table->dir[segment][index] = hl->next;
-	    else
-		prev->next = hl->next;
-            freeHashList(table,hl);
-	    table->kcount--;
-	    return hl->data;
-	}
-	prev = hl;
+    switch (table->kind) {
+    case HASH_KEY_WORD:
+        return remove_(table, key, data, HASH_KEY_WORD);
+    case HASH_KEY_STR:
+        return remove_(table, key, data, HASH_KEY_STR);
+    default:
+        return remove_(table, key, data, HASH_KEY_OTHER);
     }
-
-    /* It's not there */
-    ASSERT(data == NULL);
-    return NULL;
 }
 
 /* -----------------------------------------------------------------------------
@@ -311,80 +364,64 @@ removeHashTable(HashTable *table, StgWord key, void *data)
 void
 freeHashTable(HashTable *table, void (*freeDataFun)(void *) )
 {
-    long segment;
-    long index;
-    HashList *hl;
-    HashList *next;
-    HashListChunk *cl, *cl_next;
-
-    /* The last bucket with something in it is table->max + table->split - 1 */
-    segment = (table->max + table->split - 1) / HSEGSIZE;
-    index = (table->max + table->split - 1) % HSEGSIZE;
-
-    while (segment >= 0) {
-	while (index >= 0) {
-	    for (hl = table->dir[segment][index]; hl != NULL; hl = next) {
-		next = hl->next;
-		if (freeDataFun != NULL)
-		    (*freeDataFun)(hl->data);
+    StgWord i;
+
+    if (freeDataFun != NULL) {
+        for (i = 0; i < table->size; i++) {
+            if (table->slots[i].hash != 0) {
+                (*freeDataFun)(table->slots[i].data);
             }
-	    index--;
-	}
-	stgFree(table->dir[segment]);
-	segment--;
-	index = HSEGSIZE - 1;
-    }
-    for (cl = table->chunks; cl != NULL; cl = cl_next) {
-        cl_next = cl->next;
-        stgFree(cl->chunk);
-        stgFree(cl);
+        }
     }
+    stgFree(table->slots);
     stgFree(table);
 }
 
 /* -----------------------------------------------------------------------------
- * When we initialize a hash table, we set up the first segment as well,
- * initializing all of the first segment's hash buckets to NULL.
+ * When we initialize a hash table, we allocate the initial array of
+ * slots and mark them all empty.
  * -------------------------------------------------------------------------- */
 
-HashTable *
-allocHashTable_(HashFunction *hash, CompareFunction *compare)
+static HashTable *
+allocHashTableKind(HashFunction *hash, CompareFunction *compare,
+                   HashKeyKind kind)
 {
     HashTable *table;
-    HashList **hb;
 
     table = stgMallocBytes(sizeof(HashTable),"allocHashTable");
 
-    allocSegment(table, 0);
+    table->size = HINITSIZE;
+    table->mask = HINITSIZE - 1;
+    table->slots = stgMallocBytes(HINITSIZE * sizeof(HashSlot),
+                                  "allocHashTable");
+    memset(table->slots, 0, HINITSIZE * sizeof(HashSlot));
 
-    for (hb = table->dir[0]; hb < table->dir[0] + HSEGSIZE; hb++)
-	*hb = NULL;
-
-    table->split = 0;
-    table->max = HSEGSIZE;
-    table->mask1 = HSEGSIZE - 1;
-    table->mask2 = 2 * HSEGSIZE - 1;
     table->kcount = 0;
-    table->bcount = HSEGSIZE;
-    table->freeList = NULL;
-    table->chunks = NULL;
+    table->kind = kind;
     table->hash = hash;
     table->compare = compare;
 
     return table;
 }
 
+HashTable *
+allocHashTable_(HashFunction *hash, CompareFunction *compare)
+{
+    return allocHashTableKind(hash, compare, HASH_KEY_OTHER);
+}
+
 HashTable *
 allocHashTable(void)
 {
-    return allocHashTable_(hashWord, compareWord);
+    return allocHashTableKind(hashWord, compareWord, HASH_KEY_WORD);
 }
 
 HashTable *
 allocStrHashTable(void)
 {
-    return allocHashTable_((HashFunction *)hashStr, 
-			   (CompareFunction *)compareStr);
+    return allocHashTableKind((HashFunction *)hashStr,
+                              (CompareFunction *)compareStr,
+                              HASH_KEY_STR);
 }
 
 void
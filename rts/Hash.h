@@ -34,7 +34,9 @@ HashTable * allocStrHashTable ( void );
 #define removeStrHashTable(table, key, data) \
    (removeHashTable(table, (StgWord)key, data))
 
-/* Hash tables for arbitrary keys */
+/* Hash tables for arbitrary keys.  A HashFunction returns a hash of
+ * the whole key; the table reduces it to a slot index itself.
+ */
 typedef int HashFunction(HashTable *table, StgWord key);
 typedef int CompareFunction(StgWord key1, StgWord key2);
 HashTable * allocHashTable_(HashFunction *hash, CompareFunction *compare);
@@ -17,6 +17,7 @@
 #include "Stats.h"
 #include "RtsUtils.h"
 #include "Schedule.h"
+#include "sm/Storage.h"
 
 /* --------------------------------------------------------------------------
  * This function is called eventually on every object destroyed during
@@ -174,19 +175,23 @@ processNurseryForDead( void )
 {
     StgPtr p, bdLimit;
     bdescr *bd;
+    nat n;
 
-    bd = MainCapability.r.rNursery->blocks;
-    while (bd->start < bd->free) {
-	p = bd->start;
-	bdLimit = bd->start + BLOCK_SIZE_W;
-	while (p < bd->free && p < bdLimit) {
-	    p += processHeapClosureForDead((StgClosure *)p);
-	    while (p < bd->free && p < bdLimit && !*p)  // skip slop
-		p++;
-	}
-	bd = bd->link;
-	if (bd == NULL)
-	    break;
+    // with +RTS -n the Capability may have used several nurseries
+    for (n = 0; n < n_nurseries; n++) {
+        bd = nurseries[n].blocks;
+        while (bd->start < bd->free) {
+            p = bd->start;
+            bdLimit = bd->start + BLOCK_SIZE_W;
+            while (p < bd->free && p < bdLimit) {
+                p += processHeapClosureForDead((StgClosure *)p);
+                while (p < bd->free && p < bdLimit && !*p)  // skip slop
+                    p++;
+            }
+            bd = bd->link;
+            if (bd == NULL)
+                break;
+        }
     }
 }
 
@@ -1071,6 +1071,7 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(getOrSetSystemEventThreadEventManagerStore)         \
       SymI_HasProto(getOrSetSystemEventThreadIOManagerThreadStore)      \
       SymI_HasProto(getGCStats)                         \
+      SymI_HasProto(getStmStats)                        \
       SymI_HasProto(genSymZh)                           \
       SymI_HasProto(genericRaise)                       \
       SymI_HasProto(getProgArgv)                        \
@@ -1150,6 +1151,8 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(rts_getFunPtr)                      \
       SymI_HasProto(rts_getStablePtr)                   \
       SymI_HasProto(rts_getThreadId)                    \
+      SymI_HasProto(rts_setThreadPriority)              \
+      SymI_HasProto(rts_getThreadPriority)              \
       SymI_HasProto(rts_getWord)                        \
       SymI_HasProto(rts_getWord8)                       \
       SymI_HasProto(rts_getWord16)                      \
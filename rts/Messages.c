@@ -208,7 +208,7 @@ loop:
         owner = (StgTSO*)p;
 
 #ifdef THREADED_RTS
-        if (owner->cap != cap) {
+        if (!reclaimThread(cap, owner)) {
             sendMessage(cap, owner->cap, (Message*)msg);
             debugTraceCap(DEBUG_sched, cap, "forwarding message to cap %d", owner->cap->no);
             return 1;
@@ -272,7 +272,7 @@ loop:
         ASSERT(owner != END_TSO_QUEUE);
 
 #ifdef THREADED_RTS
-        if (owner->cap != cap) {
+        if (!reclaimThread(cap, owner)) {
             sendMessage(cap, owner->cap, (Message*)msg);
             debugTraceCap(DEBUG_sched, cap, "forwarding message to cap %d", owner->cap->no);
             return 1;
@@ -205,8 +205,8 @@ check_target:
     traceThreadStatus(DEBUG_sched, target);
 #endif
 
-    target_cap = target->cap;
-    if (target->cap != cap) {
+    if (!reclaimThread(cap, target)) {
+        target_cap = target->cap;
         throwToSendMsg(cap, target_cap, msg);
         return THROWTO_BLOCKED;
     }
@@ -656,8 +656,10 @@ removeFromQueues(Capability *cap, StgTSO *tso)
   case BlockedOnWrite:
 #if defined(mingw32_HOST_OS)
   case BlockedOnDoProc:
-#endif
       removeThreadFromDeQueue(cap, &blocked_queue_hd, &blocked_queue_tl, tso);
+#else
+      removeThreadFromFdWaiters(cap, tso);
+#endif
 #if defined(mingw32_HOST_OS)
       /* (Cooperatively) signal that the worker thread should abort
        * the request.
@@ -667,7 +669,9 @@ removeFromQueues(Capability *cap, StgTSO *tso)
       goto done;
 
   case BlockedOnDelay:
-        removeThreadFromQueue(cap, &sleeping_queue, tso);
+#if !defined(mingw32_HOST_OS)
+        removeThreadFromSleepers(tso);
+#endif
 	goto done;
 #endif
 
@@ -13,6 +13,7 @@
 #include "RtsUtils.h"
 #include "Profiling.h"
 #include "RtsFlags.h"
+#include "sm/OSMem.h"
 
 #ifdef HAVE_CTYPE_H
 #include <ctype.h>
@@ -127,6 +128,16 @@ void initRtsFlagsDefaults(void)
 #else
     RtsFlags.GcFlags.heapBase           = 0;   /* means don't care */
 #endif
+    RtsFlags.GcFlags.decommit           = DECOMMIT_EAGER;
+    RtsFlags.GcFlags.retainFree         = 0;
+    RtsFlags.GcFlags.retainFreeAuto     = rtsTrue;
+    RtsFlags.GcFlags.numa               = rtsFalse;
+    RtsFlags.GcFlags.numaMask           = 1;
+    RtsFlags.GcFlags.concurrentMark     = rtsFalse;
+    RtsFlags.GcFlags.compactBudget      = 0;
+    RtsFlags.GcFlags.nurseryChunkSize   = 0;
+    RtsFlags.GcFlags.adaptiveNursery    = rtsFalse;
+    RtsFlags.GcFlags.reusePinned        = 0;
 
 #ifdef DEBUG
     RtsFlags.DebugFlags.scheduler	= rtsFalse;
@@ -144,6 +155,7 @@ void initRtsFlagsDefaults(void)
     RtsFlags.DebugFlags.squeeze		= rtsFalse;
     RtsFlags.DebugFlags.hpc		= rtsFalse;
     RtsFlags.DebugFlags.sparks		= rtsFalse;
+    RtsFlags.DebugFlags.numa		= rtsFalse;
 #endif
 
 #if defined(PROFILING)
@@ -188,6 +200,11 @@ void initRtsFlagsDefaults(void)
     RtsFlags.MiscFlags.install_signal_handlers = rtsTrue;
     RtsFlags.MiscFlags.machineReadable = rtsFalse;
     RtsFlags.MiscFlags.linkerMemBase    = 0;
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CTL)
+    RtsFlags.MiscFlags.ioManager        = IO_MANAGER_EPOLL;
+#else
+    RtsFlags.MiscFlags.ioManager        = IO_MANAGER_SELECT;
+#endif
 
 #ifdef THREADED_RTS
     RtsFlags.ParFlags.nNodes	        = 1;
@@ -197,11 +214,16 @@ void initRtsFlagsDefaults(void)
     RtsFlags.ParFlags.parGcLoadBalancingEnabled = rtsTrue;
     RtsFlags.ParFlags.parGcLoadBalancingGen = 1;
     RtsFlags.ParFlags.parGcNoSyncWithIdle   = 0;
+    RtsFlags.ParFlags.parGcNoSyncWithoutAlloc = rtsFalse;
     RtsFlags.ParFlags.setAffinity       = 0;
+    RtsFlags.ParFlags.stmVersionClock   = rtsFalse;
+    RtsFlags.ParFlags.stmContention     = STM_CM_BACKOFF;
+    RtsFlags.ParFlags.stmSerializeAfter = 16;
 #endif
 
 #if defined(THREADED_RTS)
     RtsFlags.ParFlags.maxLocalSparks	= 4096;
+    RtsFlags.ParFlags.sparkPoolLimit	= 1048576;
 #endif /* THREADED_RTS */
 
 #ifdef TICKY_TICKY
@@ -237,6 +259,13 @@ usage_text[] = {
 "  -kb<size> Sets the stack chunk buffer size (default 1k)",
 "",
 "  -A<size> Sets the minimum allocation area size (default 512k) Egs: -A1m -A10k",
+"  -n<size> Allocation area chunk size (0 = disabled, default: 0)",
+"  --adaptive-nursery",
+"           Choose the allocation area size from the CPU cache size, and",
+"           adjust it after each GC according to how much survives",
+"  --reuse-pinned[=<n>]",
+"           Allocate small pinned objects into the free space of pinned",
+"           blocks that are less than <n>% in use (default: 50)",
 "  -M<size> Sets the maximum heap size (default unlimited)  Egs: -M256k -M1G",
 "  -H<size> Sets the minimum heap size (default 0M)   Egs: -H24m  -H1G",
 "  -m<n>    Minimum % of heap which must be available (default 3%)",
@@ -247,6 +276,10 @@ usage_text[] = {
 "  -c       Use in-place compaction for all oldest generation collections",
 "           (the default is to use copying)",
 "  -w       Use mark-region for the oldest generation (experimental)",
+"  --compact-budget=<size>",
+"           Where compaction would be used, sweep the oldest generation",
+"           instead, and copy at most <size> bytes of live data out of its",
+"           most fragmented blocks in each major GC",
 #if defined(THREADED_RTS)
 "  -I<sec>  Perform full GC after <sec> idle time (default: 0.3, 0 == off)",
 #endif
@@ -355,6 +388,8 @@ usage_text[] = {
 "  -Dz  DEBUG: stack squeezing",
 "  -Dc  DEBUG: program coverage",
 "  -Dr  DEBUG: sparks",
+"  --debug-numa=<n>",
+"       DEBUG: pretend the machine has <n> NUMA nodes (implies --numa)",
 "",
 "     NOTE: DEBUG events are sent to stderr by default; add -l to create a",
 "     binary event log file instead.",
@@ -372,11 +407,52 @@ usage_text[] = {
 "  -qi<n>    If a processor has been idle for the last <n> GCs, do not",
 "            wake it up for a non-load-balancing parallel GC.",
 "            (0 disables,  default: 0)",
+"  -ql       Do not wake up a processor that has not allocated since the",
+"            last GC for a non-load-balancing parallel GC.",
 #endif
 "  --install-signal-handlers=<yes|no>",
 "            Install signal handlers (default: yes)",
+"  --decommit=<yes|lazy|no>",
+"            Give free heap memory beyond the --retain-free target back",
+"            to the OS after GC, with MADV_DONTNEED (yes, the default) or",
+"            MADV_FREE (lazy), or not at all (no)",
+"  --retain-free=<size>",
+"            Keep up to <size> bytes of free heap memory for reuse",
+"            (default: as much as the heap has in use)",
+"  --numa[=<mask>]",
+"            Allocate memory and place capabilities on the NUMA nodes in",
+"            <mask> (default: all the nodes the process may use)",
+#if defined(THREADED_RTS)
+"  --concurrent-mark",
+"            Mark the oldest generation in a background thread while the",
+"            program runs, instead of stopping it for a major GC",
+"  --stm-clock",
+"            Check each TVar read by an STM transaction against a global",
+"            version clock, so that conflicts are found early and",
+"            read-only transactions commit without locking",
+"  --stm-cm=<none|backoff|age|aborts>",
+"            What to do when an STM transaction fails to commit: re-run",
+"            it at once (none), after a backoff that grows with each",
+"            failure (backoff, the default), or also run the oldest",
+"            (age) or most often failed (aborts) transaction that keeps",
+"            failing on its own",
+"  --stm-serialize=<n>",
+"            Let a transaction run on its own once it has failed <n>",
+"            times, under --stm-cm=age or aborts (default: 16)",
+#endif
+#if !defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
+"  --io-manager=<select|epoll>",
+"            How to wait for I/O in the non-threaded RTS",
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CTL)
+"            (default: epoll)",
+#else
+"            (default: select; epoll is not supported on this platform)",
+#endif
+#endif
 #if defined(THREADED_RTS)
-"  -e<n>     Maximum number of outstanding local sparks (default: 4096)",
+"  -e<n>     Initial size of each capability's spark pool (default: 4096)",
+"  --spark-pool-limit=<n>",
+"            Let a spark pool grow up to <n> sparks (default: 1048576)",
 #endif
 #if defined(x86_64_HOST_ARCH)
 "  -xm       Base address to mmap memory in the GHCi linker",
@@ -688,11 +764,178 @@ error = rtsTrue;
                       OPTION_UNSAFE;
                       RtsFlags.MiscFlags.install_signal_handlers = rtsFalse;
                   }
+                  else if (strequal("io-manager=select",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.MiscFlags.ioManager = IO_MANAGER_SELECT;
+                  }
+                  else if (strequal("io-manager=epoll",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.MiscFlags.ioManager = IO_MANAGER_EPOLL;
+                  }
                   else if (strequal("machine-readable",
                                &rts_argv[arg][2])) {
                       OPTION_UNSAFE;
                       RtsFlags.MiscFlags.machineReadable = rtsTrue;
                   }
+                  else if (strequal("decommit=yes",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.decommit = DECOMMIT_EAGER;
+                  }
+                  else if (strequal("decommit=lazy",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.decommit = DECOMMIT_LAZY;
+                  }
+                  else if (strequal("decommit=no",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.decommit = DECOMMIT_NONE;
+                  }
+                  else if (strncmp("retain-free=", &rts_argv[arg][2], 12) == 0) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.retainFreeAuto = rtsFalse;
+                      RtsFlags.GcFlags.retainFree =
+                          (nat)(decodeSize(rts_argv[arg], 14, 0, HS_WORD_MAX)
+                                / BLOCK_SIZE);
+                  }
+                  else if (strequal("numa", &rts_argv[arg][2]) ||
+                           strncmp("numa=", &rts_argv[arg][2], 5) == 0) {
+                      StgWord mask;
+                      OPTION_SAFE;
+                      if (rts_argv[arg][6] == '=') {
+                          mask = (StgWord)strtoul(rts_argv[arg]+7,
+                                                  (char **)NULL, 0);
+                      } else {
+                          mask = (StgWord)~0;
+                      }
+                      if (!osNumaAvailable()) {
+                          errorBelch("%s: the OS reports that NUMA is not available",
+                                     rts_argv[arg]);
+                          error = rtsTrue;
+                          break;
+                      }
+                      RtsFlags.GcFlags.numa = rtsTrue;
+                      RtsFlags.GcFlags.numaMask = mask;
+                  }
+                  else if (strequal("adaptive-nursery",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.adaptiveNursery = rtsTrue;
+                  }
+                  else if (strequal("reuse-pinned", &rts_argv[arg][2]) ||
+                           strncmp("reuse-pinned=", &rts_argv[arg][2], 13) == 0) {
+                      OPTION_UNSAFE;
+                      if (rts_argv[arg][14] == '=') {
+                          nat pct = (nat)strtol(rts_argv[arg]+15,
+                                                (char **)NULL, 10);
+                          if (pct == 0 || pct > 100) {
+                              errorBelch("%s: the percentage must be between 1 and 100",
+                                         rts_argv[arg]);
+                              error = rtsTrue;
+                              break;
+                          }
+                          RtsFlags.GcFlags.reusePinned = pct;
+                      } else {
+                          RtsFlags.GcFlags.reusePinned = 50;
+                      }
+                  }
+                  else if (strncmp("compact-budget=", &rts_argv[arg][2], 15) == 0) {
+                      OPTION_UNSAFE;
+                      RtsFlags.GcFlags.compactBudget =
+                          (nat)(decodeSize(rts_argv[arg], 17, BLOCK_SIZE, HS_WORD_MAX)
+                                / BLOCK_SIZE);
+                  }
+                  else if (strequal("concurrent-mark",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.GcFlags.concurrentMark = rtsTrue;
+                      )
+                  }
+                  else if (strequal("stm-clock",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                          RtsFlags.ParFlags.stmVersionClock = rtsTrue;
+                      )
+                  }
+                  else if (strncmp("stm-cm=", &rts_argv[arg][2], 7) == 0) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                      {
+                          char *policy = &rts_argv[arg][9];
+                          if (strequal(policy, "none")) {
+                              RtsFlags.ParFlags.stmContention = STM_CM_NONE;
+                          } else if (strequal(policy, "backoff")) {
+                              RtsFlags.ParFlags.stmContention = STM_CM_BACKOFF;
+                          } else if (strequal(policy, "age")) {
+                              RtsFlags.ParFlags.stmContention = STM_CM_AGE;
+                          } else if (strequal(policy, "aborts")) {
+                              RtsFlags.ParFlags.stmContention = STM_CM_ABORTS;
+                          } else {
+                              errorBelch("%s: unknown contention manager",
+                                         rts_argv[arg]);
+                              error = rtsTrue;
+                              break;
+                          }
+                      })
+                  }
+                  else if (strncmp("stm-serialize=", &rts_argv[arg][2], 14) == 0) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                      {
+                          nat n = (nat)strtol(rts_argv[arg]+16,
+                                              (char **)NULL, 10);
+                          if (n == 0) {
+                              errorBelch("%s: the number of aborts must be at least 1",
+                                         rts_argv[arg]);
+                              error = rtsTrue;
+                              break;
+                          }
+                          RtsFlags.ParFlags.stmSerializeAfter = n;
+                      })
+                  }
+                  else if (strncmp("spark-pool-limit=", &rts_argv[arg][2], 17) == 0) {
+                      OPTION_UNSAFE;
+                      THREADED_BUILD_ONLY(
+                      {
+                          nat n = (nat)strtol(rts_argv[arg]+19,
+                                              (char **)NULL, 10);
+                          if (n == 0) {
+                              errorBelch("bad value for %s", rts_argv[arg]);
+                              error = rtsTrue;
+                              break;
+                          }
+                          RtsFlags.ParFlags.sparkPoolLimit = n;
+                      })
+                  }
+                  else if (strncmp("debug-numa=", &rts_argv[arg][2], 11) == 0) {
+                      OPTION_SAFE;
+                      DEBUG_BUILD_ONLY(
+                      {
+                          nat nNodes;
+                          if (!isdigit(rts_argv[arg][13])) {
+                              errorBelch("%s: missing number of nodes",
+                                         rts_argv[arg]);
+                              error = rtsTrue;
+                              break;
+                          }
+                          nNodes = (nat)strtol(rts_argv[arg]+13,
+                                               (char **)NULL, 10);
+                          if (nNodes == 0 || nNodes > MAX_NUMA_NODES) {
+                              errorBelch("%s: number of nodes must be between 1 and %d",
+                                         rts_argv[arg], MAX_NUMA_NODES);
+                              error = rtsTrue;
+                              break;
+                          }
+                          RtsFlags.GcFlags.numa = rtsTrue;
+                          RtsFlags.DebugFlags.numa = rtsTrue;
+                          RtsFlags.GcFlags.numaMask = ((StgWord)1 << nNodes) - 1;
+                      })
+                  }
                   else if (strequal("info",
                                &rts_argv[arg][2])) {
                       OPTION_SAFE;
@@ -712,6 +955,14 @@ error = rtsTrue;
                            / BLOCK_SIZE;
                   break;
 
+	      case 'n':
+        	  OPTION_UNSAFE;
+                  // round up, so that only -n0 disables chunking
+                  RtsFlags.GcFlags.nurseryChunkSize
+                      = (decodeSize(rts_argv[arg], 2, 0, HS_INT_MAX)
+                         + BLOCK_SIZE - 1) / BLOCK_SIZE;
+                  break;
+
 #ifdef USE_PAPI
 	      case 'a':
         	OPTION_UNSAFE;
@@ -1217,6 +1468,9 @@ error = rtsTrue;
                         RtsFlags.ParFlags.parGcNoSyncWithIdle
                             = strtol(rts_argv[arg]+3, (char **) NULL, 10);
                         break;
+                    case 'l':
+                        RtsFlags.ParFlags.parGcNoSyncWithoutAlloc = rtsTrue;
+                        break;
                     case 'a':
 			RtsFlags.ParFlags.setAffinity = rtsTrue;
 			break;
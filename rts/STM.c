@@ -39,6 +39,23 @@
  * and, when committing a transaction, no locks are acquired for TVars that have
  * been read but not updated.
  *
+ * With the RTS option --stm-clock, STM_FG_LOCKS also keeps a global version
+ * clock, in the style of TL2.  A commit that updates TVars takes a new time
+ * from the clock and stores it in the num_updates field of each TVar it
+ * writes.  A transaction notes the time when it starts (read_version) and
+ * checks each TVar it reads against it.  If the TVar has been written since,
+ * the transaction re-checks everything it has read so far and moves its
+ * read_version on; if that fails it is condemned and sent back to the
+ * scheduler to be restarted, instead of running on to its commit.  The
+ * reads of a transaction are thus always a consistent snapshot, so a
+ * read-only transaction commits without locking or re-reading anything,
+ * and an updating transaction need only re-check its reads if another
+ * commit has taken a time since its read_version.
+ *
+ * STM_FG_LOCKS also has a contention manager, chosen with --stm-cm, which
+ * decides what to do when a transaction has to be re-run: see
+ * stmStartTransaction.
+ *
  * Concurrency control is implemented in the functions:
  *
  *    lock_stm
@@ -93,6 +110,7 @@
 #include "Threads.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #define TRUE 1
 #define FALSE 0
@@ -178,6 +196,8 @@ static int shake(void) {
 #undef IF_STM_UNIPROC
 #define IF_STM_UNIPROC(__X)  do { __X } while (0)
 static const StgBool config_use_read_phase = FALSE;
+static const StgBool config_use_version_clock = FALSE;
+static const StgWord stm_clock = 0;
 
 static void lock_stm(StgTRecHeader *trec STG_UNUSED) {
   TRACE("%p : lock_stm()", trec);
@@ -230,6 +250,8 @@ static void unlock_inv(StgAtomicInvariant *inv STG_UNUSED) {
 #undef IF_STM_CG_LOCK
 #define IF_STM_CG_LOCK(__X)  do { __X } while (0)
 static const StgBool config_use_read_phase = FALSE;
+static const StgBool config_use_version_clock = FALSE;
+static const StgWord stm_clock = 0;
 static volatile StgTRecHeader *smp_locked = NULL;
 
 static void lock_stm(StgTRecHeader *trec) {
@@ -289,6 +311,10 @@ static void unlock_inv(StgAtomicInvariant *inv STG_UNUSED) {
 #undef IF_STM_FG_LOCKS
 #define IF_STM_FG_LOCKS(__X) do { __X } while (0)
 static const StgBool config_use_read_phase = TRUE;
+#define config_use_version_clock (RtsFlags.ParFlags.stmVersionClock)
+
+// The version clock: the time of the latest commit to have updated TVars
+static volatile StgWord stm_clock = 0;
 
 static void lock_stm(StgTRecHeader *trec STG_UNUSED) {
   TRACE("%p : lock_stm()", trec);
@@ -373,10 +399,16 @@ static void unpark_tso(Capability *cap, StgTSO *tso) {
 
     // Unblocking a TSO from BlockedOnSTM is done under the TSO lock,
     // to avoid multiple CPUs unblocking the same TSO, and also to
-    // synchronise with throwTo().
+    // synchronise with throwTo().  The TSO is marked STM_AWOKEN, until
+    // it parks again, so that it is woken only once however many of
+    // the TVars it is waiting on are updated.
     lockTSO(tso);
-    if (tso -> why_blocked == BlockedOnSTM) {
+    if (tso -> why_blocked == BlockedOnSTM &&
+        tso -> block_info.closure == STM_AWOKEN) {
+	TRACE("unpark_tso already woken up tso=%p", tso);
+    } else if (tso -> why_blocked == BlockedOnSTM) {
 	TRACE("unpark_tso on tso=%p", tso);
+        tso -> block_info.closure = STM_AWOKEN;
         tryWakeupThread(cap,tso);
     } else {
 	TRACE("spurious unpark_tso on tso=%p", tso);
@@ -384,10 +416,16 @@ static void unpark_tso(Capability *cap, StgTSO *tso) {
     unlockTSO(tso);
 }
 
-static void unpark_waiters_on(Capability *cap, StgTVar *s) {
+// A commit gathers the threads waiting on the TVars it updates in
+// cap -> stm_wakeups, and wakes them once it has released the TVars:
+// then each thread is woken once per commit, and a TVar with many
+// waiters is not kept locked while they are woken.  n is the number of
+// threads gathered so far.
+
+static nat gather_waiters_on(Capability *cap, StgTVar *s, nat n) {
   StgTVarWatchQueue *q;
   StgTVarWatchQueue *trail;
-  TRACE("unpark_waiters_on tvar=%p", s);
+  TRACE("gather_waiters_on tvar=%p", s);
   // unblock TSOs in reverse order, to be a bit fairer (#2319)
   for (q = s -> first_watch_queue_entry, trail = q;
        q != END_STM_WATCH_QUEUE;
@@ -399,9 +437,31 @@ static void unpark_waiters_on(Capability *cap, StgTVar *s) {
        q != END_STM_WATCH_QUEUE; 
        q = q -> prev_queue_entry) {
     if (watcher_is_tso(q)) {
-      unpark_tso(cap, (StgTSO *)(q -> closure));
+      StgTSO *tso = (StgTSO *)(q -> closure);
+      // Skip the threads that are runnable already, or are sure to be
+      // soon: unpark_tso would only take their locks to find that out
+      if (tso -> why_blocked != BlockedOnSTM ||
+          tso -> block_info.closure == STM_AWOKEN) {
+        continue;
+      }
+      if (n == cap -> stm_wakeups_size) {
+        cap -> stm_wakeups_size = (n == 0) ? 64 : 2 * n;
+        cap -> stm_wakeups =
+          stgReallocBytes(cap -> stm_wakeups,
+                          cap -> stm_wakeups_size * sizeof(StgTSO *),
+                          "gather_waiters_on");
+      }
+      cap -> stm_wakeups[n++] = tso;
     }
   }
+  return n;
+}
+
+static void unpark_gathered(Capability *cap, nat n) {
+  nat i;
+  for (i = 0; i < n; i ++) {
+    unpark_tso(cap, cap -> stm_wakeups[i]);
+  }
 }
 
 /*......................................................................*/
@@ -445,6 +505,7 @@ static StgTRecHeader *new_stg_trec_header(Capability *cap,
   result -> enclosing_trec = enclosing_trec;
   result -> current_chunk = new_stg_trec_chunk(cap);
   result -> invariants_to_check = END_INVARIANT_CHECK_QUEUE;
+  result -> index = NO_TREC_INDEX;
 
   if (enclosing_trec == NO_TREC) {
     result -> state = TREC_ACTIVE;
@@ -492,6 +553,10 @@ static StgTVarWatchQueue *alloc_stg_tvar_watch_queue(Capability *cap,
 static void free_stg_tvar_watch_queue(Capability *cap,
 				      StgTVarWatchQueue *wq) {
 #if defined(REUSE_MEMORY)
+  // The free list survives GC (see stmPreGCHook): don't let it keep the
+  // thread or the other entries alive
+  wq -> closure = (StgClosure *)END_TSO_QUEUE;
+  wq -> prev_queue_entry = END_STM_WATCH_QUEUE;
   wq -> next_queue_entry = cap -> free_tvar_watch_queues;
   cap -> free_tvar_watch_queues = wq;
 #endif
@@ -529,6 +594,7 @@ static StgTRecHeader *alloc_stg_trec_header(Capability *cap,
     result -> enclosing_trec = enclosing_trec;
     result -> current_chunk -> next_entry_idx = 0;
     result -> invariants_to_check = END_INVARIANT_CHECK_QUEUE;
+    result -> index = NO_TREC_INDEX;
     if (enclosing_trec == NO_TREC) {
       result -> state = TREC_ACTIVE;
     } else {
@@ -658,38 +724,212 @@ static TRecEntry *get_new_entry(Capability *cap,
 
 /*......................................................................*/
 
-static void merge_update_into(Capability *cap,
-                              StgTRecHeader *t,
-                              StgTVar *tvar,
-                              StgClosure *expected_value,
-                              StgClosure *new_value) {
-  int found;
-  
-  // Look for an entry in this trec
-  found = FALSE;
-  FOR_EACH_ENTRY(t, e, {
-    StgTVar *s;
-    s = e -> tvar;
-    if (s == tvar) {
-      found = TRUE;
-      if (e -> expected_value != expected_value) {
-        // Must abort if the two entries start from different values
-        TRACE("%p : update entries inconsistent at %p (%p vs %p)", 
-              t, tvar, e -> expected_value, expected_value);
-        t -> state = TREC_CONDEMNED;
-      } 
-      e -> new_value = new_value;
+// Helper functions for indexing large transaction records
+//
+// Finding the entry for a TVar scans the chunks of a TRec, so a
+// transaction that touches n TVars costs O(n^2).  Once a TRec spans
+// TREC_INDEX_MIN_CHUNKS chunks we give it an open-addressed table from
+// TVars to their entries.  The table lives in an ARR_WORDS hanging off
+// the TRec, so it goes away with the TRec, and it is brought up to date
+// lazily from the entries added since it was last used: the code that
+// adds entries need not know about it.
+//
+// The table holds pointers that the GC does not follow.  Once the GC has
+// moved the TVars and chunks they are all stale, so the first lookup
+// after a GC (which bumps trec_index_epoch) rebuilds the table.
+
+#define TREC_INDEX_MIN_CHUNKS 3
+
+typedef struct {
+  StgWord       epoch;       // trec_index_epoch when the table was built
+  StgTRecChunk *last_chunk;  // newest chunk with entries in the table...
+  StgWord       last_idx;    // ...and how many of them are in it
+  StgWord       n_entries;
+  StgWord       bits;        // the table has 2^bits slots
+  TRecEntry    *slots[FLEXIBLE_ARRAY];
+} TRecIndex;
+
+static volatile StgWord trec_index_epoch = 0;
+
+static StgBool trec_is_large(StgTRecHeader *trec) {
+  StgTRecChunk *c;
+  int i;
+
+  c = trec -> current_chunk;
+  for (i = 1; i < TREC_INDEX_MIN_CHUNKS; i ++) {
+    c = c -> prev_chunk;
+    if (c == END_STM_CHUNK_LIST) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+STATIC_INLINE StgWord trec_index_hash(TRecIndex *ix, StgTVar *tvar) {
+#if SIZEOF_VOID_P == 8
+  return ((StgWord)tvar * 0x9E3779B97F4A7C15ULL) >> (64 - ix -> bits);
+#else
+  return ((StgWord)tvar * 0x9E3779B9UL) >> (32 - ix -> bits);
+#endif
+}
+
+static void trec_index_insert(TRecIndex *ix, TRecEntry *e) {
+  StgWord i, mask;
+
+  mask = ((StgWord)1 << ix -> bits) - 1;
+  i = trec_index_hash(ix, e -> tvar);
+  while (ix -> slots[i] != NULL) {
+    ASSERT(ix -> slots[i] -> tvar != e -> tvar);
+    i = (i + 1) & mask;
+  }
+  ix -> slots[i] = e;
+  ix -> n_entries ++;
+}
+
+static TRecEntry *trec_index_lookup(TRecIndex *ix, StgTVar *tvar) {
+  StgWord i, mask;
+  TRecEntry *e;
+
+  mask = ((StgWord)1 << ix -> bits) - 1;
+  i = trec_index_hash(ix, tvar);
+  while ((e = ix -> slots[i]) != NULL) {
+    if (e -> tvar == tvar) {
+      return e;
+    }
+    i = (i + 1) & mask;
+  }
+  return NULL;
+}
+
+static TRecIndex *build_trec_index(Capability *cap, StgTRecHeader *trec) {
+  StgArrWords *arr;
+  TRecIndex *ix;
+  StgTRecChunk *c;
+  StgWord n, bits, bytes;
+
+  // Size the table for twice the current number of entries; it is
+  // rebuilt at three-quarters full
+  n = 0;
+  for (c = trec -> current_chunk; c != END_STM_CHUNK_LIST; c = c -> prev_chunk) {
+    n += c -> next_entry_idx;
+  }
+  bits = 1;
+  while (((StgWord)1 << bits) < 2 * n) {
+    bits ++;
+  }
+
+  bytes = sizeof(TRecIndex) + (sizeof(TRecEntry *) << bits);
+  arr = (StgArrWords *)allocate(cap, sizeofW(StgArrWords) + ROUNDUP_BYTES_TO_WDS(bytes));
+  SET_ARR_HDR(arr, &stg_ARR_WORDS_info, CCS_SYSTEM, bytes);
+  ix = (TRecIndex *)(arr -> payload);
+  memset(ix -> slots, 0, sizeof(TRecEntry *) << bits);
+  ix -> epoch = trec_index_epoch;
+  ix -> n_entries = 0;
+  ix -> bits = bits;
+
+  FOR_EACH_ENTRY(trec, e, {
+    trec_index_insert(ix, e);
+  });
+  ix -> last_chunk = trec -> current_chunk;
+  ix -> last_idx = trec -> current_chunk -> next_entry_idx;
+  trec -> index = arr;
+
+  TRACE("%p : built index of %ld slots for %ld entries", 
+        trec, (long)((StgWord)1 << bits), (long)n);
+  return ix;
+}
+
+// Returns the up-to-date index for trec, or NULL if trec is small
+// enough to search directly
+static TRecIndex *get_trec_index(Capability *cap, StgTRecHeader *trec) {
+  TRecIndex *ix;
+  StgTRecChunk *c;
+  StgWord i;
+
+  if (trec -> index == NO_TREC_INDEX) {
+    if (!trec_is_large(trec)) {
+      return NULL;
+    }
+    return build_trec_index(cap, trec);
+  }
+
+  ix = (TRecIndex *)(trec -> index -> payload);
+  if (ix -> epoch != trec_index_epoch) {
+    return build_trec_index(cap, trec);
+  }
+
+  // Add the entries made since the last lookup: the rest of last_chunk
+  // and everything in the chunks after it
+  c = trec -> current_chunk;
+  for (;;) {
+    i = (c == ix -> last_chunk) ? ix -> last_idx : 0;
+    for (; i < c -> next_entry_idx; i ++) {
+      if ((ix -> n_entries + 1) * 4 > ((StgWord)3 << ix -> bits)) {
+        return build_trec_index(cap, trec);
+      }
+      trec_index_insert(ix, &(c -> entries[i]));
+    }
+    if (c == ix -> last_chunk) break;
+    c = c -> prev_chunk;
+    ASSERT(c != END_STM_CHUNK_LIST);
+  }
+  ix -> last_chunk = trec -> current_chunk;
+  ix -> last_idx = trec -> current_chunk -> next_entry_idx;
+
+  return ix;
+}
+
+// Find the entry for tvar in trec itself, not in the enclosing trecs
+static TRecEntry *find_entry_in(Capability *cap, StgTRecHeader *trec, StgTVar *tvar) {
+  TRecEntry *result = NULL;
+  TRecIndex *ix;
+
+  ix = get_trec_index(cap, trec);
+  if (ix != NULL) {
+    return trec_index_lookup(ix, tvar);
+  }
+
+  FOR_EACH_ENTRY(trec, e, {
+    if (e -> tvar == tvar) {
+      result = e;
       BREAK_FOR_EACH;
     }
   });
+  return result;
+}
 
-  if (!found) {
+/*......................................................................*/
+
+// Merge the entry "from" of a nested trec into t
+
+static void merge_update_into(Capability *cap,
+                              StgTRecHeader *t,
+                              TRecEntry *from) {
+  StgTVar *tvar = from -> tvar;
+  StgClosure *expected_value = from -> expected_value;
+  StgClosure *new_value = from -> new_value;
+  TRecEntry *e;
+  
+  // Look for an entry in this trec
+  e = find_entry_in(cap, t, tvar);
+  if (e != NULL) {
+    if (e -> expected_value != expected_value) {
+      // Must abort if the two entries start from different values
+      TRACE("%p : update entries inconsistent at %p (%p vs %p)", 
+            t, tvar, e -> expected_value, expected_value);
+      t -> state = TREC_CONDEMNED;
+    } 
+    e -> new_value = new_value;
+  } else {
     // No entry so far in this trec
     TRecEntry *ne;
     ne = get_new_entry(cap, t);
     ne -> tvar = tvar;
     ne -> expected_value = expected_value;
     ne -> new_value = new_value;
+    IF_STM_FG_LOCKS({
+      ne -> num_updates = from -> num_updates;
+    });
   }
 }
 
@@ -697,34 +937,30 @@ static void merge_update_into(Capability *cap,
 
 static void merge_read_into(Capability *cap,
 			    StgTRecHeader *t,
-			    StgTVar *tvar,
-			    StgClosure *expected_value) {
-  int found;
+			    TRecEntry *from) {
+  StgTVar *tvar = from -> tvar;
+  StgClosure *expected_value = from -> expected_value;
+  TRecEntry *e;
   
   // Look for an entry in this trec
-  found = FALSE;
-  FOR_EACH_ENTRY(t, e, {
-    StgTVar *s;
-    s = e -> tvar;
-    if (s == tvar) {
-      found = TRUE;
-      if (e -> expected_value != expected_value) {
-        // Must abort if the two entries start from different values
-        TRACE("%p : read entries inconsistent at %p (%p vs %p)", 
-              t, tvar, e -> expected_value, expected_value);
-        t -> state = TREC_CONDEMNED;
-      } 
-      BREAK_FOR_EACH;
-    }
-  });
-
-  if (!found) {
+  e = find_entry_in(cap, t, tvar);
+  if (e != NULL) {
+    if (e -> expected_value != expected_value) {
+      // Must abort if the two entries start from different values
+      TRACE("%p : read entries inconsistent at %p (%p vs %p)", 
+            t, tvar, e -> expected_value, expected_value);
+      t -> state = TREC_CONDEMNED;
+    } 
+  } else {
     // No entry so far in this trec
     TRecEntry *ne;
     ne = get_new_entry(cap, t);
     ne -> tvar = tvar;
     ne -> expected_value = expected_value;
     ne -> new_value = expected_value;
+    IF_STM_FG_LOCKS({
+      ne -> num_updates = from -> num_updates;
+    });
   }
 }
 
@@ -813,7 +1049,7 @@ static StgBool validate_and_acquire_ownership (StgTRecHeader *trec,
           result = FALSE;
           BREAK_FOR_EACH;
         }
-      } else {
+      } else if (!config_use_version_clock) {
         ASSERT(config_use_read_phase);
         IF_STM_FG_LOCKS({
           TRACE("%p : will need to check %p", trec, s);
@@ -876,15 +1112,93 @@ static StgBool check_read_only(StgTRecHeader *trec STG_UNUSED) {
   return result;
 }
 
+#if defined(STM_FG_LOCKS)
+// A TVar's version can be trusted only when it is not locked: a commit
+// that has taken a time may not yet have stored it in the TVars it is
+// updating.  So look at the lock first.
+
+static StgBool entry_version_unchanged(TRecEntry *e) {
+  StgClosure *c;
+  c = e -> tvar -> current_value;
+  load_load_barrier();
+  return (GET_INFO(UNTAG_CLOSURE(c)) != &stg_TREC_HEADER_info &&
+          e -> tvar -> num_updates == e -> num_updates);
+}
+
+static StgBool trec_has_updates(StgTRecHeader *trec) {
+  StgBool result = FALSE;
+  FOR_EACH_ENTRY(trec, e, {
+    if (entry_is_update(e)) {
+      result = TRUE;
+      BREAK_FOR_EACH;
+    }
+  });
+  return result;
+}
+
+// check_read_versions : the version clock's replacement for
+// check_read_only, called with the updated TVars locked.  Takes the time
+// of the commit, returning it in *commit_version, and checks that the
+// TVars the trec has only read are unchanged.  They were all consistent
+// at trec -> read_version, so if no other commit has taken a time since
+// then there is nothing to check.  A read-only trec takes no time at all:
+// it is serialised at its read_version.
+
+static StgBool check_read_versions(StgTRecHeader *trec, StgWord *commit_version) {
+  StgBool result = TRUE;
+
+  if (!trec_has_updates(trec)) {
+    TRACE("%p : read-only, nothing to check", trec);
+    *commit_version = 0;
+    return TRUE;
+  }
+
+  *commit_version = atomic_inc(&stm_clock);
+  if (*commit_version == trec -> read_version + 1) {
+    TRACE("%p : no commits since version %ld", trec, trec -> read_version);
+    return TRUE;
+  }
+
+  FOR_EACH_ENTRY(trec, e, {
+    if (entry_is_read_only(e) && !entry_version_unchanged(e)) {
+      TRACE("%p : TVar %p changed since it was read", trec, e -> tvar);
+      result = FALSE;
+      BREAK_FOR_EACH;
+    }
+  });
+
+  return result;
+}
+#endif
 
 /************************************************************************/
 
+// The watch queue entries on a Capability's free list are the only STM
+// structures it keeps across a GC (markCapability() treats the list as a
+// root), so that threads that block in retry# over and over can re-use
+// them.  The rest of the free list is left to the GC.
+
+#define TVAR_WATCH_QUEUE_POOL_SIZE 1024
+
+static void trim_tvar_watch_queues(Capability *cap) {
+  StgTVarWatchQueue *q = cap -> free_tvar_watch_queues;
+  nat n;
+  for (n = 1; n < TVAR_WATCH_QUEUE_POOL_SIZE && q != END_STM_WATCH_QUEUE; n ++) {
+    q = q -> next_queue_entry;
+  }
+  if (q != END_STM_WATCH_QUEUE) {
+    q -> next_queue_entry = END_STM_WATCH_QUEUE;
+  }
+}
+
 void stmPreGCHook (Capability *cap) {
   lock_stm(NO_TREC);
   TRACE("stmPreGCHook");
-  cap->free_tvar_watch_queues = END_STM_WATCH_QUEUE;
+  trim_tvar_watch_queues(cap);
   cap->free_trec_chunks = END_STM_CHUNK_LIST;
   cap->free_trec_headers = NO_TREC;
+  // The GC may move TVars and TRec chunks: invalidate the TRec indices
+  trec_index_epoch ++;
   unlock_stm(NO_TREC);
 }
 
@@ -927,16 +1241,228 @@ static void getToken(Capability *cap STG_UNUSED) {
 
 /*......................................................................*/
 
+// Contention management.  When a transaction fails to commit, the thread
+// re-runs it: stmStartTransaction counts these re-runs in the TSO
+// (stm_aborts), starting again from zero for each new atomically block.
+//
+// Under --stm-cm=backoff and the policies below, a re-run is delayed by a
+// spin whose length doubles with each abort, so that threads that keep
+// colliding over the same TVars drift apart.  Past STM_BACKOFF_MAX_SHIFT
+// aborts the thread yields its Capability instead.
+//
+// Under --stm-cm=age and --stm-cm=aborts, an atomically block that has
+// been aborted --stm-serialize times is also run serialized: while
+// stm_serial_trec is its TRec, no other transaction may commit an
+// update, so only commits that were already underway can make it fail.
+// A serialized transaction is never preempted: a starving transaction
+// that finds another one serialized runs unserialized for now, and
+// queues for the next turn.  Only one place is kept in the queue, for
+// the waiter that started failing first (age) or that has failed most
+// often (aborts).  The serialized transaction lets go when it commits,
+// aborts, or blocks in retry#, and re-claims it when it is re-run,
+// unless a waiter is queued that takes precedence.
+
+#define STM_STAMP_NONE 1  // stm_stamp of a block that has not failed yet
+
+#if defined(STM_FG_LOCKS)
+
+#define STM_BACKOFF_BASE      16  // spins after the first abort
+#define STM_BACKOFF_MAX_SHIFT 10  // ... doubling up to 8k spins
+
+static volatile StgWord stm_stamps = STM_STAMP_NONE;
+
+// The serialized transaction, protected by stm_serial_locked.  It may
+// be read without the lock.
+static StgTRecHeader *stm_serial_trec = NO_TREC;
+static volatile StgWord stm_serial_locked = FALSE;
+
+// The waiter that gets the next turn (0 if there is none), also
+// protected by stm_serial_locked.  If it does not come back for its
+// turn while STM_SERIAL_MAX_PASSES others ask, it loses its place.
+#define STM_SERIAL_MAX_PASSES 64
+static StgWord stm_serial_next_stamp = 0;
+static StgWord32 stm_serial_next_aborts = 0;
+static nat stm_serial_next_passes = 0;
+
+static void lock_serial(void) {
+  while (cas((void *)&stm_serial_locked, FALSE, TRUE) == TRUE) {
+    busy_wait_nop();
+  }
+}
+
+static void unlock_serial(void) {
+  write_barrier();
+  stm_serial_locked = FALSE;
+}
+
+static void cm_backoff(Capability *cap, StgTSO *tso) {
+  StgWord spins, i;
+
+  if (RtsFlags.ParFlags.stmContention == STM_CM_NONE) {
+    return;
+  }
+
+  if (tso -> stm_aborts == 1) {
+    tso -> stm_stamp = atomic_inc(&stm_stamps);
+  }
+
+  if (n_capabilities == 1) {
+    // Nothing else is running: the transaction failed because it was
+    // descheduled, and the commit that got in its way is finished
+    return;
+  }
+
+  if (tso -> stm_aborts > STM_BACKOFF_MAX_SHIFT) {
+    TRACE("backing off by yielding after %d aborts", tso -> stm_aborts);
+    contextSwitchCapability(cap);
+    return;
+  }
+
+  // Half the spin is fixed and half depends on the thread, so that
+  // threads that failed together do not come back together
+  spins = STM_BACKOFF_BASE << (tso -> stm_aborts - 1);
+  spins = spins / 2 + (((StgWord)tso -> id * 2654435761U) >> 8) % (spins / 2);
+  TRACE("backing off for %" FMT_Word " spins after %d aborts",
+        spins, tso -> stm_aborts);
+  for (i = 0; i < spins; i ++) {
+    busy_wait_nop();
+  }
+}
+
+// Does the atomically block running in tso take precedence over the
+// one with the given stamp and abort count?  Called with
+// stm_serial_locked held.
+
+static StgBool cm_has_priority(StgTSO *tso, StgWord stamp, StgWord32 aborts) {
+  if (RtsFlags.ParFlags.stmContention == STM_CM_ABORTS &&
+      tso -> stm_aborts != aborts) {
+    return (tso -> stm_aborts > aborts);
+  }
+  return (tso -> stm_stamp < stamp);
+}
+
+static void cm_serialize(Capability *cap, StgTSO *tso, StgTRecHeader *trec) {
+  StgBool first;
+
+  if (RtsFlags.ParFlags.stmContention < STM_CM_AGE ||
+      tso -> stm_aborts < RtsFlags.ParFlags.stmSerializeAfter) {
+    return;
+  }
+
+  lock_serial();
+  first = (stm_serial_next_stamp == 0 ||
+           tso -> stm_stamp == stm_serial_next_stamp ||
+           cm_has_priority(tso, stm_serial_next_stamp, stm_serial_next_aborts));
+  if (stm_serial_trec == NO_TREC) {
+    if (first || ++ stm_serial_next_passes > STM_SERIAL_MAX_PASSES) {
+      TRACE("%p : running serialized after %d aborts", trec, tso -> stm_aborts);
+      stm_serial_trec = trec;
+      stm_serial_next_stamp = 0;
+      stm_serial_next_passes = 0;
+      cap -> stm_stats.serialized ++;
+    }
+  } else if (first) {
+    // Wait for the serialized transaction to finish rather than
+    // taking its place, or neither of us might ever commit
+    TRACE("%p : next in line to run serialized", trec);
+    stm_serial_next_stamp = tso -> stm_stamp;
+    stm_serial_next_aborts = tso -> stm_aborts;
+    stm_serial_next_passes = 0;
+  }
+  unlock_serial();
+}
+
+static void cm_unserialize(StgTRecHeader *trec) {
+  // Only trec's own thread can make it the serialized transaction, so
+  // if it is not now it will not become so behind our back
+  if (stm_serial_trec == trec) {
+    lock_serial();
+    if (stm_serial_trec == trec) {
+      TRACE("%p : no longer serialized", trec);
+      stm_serial_trec = NO_TREC;
+    }
+    unlock_serial();
+  }
+}
+
+// cm_may_commit : a transaction may not commit updates while another
+// one is serialized.  It is re-run instead, after giving the serialized
+// transaction's thread a chance to run if it is waiting for this
+// Capability.
+
+static StgBool cm_may_commit(Capability *cap, StgTRecHeader *trec) {
+  StgTRecHeader *serial = stm_serial_trec;
+  if (serial != NO_TREC && serial != trec && trec_has_updates(trec)) {
+    TRACE("%p : giving way to serialized transaction %p", trec, serial);
+    contextSwitchCapability(cap);
+    return FALSE;
+  }
+  return TRUE;
+}
+#else
+static void cm_backoff(Capability *cap STG_UNUSED, StgTSO *tso STG_UNUSED) {
+  // Nothing
+}
+
+static void cm_serialize(Capability *cap STG_UNUSED, StgTSO *tso STG_UNUSED,
+                         StgTRecHeader *trec STG_UNUSED) {
+  // Nothing
+}
+
+static void cm_unserialize(StgTRecHeader *trec STG_UNUSED) {
+  // Nothing
+}
+
+static StgBool cm_may_commit(Capability *cap STG_UNUSED,
+                             StgTRecHeader *trec STG_UNUSED) {
+  return TRUE;
+}
+#endif
+
+void markSTM (evac_fn evac STG_UNUSED, void *user STG_UNUSED) {
+#if defined(STM_FG_LOCKS)
+  if (stm_serial_trec != NO_TREC) {
+    evac(user, (StgClosure **)(void *)&stm_serial_trec);
+  }
+#endif
+}
+
+/*......................................................................*/
+
 StgTRecHeader *stmStartTransaction(Capability *cap,
                                    StgTRecHeader *outer) {
   StgTRecHeader *t;
+  StgTSO *tso = cap -> r.rCurrentTSO;
   TRACE("%p : stmStartTransaction with %d tokens", 
         outer, 
         cap -> transaction_tokens);
 
   getToken(cap);
 
+  if (outer == NO_TREC) {
+    if (tso -> stm_stamp == 0) {
+      // A new atomically block (stg_atomicallyzh clears the stamp), or
+      // one that has been woken up after retry#
+      tso -> stm_stamp = STM_STAMP_NONE;
+      tso -> stm_aborts = 0;
+    } else {
+      // The last attempt at this atomically block failed
+      tso -> stm_aborts ++;
+      cap -> stm_stats.aborts ++;
+      if (tso -> stm_aborts > cap -> stm_stats.max_aborts) {
+        cap -> stm_stats.max_aborts = tso -> stm_aborts;
+      }
+      cm_backoff(cap, tso);
+    }
+  }
+
   t = alloc_stg_trec_header(cap, outer);
+  if (outer != NO_TREC) {
+    t -> read_version = outer -> read_version;
+  } else {
+    cm_serialize(cap, tso, t);
+    t -> read_version = stm_clock;
+  }
   TRACE("%p : stmStartTransaction()=%p", outer, t);
   return t;
 }
@@ -966,13 +1492,14 @@ void stmAbortTransaction(Capability *cap,
       remove_watch_queue_entries_for_trec(cap, trec);
     } 
 
+    cm_unserialize(trec);
+
   } else {
     // We're a nested transaction: merge our read set into our parent's
     TRACE("%p : retaining read-set into parent %p", trec, et);
 
     FOR_EACH_ENTRY(trec, e, {
-      StgTVar *s = e -> tvar;
-      merge_read_into(cap, et, s, e -> expected_value);
+      merge_read_into(cap, et, e);
     });
   } 
 
@@ -1020,7 +1547,7 @@ void stmCondemnTransaction(Capability *cap,
 
 /*......................................................................*/
 
-StgBool stmValidateNestOfTransactions(StgTRecHeader *trec) {
+StgBool stmValidateNestOfTransactions(Capability *cap, StgTRecHeader *trec) {
   StgTRecHeader *t;
   StgBool result;
 
@@ -1034,9 +1561,19 @@ StgBool stmValidateNestOfTransactions(StgTRecHeader *trec) {
 
   t = trec;
   result = TRUE;
-  while (t != NO_TREC) {
-    result &= validate_and_acquire_ownership(t, TRUE, FALSE);
-    t = t -> enclosing_trec;
+  if (config_use_version_clock && trec -> read_version == stm_clock) {
+    // No commit has updated a TVar since the nest's reads were last known
+    // to be consistent, so they are all still current
+    while (t != NO_TREC) {
+      result &= (t -> state != TREC_CONDEMNED);
+      t = t -> enclosing_trec;
+    }
+  } else {
+    while (t != NO_TREC) {
+      result &= (t -> state != TREC_CONDEMNED);
+      result &= validate_and_acquire_ownership(t, TRUE, FALSE);
+      t = t -> enclosing_trec;
+    }
   }
 
   if (!result && trec -> state != TREC_WAITING) {
@@ -1051,22 +1588,18 @@ StgBool stmValidateNestOfTransactions(StgTRecHeader *trec) {
 
 /*......................................................................*/
 
-static TRecEntry *get_entry_for(StgTRecHeader *trec, StgTVar *tvar, StgTRecHeader **in) {
+static TRecEntry *get_entry_for(Capability *cap, StgTRecHeader *trec, 
+                                StgTVar *tvar, StgTRecHeader **in) {
   TRecEntry *result = NULL;
 
   TRACE("%p : get_entry_for TVar %p", trec, tvar);
   ASSERT(trec != NO_TREC);
 
   do {
-    FOR_EACH_ENTRY(trec, e, {
-      if (e -> tvar == tvar) {
-        result = e;
-        if (in != NULL) {
-          *in = trec;
-        }
-        BREAK_FOR_EACH;
-      }
-    });
+    result = find_entry_in(cap, trec, tvar);
+    if (result != NULL && in != NULL) {
+      *in = trec;
+    }
     trec = trec -> enclosing_trec;
   } while (result == NULL && trec != NO_TREC);
 
@@ -1134,7 +1667,7 @@ static void connect_invariant_to_trec(Capability *cap,
     // We leave "last_execution" holding the values that will be
     // in the heap after the transaction we're in the process
     // of committing has finished.
-    TRecEntry *entry = get_entry_for(my_execution -> enclosing_trec, s, NULL);
+    TRecEntry *entry = get_entry_for(cap, my_execution -> enclosing_trec, s, NULL);
     if (entry != NULL) {
       e -> expected_value = entry -> new_value;
       e -> new_value = entry -> new_value;
@@ -1270,6 +1803,10 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
   StgInt64 max_commits_at_start = max_commits;
   StgBool touched_invariants;
   StgBool use_read_phase;
+  nat n_wakeups = 0;
+#if defined(STM_FG_LOCKS)
+  StgWord commit_version = 0;
+#endif
 
   TRACE("%p : stmCommitTransaction()", trec);
   ASSERT (trec != NO_TREC);
@@ -1280,6 +1817,10 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
   ASSERT ((trec -> state == TREC_ACTIVE) || 
           (trec -> state == TREC_CONDEMNED));
 
+  if (!cm_may_commit(cap, trec)) {
+    trec -> state = TREC_CONDEMNED;
+  }
+
   // touched_invariants is true if we've written to a TVar with invariants 
   // attached to it, or if we're trying to add a new invariant to the system.
 
@@ -1294,7 +1835,7 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
   // to gain access to their wait lists (and hence be able to unhook the
   // invariant from both tvars).
 
-  if (touched_invariants) {
+  if (touched_invariants && trec -> state != TREC_CONDEMNED) {
     StgInvariantCheckQueue *q = trec -> invariants_to_check;
     TRACE("%p : locking invariants", trec);
     while (q != END_INVARIANT_CHECK_QUEUE) {
@@ -1316,7 +1857,7 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
 	  for (i = 0; i < c -> next_entry_idx; i ++) {
 	    TRecEntry *e = &(c -> entries[i]);
 	    TRACE("%p : ensuring we lock TVars for %p", trec, e -> tvar);
-	    merge_read_into (cap, trec, e -> tvar, e -> expected_value);
+	    merge_read_into (cap, trec, e);
 	  }
 	  c = c -> prev_chunk;
 	}
@@ -1342,7 +1883,18 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
     // We now know that all the updated locations hold their expected values.
     ASSERT (trec -> state == TREC_ACTIVE);
 
-    if (use_read_phase) {
+    if (config_use_version_clock) {
+      IF_STM_FG_LOCKS({
+        if (use_read_phase) {
+          TRACE("%p : doing version check", trec);
+          result = check_read_versions(trec, &commit_version);
+          TRACE("%p : version-check %s", trec, result ? "succeeded" : "failed");
+        } else {
+          // We hold the locks on everything we have read
+          commit_version = atomic_inc(&stm_clock);
+        }
+      });
+    } else if (use_read_phase) {
       StgInt64 max_commits_at_end;
       StgInt64 max_concurrent_commits;
       TRACE("%p : doing read check", trec);
@@ -1393,9 +1945,15 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
 
           ACQ_ASSERT(tvar_is_locked(s, trec));
           TRACE("%p : writing %p to %p, waking waiters", trec, e -> new_value, s);
-          unpark_waiters_on(cap,s);
+          n_wakeups = gather_waiters_on(cap, s, n_wakeups);
           IF_STM_FG_LOCKS({
-            s -> num_updates ++;
+            if (config_use_version_clock) {
+              // Readers must see the new version before the new value
+              s -> num_updates = (StgInt)commit_version;
+              write_barrier();
+            } else {
+              s -> num_updates ++;
+            }
           });
           unlock_tvar(trec, s, e -> new_value, TRUE);
         } 
@@ -1408,8 +1966,15 @@ StgBool stmCommitTransaction(Capability *cap, StgTRecHeader *trec) {
 
   unlock_stm(trec);
 
+  unpark_gathered(cap, n_wakeups);
+
+  cm_unserialize(trec);
   free_stg_trec_header(cap, trec);
 
+  if (result) {
+    cap -> stm_stats.commits ++;
+  }
+
   TRACE("%p : stmCommitTransaction()=%d", trec, result);
 
   return result;
@@ -1427,11 +1992,18 @@ StgBool stmCommitNestedTransaction(Capability *cap, StgTRecHeader *trec) {
   lock_stm(trec);
 
   et = trec -> enclosing_trec;
-  result = validate_and_acquire_ownership(trec, (!config_use_read_phase), TRUE);
+  if (config_use_version_clock) {
+    // Every entry in the nest was checked against its read_version when
+    // it was made, so unless the nest has been condemned it is still a
+    // consistent view and there is nothing to lock or check
+    result = (trec -> state != TREC_CONDEMNED);
+  } else {
+    result = validate_and_acquire_ownership(trec, (!config_use_read_phase), TRUE);
+  }
   if (result) {
     // We now know that all the updated locations hold their expected values.
 
-    if (config_use_read_phase) {
+    if (config_use_read_phase && !config_use_version_clock) {
       TRACE("%p : doing read check", trec);
       result = check_read_only(trec);
     }
@@ -1447,10 +2019,10 @@ StgBool stmCommitNestedTransaction(Capability *cap, StgTRecHeader *trec) {
 	
 	StgTVar *s;
 	s = e -> tvar;
-	if (entry_is_update(e)) {
+	if (entry_is_update(e) && !config_use_version_clock) {
 	  unlock_tvar(trec, s, e -> expected_value, FALSE);
 	}
-	merge_update_into(cap, et, s, e -> expected_value, e -> new_value);
+	merge_update_into(cap, et, e);
 	ACQ_ASSERT(s -> current_value != (StgClosure *)trec);
       });
     } else {
@@ -1478,6 +2050,7 @@ StgBool stmWait(Capability *cap, StgTSO *tso, StgTRecHeader *trec) {
           (trec -> state == TREC_CONDEMNED));
 
   lock_stm(trec);
+  cm_unserialize(trec);
   result = validate_and_acquire_ownership(trec, TRUE, TRUE);
   if (result) {
     // The transaction is valid so far so we can actually start waiting.
@@ -1499,6 +2072,11 @@ StgBool stmWait(Capability *cap, StgTSO *tso, StgTRecHeader *trec) {
     // the runtime will call stmWaitUnlock() below, with the same
     // TRec.
 
+    // When it is woken up the thread will run the atomically block
+    // afresh, not re-run a failed attempt
+    tso -> stm_stamp = 0;
+    cap -> stm_stats.retries ++;
+
   } else {
     unlock_stm(trec);
     free_stg_trec_header(cap, trec);
@@ -1567,6 +2145,99 @@ static StgClosure *read_current_value(StgTRecHeader *trec STG_UNUSED, StgTVar *t
   return result;
 }
 
+#if defined(STM_FG_LOCKS)
+// Read the value of a TVar along with the version it was written at.  The
+// version is read on either side of the value until the two agree.
+
+static StgClosure *read_current_value_and_version(StgTRecHeader *trec,
+                                                  StgTVar *tvar,
+                                                  StgInt *version) {
+  StgClosure *result;
+  StgInt v;
+
+  do {
+    v = tvar -> num_updates;
+    load_load_barrier();
+    result = read_current_value(trec, tvar);
+    load_load_barrier();
+  } while (tvar -> num_updates != v);
+
+  *version = v;
+  return result;
+}
+
+// extend_read_version : the nest of trecs has met a TVar written after its
+// read_version.  If none of the TVars it has already seen has changed
+// since, its view is consistent now, and its read_version can be moved on.
+
+static StgBool extend_read_version(StgTRecHeader *trec) {
+  StgTRecHeader *t;
+  StgWord now;
+  StgBool result = TRUE;
+
+  now = stm_clock;
+  load_load_barrier();
+
+  for (t = trec; result && t != NO_TREC; t = t -> enclosing_trec) {
+    FOR_EACH_ENTRY(t, e, {
+      if (!entry_version_unchanged(e)) {
+        TRACE("%p : TVar %p changed since it was read", trec, e -> tvar);
+        result = FALSE;
+        BREAK_FOR_EACH;
+      }
+    });
+  }
+
+  if (result) {
+    TRACE("%p : read version now %ld", trec, now);
+    for (t = trec; t != NO_TREC; t = t -> enclosing_trec) {
+      t -> read_version = now;
+    }
+  }
+  return result;
+}
+#endif
+
+// Read a TVar that the nest of trecs has not seen yet, returning the
+// version of the value for its new entry.  With the version clock the
+// value must be consistent with everything the nest has read so far.  If
+// it cannot be, the nest is condemned: the value is still recorded in the
+// new entry, but stmReadTVar does not hand it back to the program (see
+// stg_readTVarzh).
+
+static StgClosure *read_new_value(Capability *cap STG_UNUSED,
+                                  StgTRecHeader *trec,
+                                  StgTVar *tvar,
+                                  StgInt *version) {
+  StgClosure *result;
+
+  *version = 0;
+#if defined(STM_FG_LOCKS)
+  if (config_use_version_clock) {
+    StgTRecHeader *t;
+    for (;;) {
+      result = read_current_value_and_version(trec, tvar, version);
+      if ((StgWord)*version <= trec -> read_version) {
+        break;
+      }
+      if (!extend_read_version(trec)) {
+        TRACE("%p : condemning nest, %p is too new", trec, tvar);
+        for (t = trec; t != NO_TREC; t = t -> enclosing_trec) {
+          t -> state = TREC_CONDEMNED;
+        }
+        break;
+      }
+      // Read it again: only a read made after the new read_version was
+      // taken is sure to be consistent with it
+    }
+    return result;
+  }
+#endif
+
+  result = read_current_value(trec, tvar);
+  return result;
+}
+
 /*......................................................................*/
 
 StgClosure *stmReadTVar(Capability *cap,
@@ -1580,7 +2251,7 @@ StgClosure *stmReadTVar(Capability *cap,
   ASSERT (trec -> state == TREC_ACTIVE || 
           trec -> state == TREC_CONDEMNED);
 
-  entry = get_entry_for(trec, tvar, &entry_in);
+  entry = get_entry_for(cap, trec, tvar, &entry_in);
 
   if (entry != NULL) {
     if (entry_in == trec) {
@@ -1592,18 +2263,32 @@ StgClosure *stmReadTVar(Capability *cap,
       new_entry -> tvar = tvar;
       new_entry -> expected_value = entry -> expected_value;
       new_entry -> new_value = entry -> new_value;
+      IF_STM_FG_LOCKS({
+        new_entry -> num_updates = entry -> num_updates;
+      });
       result = new_entry -> new_value;
     } 
   } else {
     // No entry found
-    StgClosure *current_value = read_current_value(trec, tvar);
+    StgInt version;
+    StgClosure *current_value = read_new_value(cap, trec, tvar, &version);
     TRecEntry *new_entry = get_new_entry(cap, trec);
     new_entry -> tvar = tvar;
     new_entry -> expected_value = current_value;
     new_entry -> new_value = current_value;
+    IF_STM_FG_LOCKS({
+      new_entry -> num_updates = version;
+    });
     result = current_value;
   }
 
+  if (trec -> state == TREC_CONDEMNED) {
+    // What the nest has read is inconsistent, and the value may not
+    // agree with the rest: don't let the program see it
+    TRACE("%p : stmReadTVar(%p) in condemned transaction", trec, tvar);
+    return NULL;
+  }
+
   TRACE("%p : stmReadTVar(%p)=%p", trec, tvar, result);
   return result;
 }
@@ -1622,7 +2307,7 @@ void stmWriteTVar(Capability *cap,
   ASSERT (trec -> state == TREC_ACTIVE || 
           trec -> state == TREC_CONDEMNED);
 
-  entry = get_entry_for(trec, tvar, &entry_in);
+  entry = get_entry_for(cap, trec, tvar, &entry_in);
 
   if (entry != NULL) {
     if (entry_in == trec) {
@@ -1634,14 +2319,21 @@ void stmWriteTVar(Capability *cap,
       new_entry -> tvar = tvar;
       new_entry -> expected_value = entry -> expected_value;
       new_entry -> new_value = new_value;
+      IF_STM_FG_LOCKS({
+        new_entry -> num_updates = entry -> num_updates;
+      });
     } 
   } else {
     // No entry found
-    StgClosure *current_value = read_current_value(trec, tvar);
+    StgInt version;
+    StgClosure *current_value = read_new_value(cap, trec, tvar, &version);
     TRecEntry *new_entry = get_new_entry(cap, trec);
     new_entry -> tvar = tvar;
     new_entry -> expected_value = current_value;
     new_entry -> new_value = new_value;
+    IF_STM_FG_LOCKS({
+      new_entry -> num_updates = version;
+    });
   }
 
   TRACE("%p : stmWriteTVar done", trec);
@@ -40,6 +40,8 @@
 #define STM_UNIPROC
 #endif
 
+#include "sm/GC.h" // for evac_fn
+
 #include "BeginPrivate.h"
 
 /*----------------------------------------------------------------------
@@ -50,6 +52,28 @@
 
 void stmPreGCHook(Capability *cap);
 
+/* Mark the RTS's own pointers into the heap (the serialized transaction
+   of the contention manager) */
+
+void markSTM(evac_fn evac, void *user);
+
+/*----------------------------------------------------------------------
+
+   Statistics
+   ----------
+
+   Kept per Capability and posted to the eventlog as EVENT_STM_COUNTERS
+   along with the spark counters.
+*/
+
+typedef struct {
+    StgWord commits;    /* top-level transactions committed */
+    StgWord aborts;     /* top-level transactions found invalid and re-run */
+    StgWord retries;    /* transactions that blocked in retry# */
+    StgWord serialized; /* re-runs that the contention manager serialized */
+    StgWord max_aborts; /* most re-runs of any one atomically block */
+} StmCounters;
+
 /*----------------------------------------------------------------------
 
    Transaction context management
@@ -97,7 +121,7 @@ void stmCondemnTransaction(Capability *cap, StgTRecHeader *trec);
   threads at GC (in case they are stuck looping)
 */
 
-StgBool stmValidateNestOfTransactions(StgTRecHeader *trec);
+StgBool stmValidateNestOfTransactions(Capability *cap, StgTRecHeader *trec);
 
 /*----------------------------------------------------------------------
 
@@ -197,7 +221,9 @@ StgTVar *stmNewTVar(Capability *cap, StgClosure *new_value);
 
 /*
  * Return the logical contents of 'tvar' within the context of the
- * thread's current transaction.
+ * thread's current transaction, or NULL if the transaction has been
+ * condemned, in which case the value must not be used: the caller
+ * should return to the scheduler, which will restart the transaction.
  */
 
 StgClosure *stmReadTVar(Capability *cap,
@@ -223,6 +249,12 @@ void stmWriteTVar(Capability *cap,
 
 #define NO_TREC ((StgTRecHeader *)(void *)&stg_NO_TREC_closure)
 
+#define NO_TREC_INDEX ((StgArrWords *)(void *)&stg_NO_TREC_INDEX_closure)
+
+/* The block_info of a BlockedOnSTM thread that has been woken up */
+
+#define STM_AWOKEN ((StgClosure *)(void *)&stg_STM_AWOKEN_closure)
+
 /*----------------------------------------------------------------------*/
 
 #include "EndPrivate.h"
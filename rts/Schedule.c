@@ -69,7 +69,6 @@
 // Blocked/sleeping thrads
 StgTSO *blocked_queue_hd = NULL;
 StgTSO *blocked_queue_tl = NULL;
-StgTSO *sleeping_queue = NULL;    // perhaps replace with a hash table?
 #endif
 
 /* Set to true when the latest garbage collection failed to reclaim
@@ -147,8 +146,9 @@ static void scheduleStartSignalHandlers (Capability *cap);
 static void scheduleCheckBlockedThreads (Capability *cap);
 static void scheduleProcessInbox(Capability **cap);
 static void scheduleDetectDeadlock (Capability **pcap, Task *task);
-static void schedulePushWork(Capability *cap, Task *task);
+static void scheduleOfferWork(Capability *cap, Task *task);
 #if defined(THREADED_RTS)
+static void scheduleStealThread(Capability *cap);
 static void scheduleActivateSpark(Capability *cap);
 #endif
 static void schedulePostRunThread(Capability *cap, StgTSO *t);
@@ -304,9 +304,9 @@ schedule (Capability *initialCapability, Task *task)
 
     scheduleFindWork(&cap);
 
-    /* work pushing, currently relevant only for THREADED_RTS:
-       (pushes threads, wakes up idle capabilities for stealing) */
-    schedulePushWork(cap,task);
+    /* currently relevant only for THREADED_RTS: offers threads to
+       idle capabilities, and wakes them up to steal them and sparks */
+    scheduleOfferWork(cap,task);
 
     scheduleDetectDeadlock(&cap,task);
 
@@ -427,6 +427,8 @@ run_thread:
     // that.
     cap->r.rCurrentTSO = t;
 
+    if (t->slices < STEAL_AFFINITY_SLICES) t->slices++;
+
     startHeapProfTimer();
 
     // ----------------------------------------------------------------------
@@ -582,6 +584,41 @@ run_thread:
  * Run queue operations
  * -------------------------------------------------------------------------- */
 
+// Put tso on the run queue ahead of the less urgent threads at the end
+// of it, but not ahead of any thread that has already been overtaken
+// MAX_RUN_QUEUE_OVERTAKES times.  Called by appendToRunQueue() when tso
+// is more urgent than the last thread on the queue.
+void
+insertOnRunQueue (Capability *cap, StgTSO *tso)
+{
+    StgTSO *prev, *next;
+
+    prev = cap->run_queue_tl;
+    while (prev != END_TSO_QUEUE
+           && prev->priority < tso->priority
+           && prev->overtaken < MAX_RUN_QUEUE_OVERTAKES) {
+        prev->overtaken++;
+        prev = prev->block_info.prev;
+    }
+
+    if (prev == END_TSO_QUEUE) {
+        next = cap->run_queue_hd;
+        cap->run_queue_hd = tso;
+    } else {
+        next = prev->_link;
+        setTSOLink(cap, prev, tso);
+    }
+    setTSOPrev(cap, tso, prev);
+    setTSOLink(cap, tso, next);
+    if (next == END_TSO_QUEUE) {
+        cap->run_queue_tl = tso;
+    } else {
+        setTSOPrev(cap, next, tso);
+    }
+
+    IF_DEBUG(sanity, checkRunQueue(cap));
+}
+
 void
 removeFromRunQueue (Capability *cap, StgTSO *tso)
 {
@@ -632,6 +669,8 @@ scheduleFindWork (Capability **pcap)
     scheduleCheckBlockedThreads(*pcap);
 
 #if defined(THREADED_RTS)
+    if (emptyRunQueue(*pcap)) { reclaimOfferedThreads(*pcap); }
+    if (emptyRunQueue(*pcap)) { scheduleStealThread(*pcap); }
     if (emptyRunQueue(*pcap)) { scheduleActivateSpark(*pcap); }
 #endif
 }
@@ -691,154 +730,207 @@ scheduleYield (Capability **pcap, Task *task)
 #endif
     
 /* -----------------------------------------------------------------------------
- * schedulePushWork()
+ * scheduleOfferWork()
+ *
+ * If we have more threads than we can run, and there are idle
+ * Capabilities, put some of the threads on our steal_queue and wake
+ * the idle Capabilities up to come and take them (see
+ * scheduleStealThread()).  This also wakes them up to steal our
+ * sparks.
  *
- * Push work to other Capabilities if we have some.
+ * A thread on the steal_queue has TSO_STEALABLE set.  Whoever takes
+ * it off the queue, be it us or a thief, clears the flag, and a thief
+ * sets tso->cap before doing so.  We must not touch a thread that has
+ * TSO_STEALABLE set: anything that wants to (throwTo, for example)
+ * calls reclaimThread() first.
+ *
+ * Bound threads and threads locked to this Capability are never
+ * offered, nor is the thread at the front of our run queue, which we
+ * keep for ourselves.
  * -------------------------------------------------------------------------- */
 
+#if defined(THREADED_RTS)
+// Move up to n threads from our run queue to our steal_queue.  Threads
+// that haven't run here much go first: a long-lived thread has built
+// up a working set in this CPU's cache, so we would rather it stayed.
+static nat
+offerThreads (Capability *cap, nat n)
+{
+    StgTSO *t, *next;
+    nat pass, offered;
+
+    offered = 0;
+    if (emptyRunQueue(cap)) return 0;
+
+    for (pass = 0; pass < 2 && offered < n; pass++) {
+        for (t = cap->run_queue_hd->_link;
+             t != END_TSO_QUEUE && offered < n; t = next) {
+            next = t->_link;
+            if (t->bound != NULL || tsoLocked(t)) continue;
+            if (pass == 0 && t->slices >= STEAL_AFFINITY_SLICES) continue;
+
+            removeFromRunQueue(cap, t);
+            t->flags |= TSO_STEALABLE;
+            if (!pushWSDeque(cap->steal_queue, t)) {
+                t->flags &= ~TSO_STEALABLE;
+                appendToRunQueue(cap, t);
+                return offered;
+            }
+            offered++;
+        }
+    }
+    return offered;
+}
+#endif
+
 static void
-schedulePushWork(Capability *cap USED_IF_THREADS, 
-		 Task *task      USED_IF_THREADS)
+scheduleOfferWork (Capability *cap USED_IF_THREADS,
+                   Task *task      USED_IF_THREADS)
 {
-  /* following code not for PARALLEL_HASKELL. I kept the call general,
-     future GUM versions might use pushing in a distributed setup */
 #if defined(THREADED_RTS)
-
-    Capability *free_caps[n_capabilities], *cap0;
-    nat i, n_free_caps;
+    Capability *cap0;
+    nat i, n_free_caps, n_sparks, n_wake;
+    long n_offered;
 
     // migration can be turned off with +RTS -qm
     if (!RtsFlags.ParFlags.migrate) return;
 
+    // don't hand out threads that are about to be deleted
+    if (sched_state >= SCHED_INTERRUPTING) return;
+
     // Check whether we have more threads on our run queue, or sparks
     // in our pool, that we could hand to another Capability.
-    if (cap->run_queue_hd == END_TSO_QUEUE) {
-        if (sparkPoolSizeCap(cap) < 2) return;
-    } else {
-        if (cap->run_queue_hd->_link == END_TSO_QUEUE &&
-            sparkPoolSizeCap(cap) < 1) return;
-    }
-
-    // First grab as many free Capabilities as we can.
-    for (i=0, n_free_caps=0; i < n_capabilities; i++) {
-	cap0 = &capabilities[i];
-        if (cap != cap0 && !cap0->disabled && tryGrabCapability(cap0,task)) {
-	    if (!emptyRunQueue(cap0)
-                || cap0->returning_tasks_hd != NULL
-                || cap0->inbox != (Message*)END_TSO_QUEUE) {
-		// it already has some work, we just grabbed it at 
-		// the wrong moment.  Or maybe it's deadlocked!
-		releaseCapability(cap0);
-	    } else {
-		free_caps[n_free_caps++] = cap0;
-	    }
-	}
+    if (looksEmptyWSDeque(cap->steal_queue)) {
+        if (cap->run_queue_hd == END_TSO_QUEUE) {
+            if (sparkPoolSizeCap(cap) < 2) return;
+        } else {
+            if (cap->run_queue_hd->_link == END_TSO_QUEUE &&
+                sparkPoolSizeCap(cap) < 1) return;
+        }
     }
 
-    // we now have n_free_caps free capabilities stashed in
-    // free_caps[].  Share our run queue equally with them.  This is
-    // probably the simplest thing we could do; improvements we might
-    // want to do include:
-    //
-    //   - giving high priority to moving relatively new threads, on 
-    //     the gournds that they haven't had time to build up a
-    //     working set in the cache on this CPU/Capability.
-    //
-    //   - giving low priority to moving long-lived threads
-
-    if (n_free_caps > 0) {
-	StgTSO *prev, *t, *next;
-#ifdef SPARK_PUSHING
-	rtsBool pushed_to_all;
-#endif
-
-	debugTrace(DEBUG_sched, 
-		   "cap %d: %s and %d free capabilities, sharing...", 
-		   cap->no, 
-		   (!emptyRunQueue(cap) && cap->run_queue_hd->_link != END_TSO_QUEUE)?
-		   "excess threads on run queue":"sparks to share (>=2)",
-		   n_free_caps);
-
-	i = 0;
-#ifdef SPARK_PUSHING
-	pushed_to_all = rtsFalse;
-#endif
-
-	if (cap->run_queue_hd != END_TSO_QUEUE) {
-	    prev = cap->run_queue_hd;
-	    t = prev->_link;
-	    prev->_link = END_TSO_QUEUE;
-	    for (; t != END_TSO_QUEUE; t = next) {
-		next = t->_link;
-		t->_link = END_TSO_QUEUE;
-                if (t->bound == task->incall // don't move my bound thread
-		    || tsoLocked(t)) {  // don't move a locked thread
-		    setTSOLink(cap, prev, t);
-                    setTSOPrev(cap, t, prev);
-		    prev = t;
-		} else if (i == n_free_caps) {
-#ifdef SPARK_PUSHING
-		    pushed_to_all = rtsTrue;
-#endif
-		    i = 0;
-		    // keep one for us
-		    setTSOLink(cap, prev, t);
-                    setTSOPrev(cap, t, prev);
-		    prev = t;
-		} else {
-		    appendToRunQueue(free_caps[i],t);
-
-                    traceEventMigrateThread (cap, t, free_caps[i]->no);
-
-		    if (t->bound) { t->bound->task->cap = free_caps[i]; }
-		    t->cap = free_caps[i];
-		    i++;
-		}
-	    }
-	    cap->run_queue_tl = prev;
-
-            IF_DEBUG(sanity, checkRunQueue(cap));
-	}
+    // This is only a hint: a Capability might be grabbed by somebody
+    // else before we get to wake it up.
+    n_free_caps = 0;
+    for (i = 0; i < n_capabilities; i++) {
+        cap0 = &capabilities[i];
+        if (cap0 != cap && !cap0->disabled && cap0->running_task == NULL) {
+            n_free_caps++;
+        }
+    }
 
-#ifdef SPARK_PUSHING
-	/* JB I left this code in place, it would work but is not necessary */
-
-	// If there are some free capabilities that we didn't push any
-	// threads to, then try to push a spark to each one.
-	if (!pushed_to_all) {
-	    StgClosure *spark;
-	    // i is the next free capability to push to
-	    for (; i < n_free_caps; i++) {
-		if (emptySparkPoolCap(free_caps[i])) {
-		    spark = tryStealSpark(cap->sparks);
-		    if (spark != NULL) {
-                        /* TODO: if anyone wants to re-enable this code then
-                         * they must consider the fizzledSpark(spark) case
-                         * and update the per-cap spark statistics.
-                         */
-			debugTrace(DEBUG_sched, "pushing spark %p to capability %d", spark, free_caps[i]->no);
-
-            traceEventStealSpark(free_caps[i], t, cap->no);
-
-			newSpark(&(free_caps[i]->r), spark);
-		    }
-		}
-	    }
-	}
-#endif /* SPARK_PUSHING */
+    if (n_free_caps == 0) {
+        // Nobody is going to come for the threads we offered earlier,
+        // so run them ourselves.
+        reclaimOfferedThreads(cap);
+        return;
+    }
 
-	// release the capabilities
-	for (i = 0; i < n_free_caps; i++) {
-	    task->cap = free_caps[i];
-	    releaseAndWakeupCapability(free_caps[i]);
-	}
+    n_offered = dequeElements(cap->steal_queue);
+    if (n_offered < 0) n_offered = 0;
+    if ((nat)n_offered < n_free_caps) {
+        n_offered += offerThreads(cap, n_free_caps - n_offered);
     }
-    task->cap = cap; // reset to point to our Capability.
 
+    // sparks that we won't run ourselves straight away
+    n_sparks = sparkPoolSizeCap(cap);
+    if (emptyRunQueue(cap) && n_sparks > 0) n_sparks--;
+
+    n_wake = stg_min((nat)n_offered + n_sparks, n_free_caps);
+    if (n_wake == 0) return;
+
+    debugTrace(DEBUG_sched,
+               "cap %d: %ld threads and %d sparks to share, "
+               "waking %d free capabilities",
+               cap->no, n_offered, n_sparks, n_wake);
+
+    for (i = 1; i < n_capabilities && n_wake > 0; i++) {
+        cap0 = &capabilities[(cap->no + i) % n_capabilities];
+        if (!cap0->disabled && cap0->running_task == NULL) {
+            prodCapability(cap0, task);
+            n_wake--;
+        }
+    }
 #endif /* THREADED_RTS */
+}
+
+#if defined(THREADED_RTS)
+/* -----------------------------------------------------------------------------
+ * scheduleStealThread()
+ *
+ * Our run queue is empty: take a thread from the steal_queue of
+ * another Capability.
+ * -------------------------------------------------------------------------- */
+
+static void
+scheduleStealThread (Capability *cap)
+{
+    Capability *robbed;
+    StgTSO *t;
+    nat i;
+
+    if (!RtsFlags.ParFlags.migrate || cap->disabled) return;
+
+    // start with our neighbour, so that the thieves spread out
+    for (i = 1; i < n_capabilities; i++) {
+        robbed = &capabilities[(cap->no + i) % n_capabilities];
+
+        if (looksEmptyWSDeque(robbed->steal_queue)) continue;
+
+        t = stealWSDeque(robbed->steal_queue);
+        if (t == NULL) continue;
+
+        // The thread is ours now.  The victim may be waiting in
+        // reclaimThread_() to find out who owns it, so TSO_STEALABLE
+        // must be the last thing we change.
+        ASSERT(t->flags & TSO_STEALABLE);
+        t->cap = cap;
+        t->slices = 0;
+        write_barrier();
+        t->flags &= ~TSO_STEALABLE;
+
+        debugTrace(DEBUG_sched, "cap %d: stole thread %lu from cap %d",
+                   cap->no, (unsigned long)t->id, robbed->no);
+        traceEventStealThread(cap, t, robbed->no);
+
+        appendToRunQueue(cap, t);
+        return;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Taking back the threads we offered
+ * -------------------------------------------------------------------------- */
+
+// Put the threads on our steal_queue that nobody has stolen back on
+// our run queue.  They go at the front, since they have already been
+// waiting.  This is also used by scheduleDoGC() to empty the
+// steal_queue of every Capability once they have all stopped.
+void
+reclaimOfferedThreads (Capability *cap)
+{
+    StgTSO *t;
 
+    while ((t = popWSDeque(cap->steal_queue)) != NULL) {
+        t->flags &= ~TSO_STEALABLE;
+        pushOnRunQueue(cap, t);
+    }
 }
 
+// tso looked like ours but had TSO_STEALABLE set: take back everything
+// we offered, and if a thief got to tso first, wait until it has
+// finished taking it (it sets tso->cap before clearing the flag).
+void
+reclaimThread_ (Capability *cap, StgTSO *tso)
+{
+    reclaimOfferedThreads(cap);
+    while ((*(volatile StgWord32 *)&tso->flags & TSO_STEALABLE) &&
+           *(Capability * volatile *)&tso->cap == cap) {
+        busy_wait_nop();
+    }
+}
+#endif /* THREADED_RTS */
+
 /* ----------------------------------------------------------------------------
  * Start any pending signal handlers
  * ------------------------------------------------------------------------- */
@@ -872,7 +964,7 @@ scheduleCheckBlockedThreads(Capability *cap USED_IF_NOT_THREADS)
     // run queue is empty, and there are no other tasks running, we
     // can wait indefinitely for something to happen.
     //
-    if ( !emptyQueue(blocked_queue_hd) || !emptyQueue(sleeping_queue) )
+    if ( !EMPTY_BLOCKED_QUEUE() || !EMPTY_SLEEPING_QUEUE() )
     {
 	awaitEvent (emptyRunQueue(cap));
     }
@@ -1001,8 +1093,7 @@ scheduleProcessInbox (Capability **pcap USED_IF_THREADS)
     Capability *cap = *pcap;
 
     while (!emptyInbox(cap)) {
-        if (cap->r.rCurrentNursery->link == NULL ||
-            g0->n_new_large_words >= large_alloc_lim) {
+        if (doYouWantToGC(cap)) {
             scheduleDoGC(pcap, cap->running_task, rtsFalse);
             cap = *pcap;
         }
@@ -1068,7 +1159,7 @@ schedulePostRunThread (Capability *cap, StgTSO *t)
     // and a is never equal to b given a consistent view of memory.
     //
     if (t -> trec != NO_TREC && t -> why_blocked == NotBlocked) {
-        if (!stmValidateNestOfTransactions (t -> trec)) {
+        if (!stmValidateNestOfTransactions (cap, t -> trec)) {
             debugTrace(DEBUG_sched | DEBUG_stm,
                        "trec %p found wasting its time", t);
             
@@ -1113,7 +1204,7 @@ scheduleHandleHeapOverflow( Capability *cap, StgTSO *t )
 	    cap->r.rNursery->n_blocks == 1) {  // paranoia to prevent infinite loop
 	                                       // if the nursery has only one block.
 	    
-            bd = allocGroup_lock(blocks);
+            bd = allocGroupOnCap_lock(cap,blocks);
             cap->r.rNursery->n_blocks += blocks;
 	    
 	    // link the new group into the list
@@ -1157,7 +1248,7 @@ scheduleHandleHeapOverflow( Capability *cap, StgTSO *t )
 	    return rtsFalse;  /* not actually GC'ing */
 	}
     }
-    
+
     if (cap->r.rHpLim == NULL || cap->context_switch) {
         // Sometimes we miss a context switch, e.g. when calling
         // primitives in a tight loop, MAYBE_GC() doesn't check the
@@ -1168,6 +1259,16 @@ scheduleHandleHeapOverflow( Capability *cap, StgTSO *t )
     } else {
         pushOnRunQueue(cap,t);
     }
+
+    // If the allocation area is divided into chunks (+RTS -n), there
+    // might be one left that we can use instead of GCing.
+    if (cap->r.rCurrentNursery->link == NULL &&
+        g0->n_new_large_words < large_alloc_lim &&
+        getNewNursery(cap)) {
+        debugTrace(DEBUG_sched, "thread %ld got a new nursery", (long)t->id);
+        return rtsFalse;
+    }
+
     return rtsTrue;
     /* actual GC is done at the end of the while loop in schedule() */
 }
@@ -1434,6 +1535,22 @@ static void releaseAllCapabilities(Capability *cap, Task *task)
  * Perform a garbage collection if necessary
  * -------------------------------------------------------------------------- */
 
+#if defined(THREADED_RTS)
+static rtsBool
+isIdleForGC (Capability *cap)
+{
+    if (RtsFlags.ParFlags.parGcNoSyncWithIdle != 0 &&
+        cap->idle >= RtsFlags.ParFlags.parGcNoSyncWithIdle) {
+        return rtsTrue;
+    }
+    if (RtsFlags.ParFlags.parGcNoSyncWithoutAlloc &&
+        !nurseryUsedSinceGC(cap)) {
+        return rtsTrue;
+    }
+    return rtsFalse;
+}
+#endif
+
 static void
 scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
               rtsBool force_major)
@@ -1526,8 +1643,16 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
         // any idle capabilities.  The rationale here is that waking
         // up an idle Capability takes much longer than just doing any
         // GC work on its behalf.
-
-        if (RtsFlags.ParFlags.parGcNoSyncWithIdle == 0
+        //
+        // A Capability is idle if it has not run anything for the
+        // last parGcNoSyncWithIdle GCs (+RTS -qi), or if it has not
+        // allocated a nursery block's worth since the last GC (+RTS
+        // -ql).  Each active Capability collects its own nursery and
+        // mutable list; the idle ones have so little of either that
+        // we do it for them.
+
+        if ((RtsFlags.ParFlags.parGcNoSyncWithIdle == 0 &&
+             !RtsFlags.ParFlags.parGcNoSyncWithoutAlloc)
             || (RtsFlags.ParFlags.parGcLoadBalancingEnabled &&
                 N >= RtsFlags.ParFlags.parGcLoadBalancingGen)) {
             for (i=0; i < n_capabilities; i++) {
@@ -1542,7 +1667,7 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
                 if (capabilities[i].disabled) {
                     idle_cap[i] = tryGrabCapability(&capabilities[i], task);
                 } else if (i == cap->no ||
-                           capabilities[i].idle < RtsFlags.ParFlags.parGcNoSyncWithIdle) {
+                           !isIdleForGC(&capabilities[i])) {
                     idle_cap[i] = rtsFalse;
                 } else {
                     idle_cap[i] = tryGrabCapability(&capabilities[i], task);
@@ -1581,6 +1706,15 @@ scheduleDoGC (Capability **pcap, Task *task USED_IF_THREADS,
 
 #endif
 
+#if defined(THREADED_RTS)
+    // Nobody can steal now, so put the threads that were offered to
+    // idle Capabilities back on the run queues, where the rest of
+    // the world (and the GC) expects them.
+    for (i = 0; i < n_capabilities; i++) {
+        reclaimOfferedThreads(&capabilities[i]);
+    }
+#endif
+
     IF_DEBUG(scheduler, printAllThreads());
 
 delete_threads_and_gc:
@@ -1641,6 +1775,7 @@ delete_threads_and_gc:
 #endif
 
     traceSparkCounters(cap);
+    traceStmCounters(cap);
 
     if (recent_activity == ACTIVITY_INACTIVE && force_major)
     {
@@ -1865,6 +2000,8 @@ forkProcess(HsStablePtr *entry
             cap->n_spare_workers = 0;
             cap->returning_tasks_hd = NULL;
             cap->returning_tasks_tl = NULL;
+            // and the threads it offered are dead
+            discardElements(cap->steal_queue);
 #endif
 
             // Release all caps except 0, we'll use that for starting
@@ -1888,6 +2025,12 @@ forkProcess(HsStablePtr *entry
         initTimer();
         startTimer();
 
+#if !defined(THREADED_RTS)
+        // The epoll instance, if we have one, is shared with the
+        // parent, so the child needs its own.
+        resetAwaitEvent();
+#endif
+
 #if defined(THREADED_RTS)
         ioManagerStartCap(&cap);
 #endif
@@ -1971,7 +2114,7 @@ setNumCapabilities (nat new_n_capabilities USED_IF_THREADS)
         //     (see scheduleActivateSpark())
         //
         //   - We do not attempt to migrate threads *to* a disabled
-        //     capability (see schedulePushWork()).
+        //     capability (see scheduleStealThread()).
         //
         // but in other respects, a disabled capability remains
         // alive.  Threads may be woken up on a disabled capability,
@@ -2082,8 +2225,8 @@ deleteAllThreads ( Capability *cap )
     // being GC'd, and we don't want the "main thread has been GC'd" panic.
 
 #if !defined(THREADED_RTS)
-    ASSERT(blocked_queue_hd == END_TSO_QUEUE);
-    ASSERT(sleeping_queue == END_TSO_QUEUE);
+    ASSERT(EMPTY_BLOCKED_QUEUE());
+    ASSERT(EMPTY_SLEEPING_QUEUE());
 #endif
 }
 
@@ -2396,7 +2539,9 @@ initScheduler(void)
 #if !defined(THREADED_RTS)
   blocked_queue_hd  = END_TSO_QUEUE;
   blocked_queue_tl  = END_TSO_QUEUE;
-  sleeping_queue    = END_TSO_QUEUE;
+#if !defined(mingw32_HOST_OS)
+  initAwaitEvent();
+#endif
 #endif
 
   sched_state    = SCHED_RUNNING;
@@ -2480,6 +2625,9 @@ freeScheduler( void )
 #if defined(THREADED_RTS)
     closeMutex(&sched_mutex);
 #endif
+#if !defined(THREADED_RTS) && !defined(mingw32_HOST_OS)
+    exitAwaitEvent();
+#endif
 }
 
 void markScheduler (evac_fn evac USED_IF_NOT_THREADS, 
@@ -2488,7 +2636,9 @@ void markScheduler (evac_fn evac USED_IF_NOT_THREADS,
 #if !defined(THREADED_RTS)
     evac(user, (StgClosure **)(void *)&blocked_queue_hd);
     evac(user, (StgClosure **)(void *)&blocked_queue_tl);
-    evac(user, (StgClosure **)(void *)&sleeping_queue);
+#if !defined(mingw32_HOST_OS)
+    markAwaitEvent(evac, user);
+#endif
 #endif 
 }
 
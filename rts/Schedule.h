@@ -13,6 +13,7 @@
 #include "rts/OSThreads.h"
 #include "Capability.h"
 #include "Trace.h"
+#include "AwaitEvent.h"
 
 #include "BeginPrivate.h"
 
@@ -84,7 +85,6 @@ extern volatile StgWord recent_activity;
 extern  StgTSO *blackhole_queue;
 #if !defined(THREADED_RTS)
 extern  StgTSO *blocked_queue_hd, *blocked_queue_tl;
-extern  StgTSO *sleeping_queue;
 #endif
 
 extern rtsBool heap_overflow;
@@ -106,7 +106,16 @@ void resurrectThreads (StgTSO *);
 
 /* END_TSO_QUEUE and friends now defined in includes/StgMiscClosures.h */
 
-/* Add a thread to the end of the run queue.
+/* A thread can be overtaken on the run queue by this many more urgent
+ * threads before it stops giving way, which bounds how long a
+ * low-priority thread can starve.
+ */
+#define MAX_RUN_QUEUE_OVERTAKES 16
+
+extern void insertOnRunQueue (Capability *cap, StgTSO *tso);
+
+/* Add a thread to the end of the run queue, or further forward if it
+ * is more urgent than the threads at the end (see insertOnRunQueue()).
  * NOTE: tso->link should be END_TSO_QUEUE before calling this macro.
  * ASSUMES: cap->running_task is the current task.
  */
@@ -117,14 +126,24 @@ EXTERN_INLINE void
 appendToRunQueue (Capability *cap, StgTSO *tso)
 {
     ASSERT(tso->_link == END_TSO_QUEUE);
+    tso->overtaken = 0;
     if (cap->run_queue_hd == END_TSO_QUEUE) {
 	cap->run_queue_hd = tso;
         tso->block_info.prev = END_TSO_QUEUE;
-    } else {
+        cap->run_queue_tl = tso;
+    } else if (cap->run_queue_tl->priority >= tso->priority) {
 	setTSOLink(cap, cap->run_queue_tl, tso);
         setTSOPrev(cap, tso, cap->run_queue_tl);
+        cap->run_queue_tl = tso;
+    } else {
+        insertOnRunQueue(cap, tso);
+    }
+
+    // If tso is more urgent than the thread we are running, get back
+    // to the scheduler soon rather than at the end of the time slice.
+    if (cap->in_haskell && cap->r.rCurrentTSO->priority < tso->priority) {
+        cap->context_switch = 1;
     }
-    cap->run_queue_tl = tso;
 }
 
 /* Push a thread on the beginning of the run queue.
@@ -167,6 +186,40 @@ popRunQueue (Capability *cap)
 
 extern void removeFromRunQueue (Capability *cap, StgTSO *tso);
 
+/* Threads that a busy Capability offers to idle ones go on its
+ * steal_queue (see scheduleOfferWork() in Schedule.c).  A thread that
+ * has run this many times on its Capability is only offered if there
+ * is nothing younger to offer.
+ */
+#define STEAL_QUEUE_SIZE      256
+#define STEAL_AFFINITY_SLICES 8
+
+#if defined(THREADED_RTS)
+extern void reclaimOfferedThreads (Capability *cap);
+extern void reclaimThread_        (Capability *cap, StgTSO *tso);
+#endif
+
+/* Use this rather than (tso->cap == cap) to decide whether we own a
+ * thread that might be runnable: it also makes sure that the thread
+ * is not on our steal_queue, so that we can touch it.  Returns
+ * rtsFalse if the thread belongs to (or has just been stolen by)
+ * another Capability.
+ */
+INLINE_HEADER rtsBool
+reclaimThread (Capability *cap USED_IF_THREADS, StgTSO *tso USED_IF_THREADS)
+{
+#if defined(THREADED_RTS)
+    if (tso->cap != cap) return rtsFalse;
+    if (tso->flags & TSO_STEALABLE) {
+        reclaimThread_(cap, tso);
+    }
+    load_load_barrier();
+    return (tso->cap == cap);
+#else
+    return rtsTrue;
+#endif
+}
+
 /* Add a thread to the end of the blocked queue.
  */
 #if !defined(THREADED_RTS)
@@ -198,8 +251,14 @@ emptyRunQueue(Capability *cap)
 }
 
 #if !defined(THREADED_RTS)
+#if defined(mingw32_HOST_OS)
+// On Windows, delays are I/O requests on the blocked_queue
 #define EMPTY_BLOCKED_QUEUE()  (emptyQueue(blocked_queue_hd))
-#define EMPTY_SLEEPING_QUEUE() (emptyQueue(sleeping_queue))
+#define EMPTY_SLEEPING_QUEUE() (rtsTrue)
+#else
+#define EMPTY_BLOCKED_QUEUE()  (emptyQueue(blocked_queue_hd) && emptyFdWaiters())
+#define EMPTY_SLEEPING_QUEUE() (emptySleepingThreads())
+#endif
 #endif
 
 INLINE_HEADER rtsBool
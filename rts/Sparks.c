@@ -20,7 +20,8 @@
 SparkPool *
 allocSparkPool( void )
 {
-    return newWSDeque(RtsFlags.ParFlags.maxLocalSparks);
+    return newGrowableWSDeque(RtsFlags.ParFlags.maxLocalSparks,
+                              RtsFlags.ParFlags.sparkPoolLimit);
 }
 
 void
@@ -110,6 +111,10 @@ pruneSparkQueue (Capability *cap)
     pool->top     &= pool->moduloSize;
     pool->topBound = pool->top;
 
+    // Nobody is stealing, so the arrays that the pool has outgrown
+    // can go too.
+    freeRetiredWSDeque(pool);
+
     debugTrace(DEBUG_sparks,
                "markSparkQueue: current spark queue len=%ld; (hd=%ld; tl=%ld)",
                sparkPoolSize(pool), pool->bottom, pool->top);
@@ -14,6 +14,10 @@
 #include "RtsUtils.h"
 #include "Trace.h"
 #include "Stable.h"
+#include "Capability.h"
+#include "Task.h"
+
+#include <string.h>
 
 /* Comment from ADR's implementation in old RTS:
 
@@ -71,86 +75,143 @@
 
 */
 
-snEntry *stable_ptr_table = NULL;
-static snEntry *stable_ptr_free = NULL;
+/* -----------------------------------------------------------------------------
+ * The stable pointer table
+ *
+ * The table is a directory of segments, each holding
+ * STABLE_PTR_SEGMENT_SIZE spEntry structs.  Enlarging the table
+ * allocates a new segment, and occasionally a bigger directory; the
+ * entries themselves never move, so there is no big copy while
+ * stable_mutex is held.  A directory that has been replaced is kept
+ * until exitStablePtrTable(), because deRefStablePtr() and the
+ * Capability fast paths below index the table without the lock.
+ *
+ * A free entry holds the index of the next free entry, encoded as
+ * (next << 1) | 1.  Index 0 is never handed out, so that a NULL
+ * StablePtr stays invalid, and 0 terminates a free list.
+ *
+ * There is a global free list protected by stable_mutex.  In the
+ * threaded RTS each Capability also caches a short free list of its
+ * own: when getStablePtr()/freeStablePtr() are called by the Task
+ * that owns a Capability, they only touch that cache, and take
+ * stable_mutex once every SPT_CACHE_BATCH operations to refill it or
+ * to hand a batch back.  Calls made without a Capability
+ * (e.g. hs_free_stable_ptr() from a foreign thread) use the global
+ * list directly.
+ * -------------------------------------------------------------------------- */
+
+spEntry **stable_ptr_table = NULL;
+static nat SPT_n_segments = 0;          // segments in use
+static nat SPT_dir_size = 0;            // capacity of the directory
+static StgWord stable_ptr_free = 0;     // global free list, 0 if empty
+
+// Directories replaced by enlargeStablePtrTable(), freed on exit
+typedef struct OldSPTDir_ {
+    spEntry **dir;
+    struct OldSPTDir_ *link;
+} OldSPTDir;
+
+static OldSPTDir *old_SPT_dirs = NULL;
+
+#define INIT_SPT_DIR_SIZE 16
 
-static unsigned int SPT_size = 0;
+// Number of entries moved between a Capability and the global free
+// list at a time.  A Capability holds at most 2*SPT_CACHE_BATCH.
+#define SPT_CACHE_BATCH 32
+
+#define SPT_FREE_LINK(next) ((StgPtr)(((StgWord)(next) << 1) | 1))
+#define SPT_FREE_NEXT(e)    ((StgWord)(e)->addr >> 1)
+
+/* -----------------------------------------------------------------------------
+ * The stable name table
+ *
+ * Stable names live in a table of their own, so that the hash table
+ * and the stable pointer fast paths don't get in each other's way.
+ *
+ * Live entries are kept on one list per generation, linked through
+ * their 'link' field by index.  An entry belongs to the youngest
+ * generation of its object and its StableName object, so a GC of
+ * generations 0..N only has to look at the lists for those
+ * generations: nothing else can have died or moved.  The entries it
+ * visits are collected on sn_pending by gcStablePtrTable(), re-hashed
+ * if they moved and re-filed by generation in updateStablePtrTable().
+ * -------------------------------------------------------------------------- */
+
+snEntry *stable_name_table = NULL;
+static snEntry *stable_name_free = NULL;
+
+static unsigned int SNT_size = 0;
+
+static StgWord *sn_gen_lists = NULL;    // per generation, 0 if empty
+static StgWord  sn_pending = 0;         // entries visited by this GC
 
 #ifdef THREADED_RTS
 Mutex stable_mutex;
 #endif
 
 static void enlargeStablePtrTable(void);
+static void enlargeStableNameTable(void);
 
 /* This hash table maps Haskell objects to stable names, so that every
  * call to lookupStableName on a given object will return the same
  * stable name.
- *
- * OLD COMMENTS about reference counting follow.  The reference count
- * in a stable name entry is now just a counter.
- *
- * Reference counting
- * ------------------
- * A plain stable name entry has a zero reference count, which means
- * the entry will dissappear when the object it points to is
- * unreachable.  For stable pointers, we need an entry that sticks
- * around and keeps the object it points to alive, so each stable name
- * entry has an associated reference count.
- *
- * A stable pointer has a weighted reference count N attached to it
- * (actually in its upper 5 bits), which represents the weight
- * 2^(N-1).  The stable name entry keeps a 32-bit reference count, which
- * represents any weight between 1 and 2^32 (represented as zero).
- * When the weight is 2^32, the stable name table owns "all" of the
- * stable pointers to this object, and the entry can be garbage
- * collected if the object isn't reachable.
- *
- * A new stable pointer is given the weight log2(W/2), where W is the
- * weight stored in the table entry.  The new weight in the table is W
- * - 2^log2(W/2).
- *
- * A stable pointer can be "split" into two stable pointers, by
- * dividing the weight by 2 and giving each pointer half.
- * When freeing a stable pointer, the weight of the pointer is added
- * to the weight stored in the table entry.
- * */
+ */
 
 static HashTable *addrToStableHash = NULL;
 
-#define INIT_SPT_SIZE 64
+#define INIT_SNT_SIZE 64
+
+STATIC_INLINE spEntry *
+spEntryOf (StgWord sp)
+{
+    return &stable_ptr_table[sp >> STABLE_PTR_SEGMENT_BITS]
+                            [sp & STABLE_PTR_SEGMENT_MASK];
+}
 
 STATIC_INLINE void
-initFreeList(snEntry *table, nat n, snEntry *free)
+initSnEntryFreeList(snEntry *table, nat n, snEntry *free)
 {
   snEntry *p;
 
   for (p = table + n - 1; p >= table; p--) {
     p->addr   = (P_)free;
     p->old    = NULL;
-    p->ref    = 0;
     p->sn_obj = NULL;
+    p->link   = 0;
     free = p;
   }
-  stable_ptr_free = table;
+  stable_name_free = table;
 }
 
 void
 initStablePtrTable(void)
 {
-	if (SPT_size > 0)
+    nat g;
+
+	if (SNT_size > 0)
 		return;
 
-    SPT_size = INIT_SPT_SIZE;
-    stable_ptr_table = stgMallocBytes(SPT_size * sizeof(snEntry),
-				      "initStablePtrTable");
+    SNT_size = INIT_SNT_SIZE;
+    stable_name_table = stgMallocBytes(SNT_size * sizeof(snEntry),
+                                       "initStablePtrTable");
 
     /* we don't use index 0 in the stable name table, because that
      * would conflict with the hash table lookup operations which
      * return NULL if an entry isn't found in the hash table.
      */
-    initFreeList(stable_ptr_table+1,INIT_SPT_SIZE-1,NULL);
+    initSnEntryFreeList(stable_name_table+1,INIT_SNT_SIZE-1,NULL);
     addrToStableHash = allocHashTable();
 
+    sn_gen_lists = stgMallocBytes(RtsFlags.GcFlags.generations * sizeof(StgWord),
+                                  "initStablePtrTable");
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        sn_gen_lists[g] = 0;
+    }
+    sn_pending = 0;
+
+    // the first segment of the stable pointer table
+    enlargeStablePtrTable();
+
 #ifdef THREADED_RTS
     initMutex(&stable_mutex);
 #endif
@@ -159,13 +220,36 @@ initStablePtrTable(void)
 void
 exitStablePtrTable(void)
 {
+  nat i;
+  OldSPTDir *old, *next;
+
   if (addrToStableHash)
     freeHashTable(addrToStableHash, NULL);
   addrToStableHash = NULL;
+  if (stable_name_table)
+    stgFree(stable_name_table);
+  stable_name_table = NULL;
+  stable_name_free = NULL;
+  SNT_size = 0;
+  if (sn_gen_lists)
+    stgFree(sn_gen_lists);
+  sn_gen_lists = NULL;
+
+  for (i = 0; i < SPT_n_segments; i++) {
+    stgFree(stable_ptr_table[i]);
+  }
   if (stable_ptr_table)
     stgFree(stable_ptr_table);
+  for (old = old_SPT_dirs; old != NULL; old = next) {
+    next = old->link;
+    stgFree(old->dir);
+    stgFree(old);
+  }
+  old_SPT_dirs = NULL;
   stable_ptr_table = NULL;
-  SPT_size = 0;
+  stable_ptr_free = 0;
+  SPT_n_segments = 0;
+  SPT_dir_size = 0;
 #ifdef THREADED_RTS
   closeMutex(&stable_mutex);
 #endif
@@ -203,8 +287,8 @@ lookupStableName_(StgPtr p)
   StgWord sn;
   void* sn_tmp;
 
-  if (stable_ptr_free == NULL) {
-    enlargeStablePtrTable();
+  if (stable_name_free == NULL) {
+    enlargeStableNameTable();
   }
 
   /* removing indirections increases the likelihood
@@ -219,15 +303,17 @@ lookupStableName_(StgPtr p)
   sn = (StgWord)sn_tmp;
   
   if (sn != 0) {
-    ASSERT(stable_ptr_table[sn].addr == p);
+    ASSERT(stable_name_table[sn].addr == p);
     debugTrace(DEBUG_stable, "cached stable name %ld at %p",sn,p);
     return sn;
   } else {
-    sn = stable_ptr_free - stable_ptr_table;
-    stable_ptr_free  = (snEntry*)(stable_ptr_free->addr);
-    stable_ptr_table[sn].ref = 0;
-    stable_ptr_table[sn].addr = p;
-    stable_ptr_table[sn].sn_obj = NULL;
+    sn = stable_name_free - stable_name_table;
+    stable_name_free  = (snEntry*)(stable_name_free->addr);
+    stable_name_table[sn].addr = p;
+    stable_name_table[sn].sn_obj = NULL;
+    // the StableName object is about to be allocated in the nursery
+    stable_name_table[sn].link = sn_gen_lists[0];
+    sn_gen_lists[0] = sn;
     /* debugTrace(DEBUG_stable, "new stable name %d at %p\n",sn,p); */
     
     /* add the new stable name to the hash table */
@@ -256,60 +342,217 @@ freeStableName(snEntry *sn)
   if (sn->addr != NULL) {
       removeHashTable(addrToStableHash, (W_)sn->addr, NULL);
   }
-  sn->addr = (P_)stable_ptr_free;
-  stable_ptr_free = sn;
+  sn->addr = (P_)stable_name_free;
+  stable_name_free = sn;
+}
+
+static void
+enlargeStableNameTable(void)
+{
+  nat old_SNT_size = SNT_size;
+
+    // 2nd and subsequent times
+  SNT_size *= 2;
+  stable_name_table =
+    stgReallocBytes(stable_name_table,
+		      SNT_size * sizeof(snEntry),
+		      "enlargeStableNameTable");
+
+  initSnEntryFreeList(stable_name_table + old_SNT_size, old_SNT_size, NULL);
+}
+
+/* -----------------------------------------------------------------------------
+ * Allocating and freeing stable pointers
+ * -------------------------------------------------------------------------- */
+
+// Take an entry from the global free list.  Requires stable_mutex.
+static StgWord
+allocSpEntry(void)
+{
+  StgWord sp;
+
+  if (stable_ptr_free == 0) {
+    enlargeStablePtrTable();
+  }
+  sp = stable_ptr_free;
+  stable_ptr_free = SPT_FREE_NEXT(spEntryOf(sp));
+  return sp;
+}
+
+#if defined(THREADED_RTS)
+// The Capability owned by the calling OS thread, or NULL if it
+// doesn't hold one.  Only the running_task of a Capability can see
+// itself here, so the result can't change under our feet.
+STATIC_INLINE Capability *
+myOwnedCapability(void)
+{
+  Task *task = myTask();
+
+  if (task != NULL && task->cap != NULL && task->cap->running_task == task) {
+    return task->cap;
+  }
+  return NULL;
 }
 
+static void
+refillStablePtrCache(Capability *cap)
+{
+  StgWord sp;
+  nat n;
+
+  ACQUIRE_LOCK(&stable_mutex);
+  for (n = 0; n < SPT_CACHE_BATCH; n++) {
+    sp = allocSpEntry();
+    spEntryOf(sp)->addr = SPT_FREE_LINK(cap->stable_ptr_free);
+    cap->stable_ptr_free = sp;
+  }
+  RELEASE_LOCK(&stable_mutex);
+  cap->n_stable_ptr_free += SPT_CACHE_BATCH;
+}
+
+static void
+flushStablePtrCache(Capability *cap)
+{
+  StgWord first, last;
+  nat n;
+
+  // detach the first SPT_CACHE_BATCH entries of the cache...
+  first = last = cap->stable_ptr_free;
+  for (n = 1; n < SPT_CACHE_BATCH; n++) {
+    last = SPT_FREE_NEXT(spEntryOf(last));
+  }
+  cap->stable_ptr_free = SPT_FREE_NEXT(spEntryOf(last));
+  cap->n_stable_ptr_free -= SPT_CACHE_BATCH;
+
+  // ...and splice them onto the global free list
+  ACQUIRE_LOCK(&stable_mutex);
+  spEntryOf(last)->addr = SPT_FREE_LINK(stable_ptr_free);
+  stable_ptr_free = first;
+  RELEASE_LOCK(&stable_mutex);
+}
+#endif
+
 StgStablePtr
 getStablePtr(StgPtr p)
 {
-  StgWord sn;
+  StgWord sp;
+#if defined(THREADED_RTS)
+  Capability *cap;
+#endif
 
   initStablePtrTable();
+
+  // register the untagged pointer: a live entry must have its low bit
+  // clear, see SPT_ENTRY_IS_FREE().
+  p = (StgPtr)UNTAG_CLOSURE((StgClosure*)p);
+
+#if defined(THREADED_RTS)
+  cap = myOwnedCapability();
+  if (cap != NULL) {
+    if (cap->n_stable_ptr_free == 0) {
+      refillStablePtrCache(cap);
+    }
+    sp = cap->stable_ptr_free;
+    cap->stable_ptr_free = SPT_FREE_NEXT(spEntryOf(sp));
+    cap->n_stable_ptr_free--;
+    spEntryOf(sp)->addr = p;
+    return (StgStablePtr)sp;
+  }
+#endif
+
   ACQUIRE_LOCK(&stable_mutex);
-  sn = lookupStableName_(p);
-  stable_ptr_table[sn].ref++;
+  sp = allocSpEntry();
+  spEntryOf(sp)->addr = p;
   RELEASE_LOCK(&stable_mutex);
-  return (StgStablePtr)(sn);
+  return (StgStablePtr)sp;
 }
 
 void
-freeStablePtr(StgStablePtr sp)
+freeStablePtr(StgStablePtr stable_ptr)
 {
-    snEntry *sn;
-
-	initStablePtrTable();
-    ACQUIRE_LOCK(&stable_mutex);
-
-    sn = &stable_ptr_table[(StgWord)sp];
-    
-    ASSERT((StgWord)sp < SPT_size  &&  sn->addr != NULL  &&  sn->ref > 0);
+    StgWord sp = (StgWord)stable_ptr;
+    spEntry *e;
+#if defined(THREADED_RTS)
+    Capability *cap;
+#endif
 
-    sn->ref--;
+    initStablePtrTable();
 
-    // If this entry has no StableName attached, then just free it
-    // immediately.  This is important; it might be a while before the
-    // next major GC which actually collects the entry.
-    if (sn->sn_obj == NULL && sn->ref == 0) {
-	freeStableName(sn);
+    e = spEntryOf(sp);
+
+    ASSERT(sp > 0 && sp < ((StgWord)SPT_n_segments << STABLE_PTR_SEGMENT_BITS)
+           && !SPT_ENTRY_IS_FREE(e));
+
+#if defined(THREADED_RTS)
+    cap = myOwnedCapability();
+    if (cap != NULL) {
+        e->addr = SPT_FREE_LINK(cap->stable_ptr_free);
+        cap->stable_ptr_free = sp;
+        cap->n_stable_ptr_free++;
+        if (cap->n_stable_ptr_free > 2 * SPT_CACHE_BATCH) {
+            flushStablePtrCache(cap);
+        }
+        return;
     }
+#endif
 
+    ACQUIRE_LOCK(&stable_mutex);
+    e->addr = SPT_FREE_LINK(stable_ptr_free);
+    stable_ptr_free = sp;
     RELEASE_LOCK(&stable_mutex);
 }
 
+// Add a segment to the stable pointer table, and put its entries on
+// the global free list.  Requires stable_mutex (or that the RTS is
+// still single-threaded).
 static void
 enlargeStablePtrTable(void)
 {
-  nat old_SPT_size = SPT_size;
+  spEntry **dir;
+  spEntry *segment;
+  OldSPTDir *old;
+  StgWord base, free;
+  nat i;
+
+  if (SPT_n_segments == SPT_dir_size) {
+    SPT_dir_size = SPT_dir_size == 0 ? INIT_SPT_DIR_SIZE : SPT_dir_size * 2;
+    dir = stgMallocBytes(SPT_dir_size * sizeof(spEntry *),
+                         "enlargeStablePtrTable");
+    if (stable_ptr_table != NULL) {
+      memcpy(dir, stable_ptr_table, SPT_n_segments * sizeof(spEntry *));
+      old = stgMallocBytes(sizeof(OldSPTDir), "enlargeStablePtrTable");
+      old->dir  = stable_ptr_table;
+      old->link = old_SPT_dirs;
+      old_SPT_dirs = old;
+    }
+    // the copy must be visible before the new directory is
+    write_barrier();
+    stable_ptr_table = dir;
+  }
 
-    // 2nd and subsequent times
-  SPT_size *= 2;
-  stable_ptr_table =
-    stgReallocBytes(stable_ptr_table,
-		      SPT_size * sizeof(snEntry),
-		      "enlargeStablePtrTable");
+  segment = stgMallocBytes(STABLE_PTR_SEGMENT_SIZE * sizeof(spEntry),
+                           "enlargeStablePtrTable");
+  base = (StgWord)SPT_n_segments << STABLE_PTR_SEGMENT_BITS;
 
-  initFreeList(stable_ptr_table + old_SPT_size, old_SPT_size, NULL);
+  free = stable_ptr_free;
+  for (i = STABLE_PTR_SEGMENT_SIZE - 1; i > 0; i--) {
+    segment[i].addr = SPT_FREE_LINK(free);
+    free = base + i;
+  }
+  if (base == 0) {
+    // index 0 is never used
+    segment[0].addr = SPT_FREE_LINK(0);
+  } else {
+    segment[0].addr = SPT_FREE_LINK(free);
+    free = base;
+  }
+
+  stable_ptr_table[SPT_n_segments] = segment;
+  SPT_n_segments++;
+  stable_ptr_free = free;
+
+  debugTrace(DEBUG_stable, "stable pointer table now has %d segments",
+             SPT_n_segments);
 }
 
 /* -----------------------------------------------------------------------------
@@ -332,37 +575,53 @@ stablePtrPostGC(void)
 /* -----------------------------------------------------------------------------
  * Treat stable pointers as roots for the garbage collector.
  *
- * A stable pointer is any stable name entry with a ref > 0.  We'll
- * take the opportunity to zero the "keep" flags at the same time.
+ * Every live entry in the stable pointer table is a root.  Stable
+ * names are not roots; see gcStablePtrTable().
  * -------------------------------------------------------------------------- */
 
 void
 markStablePtrTable(evac_fn evac, void *user)
 {
-    snEntry *p, *end_stable_ptr_table;
+    spEntry *e, *end_segment;
+    nat s;
+
+    // Free entries in the per-Capability caches are free entries like
+    // any other.
+    for (s = 0; s < SPT_n_segments; s++) {
+	end_segment = stable_ptr_table[s] + STABLE_PTR_SEGMENT_SIZE;
+	for (e = stable_ptr_table[s]; e < end_segment; e++) {
+	    if (!SPT_ENTRY_IS_FREE(e)) {
+		evac(user, (StgClosure **)&e->addr);
+	    }
+	}
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Mark the objects that the stable name table refers to.
+ *
+ * A concurrent mark of the old generation (see sm/ConcMark.c) cannot
+ * tell which stable names are dead, so it keeps everything in the
+ * table alive until the next major GC.
+ * -------------------------------------------------------------------------- */
+
+void
+markStableNameTable(evac_fn evac, void *user)
+{
+    snEntry *p, *end_stable_name_table;
     StgPtr q;
-    
-    end_stable_ptr_table = &stable_ptr_table[SPT_size];
-    
-    // Mark all the stable *pointers* (not stable names).
-    // _starting_ at index 1; index 0 is unused.
-    for (p = stable_ptr_table+1; p < end_stable_ptr_table; p++) {
-	q = p->addr;
 
-	// Internal pointers are free slots.  If q == NULL, it's a
-	// stable name where the object has been GC'd, but the
-	// StableName object (sn_obj) is still alive.
-	if (q && (q < (P_)stable_ptr_table || q >= (P_)end_stable_ptr_table)) {
+    end_stable_name_table = &stable_name_table[SNT_size];
 
-	    // save the current addr away: we need to be able to tell
-	    // whether the objects moved in order to be able to update
-	    // the hash table later.
-	    p->old = p->addr;
+    for (p = stable_name_table+1; p < end_stable_name_table; p++) {
 
-	    // if the ref is non-zero, treat addr as a root
-	    if (p->ref != 0) {
-		evac(user, (StgClosure **)&p->addr);
-	    }
+	if (p->sn_obj != NULL) {
+	    evac(user, (StgClosure **)&p->sn_obj);
+	}
+
+	q = p->addr;
+	if (q && (q < (P_)stable_name_table || q >= (P_)end_stable_name_table)) {
+	    evac(user, (StgClosure **)&p->addr);
 	}
     }
 }
@@ -378,103 +637,131 @@ markStablePtrTable(evac_fn evac, void *user)
 void
 threadStablePtrTable( evac_fn evac, void *user )
 {
-    snEntry *p, *end_stable_ptr_table;
+    snEntry *p, *end_stable_name_table;
+    spEntry *e, *end_segment;
     StgPtr q;
+    nat s;
     
-    end_stable_ptr_table = &stable_ptr_table[SPT_size];
+    end_stable_name_table = &stable_name_table[SNT_size];
     
-    for (p = stable_ptr_table+1; p < end_stable_ptr_table; p++) {
+    for (p = stable_name_table+1; p < end_stable_name_table; p++) {
 	
 	if (p->sn_obj != NULL) {
 	    evac(user, (StgClosure **)&p->sn_obj);
 	}
 
 	q = p->addr;
-	if (q && (q < (P_)stable_ptr_table || q >= (P_)end_stable_ptr_table)) {
+	if (q && (q < (P_)stable_name_table || q >= (P_)end_stable_name_table)) {
 	    evac(user, (StgClosure **)&p->addr);
 	}
     }
+
+    for (s = 0; s < SPT_n_segments; s++) {
+	end_segment = stable_ptr_table[s] + STABLE_PTR_SEGMENT_SIZE;
+	for (e = stable_ptr_table[s]; e < end_segment; e++) {
+	    if (!SPT_ENTRY_IS_FREE(e)) {
+		evac(user, (StgClosure **)&e->addr);
+	    }
+	}
+    }
 }
 
 /* -----------------------------------------------------------------------------
- * Garbage collect any dead entries in the stable pointer table.
- *
- * A dead entry has:
+ * Garbage collect any dead entries in the stable name table.
  *
- *          - a zero reference count
- *          - a dead sn_obj
+ * A dead entry has a dead sn_obj.  We can re-use stable name table
+ * entries for live heap objects, as long as the program has no
+ * StableName objects that refer to the entry.  Stable pointers are
+ * roots, so there is nothing to do for them here.
  *
- * Both of these conditions must be true in order to re-use the stable
- * name table entry.  We can re-use stable name table entries for live
- * heap objects, as long as the program has no StableName objects that
- * refer to the entry.
+ * Only the entries on the lists of the generations being collected
+ * are visited.  The survivors are put on sn_pending, with 'old'
+ * remembering where the object was so that updateStablePtrTable()
+ * can tell whether it moved.
  * -------------------------------------------------------------------------- */
 
 void
 gcStablePtrTable( void )
 {
-    snEntry *p, *end_stable_ptr_table;
-    StgPtr q;
-    
-    end_stable_ptr_table = &stable_ptr_table[SPT_size];
-    
-    // NOTE: _starting_ at index 1; index 0 is unused.
-    for (p = stable_ptr_table + 1; p < end_stable_ptr_table; p++) {
-	
-	// Update the pointer to the StableName object, if there is one
-	if (p->sn_obj != NULL) {
-	    p->sn_obj = isAlive(p->sn_obj);
-	}
-	
-	// Internal pointers are free slots.  If q == NULL, it's a
-	// stable name where the object has been GC'd, but the
-	// StableName object (sn_obj) is still alive.
-	q = p->addr;
-	if (q && (q < (P_)stable_ptr_table || q >= (P_)end_stable_ptr_table)) {
-
-	    // StableNames only:
-	    if (p->ref == 0) {
-		if (p->sn_obj == NULL) {
-		    // StableName object is dead
-		    freeStableName(p);
-		    debugTrace(DEBUG_stable, "GC'd Stable name %ld",
-			       (long)(p - stable_ptr_table));
-		    continue;
-		    
-		} else {
-		  p->addr = (StgPtr)isAlive((StgClosure *)p->addr);
-		  debugTrace(DEBUG_stable, 
-			     "stable name %ld still alive at %p, ref %ld\n",
-			     (long)(p - stable_ptr_table), p->addr, p->ref);
-		}
+    snEntry *p;
+    StgWord sn, next;
+    nat g;
+
+    sn_pending = 0;
+
+    for (g = 0; g <= N; g++) {
+	for (sn = sn_gen_lists[g]; sn != 0; sn = next) {
+	    p = &stable_name_table[sn];
+	    next = p->link;
+
+	    // Update the pointer to the StableName object, if there is one
+	    if (p->sn_obj != NULL) {
+		p->sn_obj = isAlive(p->sn_obj);
+	    }
+
+	    if (p->sn_obj == NULL) {
+		// StableName object is dead
+		freeStableName(p);
+		debugTrace(DEBUG_stable, "GC'd Stable name %ld", (long)sn);
+		continue;
 	    }
+
+	    // If addr == NULL, it's a stable name where the object has
+	    // been GC'd, but the StableName object (sn_obj) is still
+	    // alive.
+	    p->old = p->addr;
+	    if (p->addr != NULL) {
+		p->addr = (StgPtr)isAlive((StgClosure *)p->addr);
+		debugTrace(DEBUG_stable,
+			   "stable name %ld still alive at %p\n",
+			   (long)sn, p->addr);
+	    }
+
+	    p->link = sn_pending;
+	    sn_pending = sn;
 	}
+	sn_gen_lists[g] = 0;
     }
 }
 
 /* -----------------------------------------------------------------------------
- * Update the StablePtr/StableName hash table
+ * Update the StableName hash table
  *
  * The boolean argument 'full' indicates that a major collection is
  * being done, so we might as well throw away the hash table and build
  * a new one.  For a minor collection, we just re-hash the elements
- * that changed.
+ * that moved.  Either way, only the entries that gcStablePtrTable()
+ * visited need looking at; they go back on the list for their new
+ * generation.
  * -------------------------------------------------------------------------- */
 
+STATIC_INLINE nat
+snEntryGen(snEntry *p)
+{
+    nat g;
+
+    g = Bdescr((P_)p->sn_obj)->gen_no;
+    if (p->addr != NULL && HEAP_ALLOCED(p->addr)) {
+	g = stg_min(g, Bdescr(p->addr)->gen_no);
+    }
+    return g;
+}
+
 void
 updateStablePtrTable(rtsBool full)
 {
-    snEntry *p, *end_stable_ptr_table;
+    snEntry *p;
+    StgWord sn, next;
+    nat g;
     
     if (full && addrToStableHash != NULL) {
 	freeHashTable(addrToStableHash,NULL);
 	addrToStableHash = allocHashTable();
     }
     
-    end_stable_ptr_table = &stable_ptr_table[SPT_size];
-    
-    // NOTE: _starting_ at index 1; index 0 is unused.
-    for (p = stable_ptr_table + 1; p < end_stable_ptr_table; p++) {
+    for (sn = sn_pending; sn != 0; sn = next) {
+	p = &stable_name_table[sn];
+	next = p->link;
 	
 	if (p->addr == NULL) {
 	    if (p->old != NULL) {
@@ -483,18 +770,17 @@ updateStablePtrTable(rtsBool full)
 		removeHashTable(addrToStableHash, (W_)p->old, NULL);
 		p->old = NULL;
 	    }
+	} else if (full) {
+	    insertHashTable(addrToStableHash, (W_)p->addr, (void *)sn);
+	} else if (p->addr != p->old) {
+	    // Target moved, re-hash this stable name
+	    removeHashTable(addrToStableHash, (W_)p->old, NULL);
+	    insertHashTable(addrToStableHash, (W_)p->addr, (void *)sn);
 	}
-	else if (p->addr < (P_)stable_ptr_table 
-		 || p->addr >= (P_)end_stable_ptr_table) {
-	    // Target still alive, Re-hash this stable name 
-	    if (full) {
-		insertHashTable(addrToStableHash, (W_)p->addr, 
-				(void *)(p - stable_ptr_table));
-	    } else if (p->addr != p->old) {
-		removeHashTable(addrToStableHash, (W_)p->old, NULL);
-		insertHashTable(addrToStableHash, (W_)p->addr, 
-				(void *)(p - stable_ptr_table));
-	    }
-	}
+
+	g = snEntryGen(p);
+	p->link = sn_gen_lists[g];
+	sn_gen_lists[g] = sn;
     }
+    sn_pending = 0;
 }
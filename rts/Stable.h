@@ -26,6 +26,7 @@ void    exitStablePtrTable    ( void );
 StgWord lookupStableName      ( StgPtr p );
 
 void    markStablePtrTable    ( evac_fn evac, void *user );
+void    markStableNameTable   ( evac_fn evac, void *user );
 void    threadStablePtrTable  ( evac_fn evac, void *user );
 void    gcStablePtrTable      ( void );
 void    updateStablePtrTable  ( rtsBool full );
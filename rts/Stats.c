@@ -18,6 +18,7 @@
 #include "sm/GC.h" // gc_alloc_block_sync, whitehole_spin
 #include "sm/GCThread.h"
 #include "sm/BlockAlloc.h"
+#include "sm/ConcMark.h"
 
 #if USE_PAPI
 #include "Papi.h"
@@ -312,8 +313,11 @@ stat_gcWorkerThreadStart (gc_thread *gct STG_UNUSED)
 }
 
 void
-stat_gcWorkerThreadDone (gc_thread *gct STG_UNUSED)
+stat_gcWorkerThreadDone (gc_thread *gct)
 {
+    gct->tot_idle_spin_time  += gct->idle_spin_time;
+    gct->tot_idle_sleep_time += gct->idle_sleep_time;
+
 #if 0
     /*
      * We dont' collect per-thread GC stats any more, but this code
@@ -343,6 +347,9 @@ stat_endGC (Capability *cap, gc_thread *gct,
             lnat alloc, lnat live, lnat copied, lnat slop, nat gen,
             nat par_n_threads, lnat par_max_copied, lnat par_tot_copied)
 {
+    // the GC leader is a GC thread too
+    stat_gcWorkerThreadDone(gct);
+
     if (RtsFlags.GcFlags.giveStats != NO_GC_STATS ||
         RtsFlags.ProfFlags.doHeapProfile)
         // heap profiling needs GC_tot_time
@@ -673,6 +680,12 @@ stat_exit(int alloc)
 	    showStgWord64(max_slop*sizeof(W_), temp, rtsTrue/*commas*/);
 	    statsPrintf("%16s bytes maximum slop\n", temp);
 
+            if (total_decommitted_mblocks > 0) {
+                showStgWord64(total_decommitted_mblocks * MBLOCK_SIZE,
+                              temp, rtsTrue/*commas*/);
+                statsPrintf("%16s bytes of free heap returned to the OS\n", temp);
+            }
+
 	    statsPrintf("%16" FMT_SizeT " MB total memory in use (%" FMT_SizeT " MB lost due to fragmentation)\n\n", 
                         peak_mblocks_allocated * MBLOCK_SIZE_W / (1024 * 1024 / sizeof(W_)),
                         (lnat)(peak_mblocks_allocated * BLOCKS_PER_MBLOCK * BLOCK_SIZE_W - hw_alloc_blocks * BLOCK_SIZE_W) / (1024 * 1024 / sizeof(W_)));
@@ -697,6 +710,22 @@ stat_exit(int alloc)
                             100 * (((double)GC_par_tot_copied / (double)GC_par_max_copied) - 1)
                                 / (n_capabilities - 1)
                     );
+
+                {
+                    Time idle_spin = 0, idle_sleep = 0;
+                    for (i = 0; i < n_capabilities; i++) {
+                        idle_spin  += gc_threads[i]->tot_idle_spin_time;
+                        idle_sleep += gc_threads[i]->tot_idle_sleep_time;
+                    }
+                    statsPrintf("  Parallel GC idle time: %.2fs spinning, %.2fs asleep (all GC threads)\n",
+                                TimeToSecondsDbl(idle_spin),
+                                TimeToSecondsDbl(idle_sleep));
+                }
+            }
+            if (RtsFlags.GcFlags.concurrentMark) {
+                statsPrintf("  Concurrent marks of gen %d: %d completed, %d abandoned\n",
+                            RtsFlags.GcFlags.generations - 1,
+                            conc_mark_cycles, conc_mark_abandoned);
             }
 #endif
             statsPrintf("\n");
@@ -726,8 +755,44 @@ stat_exit(int alloc)
                             sparks.converted, sparks.overflowed, sparks.dud,
                             sparks.gcd, sparks.fizzled);
             }
+
+            {
+                nat i;
+                lnat mut_hits = 0, mut_refills = 0;
+                lnat gc_hits = 0, gc_refills = 0;
+                for (i = 0; i < n_capabilities; i++) {
+                    mut_hits    += capabilities[i].block_cache.hits;
+                    mut_refills += capabilities[i].block_cache.refills;
+                    gc_hits     += gc_threads[i]->block_cache.hits;
+                    gc_refills  += gc_threads[i]->block_cache.refills;
+                }
+
+                statsPrintf("  BLOCK CACHE: %" FMT_SizeT " hits, %" FMT_SizeT " refills (mutator); %" FMT_SizeT " hits, %" FMT_SizeT " refills (GC)\n\n",
+                            mut_hits, mut_refills, gc_hits, gc_refills);
+            }
 #endif
 
+            {
+                nat i;
+                lnat hits = 0, misses = 0;
+                for (i = 0; i < n_capabilities; i++) {
+                    hits   += capabilities[i].large_cache.hits;
+                    misses += capabilities[i].large_cache.misses;
+                }
+                statsPrintf("  LARGE OBJECT CACHE: %" FMT_SizeT " hits, %" FMT_SizeT " misses\n\n",
+                            hits, misses);
+            }
+
+            {
+                StmStats stm;
+                getStmStats(&stm);
+                if (stm.commits + stm.aborts + stm.retries > 0) {
+                    statsPrintf("  STM: %" FMT_Word64 " committed, %" FMT_Word64 " re-run, %" FMT_Word64 " retried, %" FMT_Word64 " serialized (at most %" FMT_Word64 " re-runs of one transaction)\n\n",
+                                stm.commits, stm.aborts, stm.retries,
+                                stm.serialized, stm.max_aborts);
+                }
+            }
+
 	    statsPrintf("  INIT    time  %6.2fs  (%6.2fs elapsed)\n",
                         TimeToSecondsDbl(init_cpu), TimeToSecondsDbl(init_elapsed));
 
@@ -857,19 +922,20 @@ statDescribeGens(void)
 {
   nat g, mut, lge, i;
   lnat gen_slop;
-  lnat tot_live, tot_slop;
+  lnat tot_live, tot_slop, tot_pinned_waste;
   lnat gen_live, gen_blocks;
   bdescr *bd;
   generation *gen;
   
   debugBelch(
-"----------------------------------------------------------\n"
-"  Gen     Max  Mut-list  Blocks    Large     Live     Slop\n"
-"       Blocks     Bytes          Objects                  \n"
-"----------------------------------------------------------\n");
+"-------------------------------------------------------------------\n"
+"  Gen     Max  Mut-list  Blocks    Large     Live     Slop   Pinned\n"
+"       Blocks     Bytes          Objects                      Waste\n"
+"-------------------------------------------------------------------\n");
 
   tot_live = 0;
   tot_slop = 0;
+  tot_pinned_waste = 0;
 
   for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
       gen = &generations[g];
@@ -885,9 +951,10 @@ statDescribeGens(void)
       for (i = 0; i < n_capabilities; i++) {
           mut += countOccupied(capabilities[i].mut_lists[g]);
 
-          // Add the pinned object block.
+          // Add the pinned object block, unless it is an old one
+          // that we are reusing (see Pinned.c)
           bd = capabilities[i].pinned_object_block;
-          if (bd != NULL) {
+          if (bd != NULL && !(bd->flags & BF_PINNED_REUSED)) {
               gen_live   += bd->free - bd->start;
               gen_blocks += bd->blocks;
           }
@@ -900,15 +967,18 @@ statDescribeGens(void)
 
       gen_slop = gen_blocks * BLOCK_SIZE_W - gen_live;
 
-      debugBelch("%8" FMT_SizeT " %8d %8" FMT_SizeT " %8" FMT_SizeT "\n", gen_blocks, lge,
-                 gen_live*sizeof(W_), gen_slop*sizeof(W_));
+      debugBelch("%8" FMT_SizeT " %8d %8" FMT_SizeT " %8" FMT_SizeT " %8" FMT_SizeT "\n",
+                 gen_blocks, lge, gen_live*sizeof(W_), gen_slop*sizeof(W_),
+                 (lnat)gen->n_pinned_waste_words*sizeof(W_));
       tot_live += gen_live;
       tot_slop += gen_slop;
+      tot_pinned_waste += gen->n_pinned_waste_words;
   }
-  debugBelch("----------------------------------------------------------\n");
-  debugBelch("%41s%8" FMT_SizeT " %8" FMT_SizeT "\n",
-             "",tot_live*sizeof(W_),tot_slop*sizeof(W_));
-  debugBelch("----------------------------------------------------------\n");
+  debugBelch("-------------------------------------------------------------------\n");
+  debugBelch("%41s%8" FMT_SizeT " %8" FMT_SizeT " %8" FMT_SizeT "\n",
+             "",tot_live*sizeof(W_),tot_slop*sizeof(W_),
+             tot_pinned_waste*sizeof(W_));
+  debugBelch("-------------------------------------------------------------------\n");
   debugBelch("\n");
 }
 
@@ -965,7 +1035,36 @@ extern void getGCStats( GCStats *s )
     s->wall_seconds = TimeToSecondsDbl(current_elapsed - end_init_elapsed);
     s->par_tot_bytes_copied = GC_par_tot_copied*(StgWord64)sizeof(W_);
     s->par_max_bytes_copied = GC_par_max_copied*(StgWord64)sizeof(W_);
+    s->current_bytes_decommitted = (StgWord64)decommitted_mblocks * MBLOCK_SIZE;
+    s->cumulative_bytes_decommitted = total_decommitted_mblocks * MBLOCK_SIZE;
+    s->current_bytes_pinned = 0;
+    s->current_bytes_pinned_wasted = 0;
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        s->current_bytes_pinned +=
+            (StgWord64)generations[g].n_pinned_blocks * BLOCK_SIZE;
+        s->current_bytes_pinned_wasted +=
+            (StgWord64)generations[g].n_pinned_waste_words * sizeof(W_);
+    }
+}
+void getStmStats (StmStats *s)
+{
+    nat i;
+    s->commits = 0;
+    s->aborts = 0;
+    s->retries = 0;
+    s->serialized = 0;
+    s->max_aborts = 0;
+    for (i = 0; i < n_capabilities; i++) {
+        s->commits    += capabilities[i].stm_stats.commits;
+        s->aborts     += capabilities[i].stm_stats.aborts;
+        s->retries    += capabilities[i].stm_stats.retries;
+        s->serialized += capabilities[i].stm_stats.serialized;
+        if (capabilities[i].stm_stats.max_aborts > s->max_aborts) {
+            s->max_aborts = capabilities[i].stm_stats.max_aborts;
+        }
+    }
 }
+
 // extern void getTaskStats( TaskStats **s ) {}
 #if 0
 extern void getSparkStats( SparkCounters *s ) {
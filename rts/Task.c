@@ -417,6 +417,15 @@ workerStart(Task *task)
         setThreadAffinity(cap->no, n_capabilities);
     }
 
+    // keep the worker on the NUMA node its Capability's memory is on
+    if (RtsFlags.GcFlags.numa
+#ifdef DEBUG
+        && !RtsFlags.DebugFlags.numa
+#endif
+        ) {
+        setThreadNode(numa_map[cap->node]);
+    }
+
     // set the thread-local pointer to the Task:
     setMyTask(task);
 
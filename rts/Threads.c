@@ -106,6 +106,17 @@ createThread(Capability *cap, nat size)
     tso->saved_errno = 0;
     tso->bound = NULL;
     tso->cap = cap;
+    tso->slices = 0;
+    tso->overtaken = 0;
+    tso->stm_stamp = 0;
+    tso->stm_aborts = 0;
+
+    // a thread forked by a Haskell thread inherits its priority
+    if (cap->in_haskell) {
+        tso->priority = cap->r.rCurrentTSO->priority;
+    } else {
+        tso->priority = THREAD_PRIORITY_DEFAULT;
+    }
     
     tso->stackobj       = stack;
     tso->tot_stack_size = stack->stack_size;
@@ -164,6 +175,42 @@ rts_getThreadId(StgPtr tso)
   return ((StgTSO *)tso)->id;
 }
 
+/* ---------------------------------------------------------------------------
+ * Getting and setting the scheduling priority of a thread.
+ *
+ * A thread waiting on our run queue moves to its new place straight
+ * away; a thread on another Capability moves the next time it is put
+ * on a run queue.
+ * ------------------------------------------------------------------------ */
+
+void
+rts_setThreadPriority (StgPtr tso_, HsInt priority)
+{
+    StgTSO *tso = (StgTSO *)tso_;
+    Capability *cap = rts_unsafeGetMyCapability();
+
+    if (priority < THREAD_PRIORITY_MIN) priority = THREAD_PRIORITY_MIN;
+    if (priority > THREAD_PRIORITY_MAX) priority = THREAD_PRIORITY_MAX;
+
+    if (tso->priority == (StgWord32)priority) return;
+    tso->priority = (StgWord32)priority;
+
+    if (tso != cap->r.rCurrentTSO
+        && tso->why_blocked == NotBlocked
+        && tso->what_next != ThreadComplete
+        && tso->what_next != ThreadKilled
+        && reclaimThread(cap, tso)) {
+        removeFromRunQueue(cap, tso);
+        appendToRunQueue(cap, tso);
+    }
+}
+
+HsInt
+rts_getThreadPriority (StgPtr tso)
+{
+    return ((StgTSO *)tso)->priority;
+}
+
 /* -----------------------------------------------------------------------------
    Remove a thread from a queue.
    Fails fatally if the TSO is not on the queue.
@@ -324,6 +371,7 @@ migrateThread (Capability *from, StgTSO *tso, Capability *to)
     // the run queue when it receives the MSG_TRY_WAKEUP.
     tso->why_blocked = ThreadMigrating;
     tso->cap = to;
+    tso->slices = 0;
     tryWakeupThread(from, tso);
 }
 
@@ -218,6 +218,10 @@ static void traceSchedEvent_stderr (Capability *cap, EventTypeNum tag,
         debugBelch("cap %d: thread %" FMT_SizeT " migrating to cap %d\n", 
                    cap->no, (lnat)tso->id, (int)info1);
         break;
+    case EVENT_STEAL_THREAD:    // (cap, thread, victim_cap)
+        debugBelch("cap %d: stole thread %" FMT_SizeT " from cap %d\n", 
+                   cap->no, (lnat)tso->id, (int)info1);
+        break;
     case EVENT_THREAD_WAKEUP:   // (cap, thread, info1_cap)
         debugBelch("cap %d: waking up thread %" FMT_SizeT " on cap %d\n", 
                    cap->no, (lnat)tso->id, (int)info1);
@@ -574,6 +578,18 @@ void traceSparkCounters_ (Capability *cap,
     }
 }
 
+void traceStmCounters_ (Capability *cap, StmCounters counters)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        /* as for the spark counters, these only go to the eventlog */
+    } else
+#endif
+    {
+        postStmCountersEvent(cap, counters);
+    }
+}
+
 #ifdef DEBUG
 static void traceCap_stderr(Capability *cap, char *msg, va_list ap)
 {
@@ -262,6 +262,8 @@ void traceSparkCounters_ (Capability *cap,
                           SparkCounters counters,
                           StgWord remaining);
 
+void traceStmCounters_ (Capability *cap, StmCounters counters);
+
 #else /* !TRACING */
 
 #define traceSchedEvent(cap, tag, tso, other) /* nothing */
@@ -289,6 +291,7 @@ INLINE_HEADER void traceEventStartup_ (int n_caps STG_UNUSED) {};
 #define traceWallClockTime_() /* nothing */
 #define traceOSProcessInfo_() /* nothing */
 #define traceSparkCounters_(cap, counters, remaining) /* nothing */
+#define traceStmCounters_(cap, counters) /* nothing */
 
 #endif /* TRACING */
 
@@ -317,6 +320,8 @@ void dtraceUserMsgWrapper(Capability *cap, char *msg);
     HASKELLEVENT_THREAD_RUNNABLE(cap, tid)
 #define dtraceMigrateThread(cap, tid, new_cap)          \
     HASKELLEVENT_MIGRATE_THREAD(cap, tid, new_cap)
+#define dtraceStealThread(cap, tid, victim_cap)         \
+    HASKELLEVENT_STEAL_THREAD(cap, tid, victim_cap)
 #define dtraceThreadWakeup(cap, tid, other_cap)         \
     HASKELLEVENT_THREAD_WAKEUP(cap, tid, other_cap)
 #define dtraceGcStart(cap)                              \
@@ -377,6 +382,10 @@ INLINE_HEADER void dtraceStartup (int num_caps) {
     HASKELLEVENT_HEAP_SIZE(heap_capset, size)
 #define dtraceEventHeapLive(heap_capset, live)          \
     HASKELLEVENT_HEAP_LIVE(heap_capset, live)
+#define dtraceEventNurserySize(heap_capset, size)       \
+    HASKELLEVENT_NURSERY_SIZE(heap_capset, size)
+#define dtraceEventMutListSize(heap_capset, size)       \
+    HASKELLEVENT_MUT_LIST_SIZE(heap_capset, size)
  */
 #define dtraceEventGcStats(heap_capset, gens,           \
                            copies, slop, fragmentation, \
@@ -390,6 +399,8 @@ INLINE_HEADER void dtraceStartup (int num_caps) {
                                  allocated)             
 #define dtraceEventHeapSize(heap_capset, size)          
 #define dtraceEventHeapLive(heap_capset, live)          
+#define dtraceEventNurserySize(heap_capset, size)       
+#define dtraceEventMutListSize(heap_capset, size)       
  
 #define dtraceCapsetCreate(capset, capset_type)         \
     HASKELLEVENT_CAPSET_CREATE(capset, capset_type)
@@ -401,6 +412,8 @@ INLINE_HEADER void dtraceStartup (int num_caps) {
     HASKELLEVENT_CAPSET_REMOVE_CAP(capset, capno)
 #define dtraceSparkCounters(cap, a, b, c, d, e, f, g) \
     HASKELLEVENT_SPARK_COUNTERS(cap, a, b, c, d, e, f, g)
+#define dtraceStmCounters(cap, a, b, c)                 \
+    HASKELLEVENT_STM_COUNTERS(cap, a, b, c)
 #define dtraceSparkCreate(cap)                         \
     HASKELLEVENT_SPARK_CREATE(cap)
 #define dtraceSparkDud(cap)                             \
@@ -423,6 +436,7 @@ INLINE_HEADER void dtraceStartup (int num_caps) {
 #define dtraceStopThread(cap, tid, status, info)        /* nothing */
 #define dtraceThreadRunnable(cap, tid)                  /* nothing */
 #define dtraceMigrateThread(cap, tid, new_cap)          /* nothing */
+#define dtraceStealThread(cap, tid, victim_cap)         /* nothing */
 #define dtraceThreadWakeup(cap, tid, other_cap)         /* nothing */
 #define dtraceGcStart(cap)                              /* nothing */
 #define dtraceGcEnd(cap)                                /* nothing */
@@ -448,6 +462,8 @@ INLINE_HEADER void dtraceStartup (int num_caps STG_UNUSED) {};
                                  allocated)             /* nothing */
 #define dtraceEventHeapSize(heap_capset, size)          /* nothing */
 #define dtraceEventHeapLive(heap_capset, live)          /* nothing */
+#define dtraceEventNurserySize(heap_capset, size)       /* nothing */
+#define dtraceEventMutListSize(heap_capset, size)       /* nothing */
 #define dtraceCapCreate(cap)                            /* nothing */
 #define dtraceCapDelete(cap)                            /* nothing */
 #define dtraceCapEnable(cap)                            /* nothing */
@@ -457,6 +473,7 @@ INLINE_HEADER void dtraceStartup (int num_caps STG_UNUSED) {};
 #define dtraceCapsetAssignCap(capset, capno)            /* nothing */
 #define dtraceCapsetRemoveCap(capset, capno)            /* nothing */
 #define dtraceSparkCounters(cap, a, b, c, d, e, f, g)   /* nothing */
+#define dtraceStmCounters(cap, a, b, c)                 /* nothing */
 #define dtraceSparkCreate(cap)                          /* nothing */
 #define dtraceSparkDud(cap)                             /* nothing */
 #define dtraceSparkOverflow(cap)                        /* nothing */
@@ -528,6 +545,15 @@ INLINE_HEADER void traceEventMigrateThread(Capability *cap     STG_UNUSED,
                         (EventCapNo)new_cap);
 }
 
+INLINE_HEADER void traceEventStealThread(Capability *cap        STG_UNUSED, 
+                                         StgTSO     *tso        STG_UNUSED,
+                                         nat         victim_cap STG_UNUSED)
+{
+    traceSchedEvent(cap, EVENT_STEAL_THREAD, tso, victim_cap);
+    dtraceStealThread((EventCapNo)cap->no, (EventThreadID)tso->id,
+                      (EventCapNo)victim_cap);
+}
+
 INLINE_HEADER void traceCapCreate(Capability *cap STG_UNUSED)
 {
     traceCapEvent(cap, EVENT_CAP_CREATE);
@@ -698,6 +724,22 @@ INLINE_HEADER void traceEventHeapLive(Capability *cap         STG_UNUSED,
     dtraceEventHeapLive(heap_capset, heap_live);
 }
 
+INLINE_HEADER void traceEventNurserySize(Capability *cap         STG_UNUSED,
+                                         CapsetID    heap_capset STG_UNUSED,
+                                         lnat        size        STG_UNUSED)
+{
+    traceHeapEvent(cap, EVENT_NURSERY_SIZE, heap_capset, size);
+    dtraceEventNurserySize(heap_capset, size);
+}
+
+INLINE_HEADER void traceEventMutListSize(Capability *cap         STG_UNUSED,
+                                         CapsetID    heap_capset STG_UNUSED,
+                                         lnat        size        STG_UNUSED)
+{
+    traceHeapEvent(cap, EVENT_MUT_LIST_SIZE, heap_capset, size);
+    dtraceEventMutListSize(heap_capset, size);
+}
+
 /* TODO: at some point we should remove this event, it's covered by
  * the cap create/delete events.
  */
@@ -779,6 +821,17 @@ INLINE_HEADER void traceSparkCounters(Capability *cap STG_UNUSED)
 #endif
 }
 
+INLINE_HEADER void traceStmCounters(Capability *cap STG_UNUSED)
+{
+    if (RTS_UNLIKELY(TRACE_sched)) {
+        traceStmCounters_(cap, cap->stm_stats);
+    }
+    dtraceStmCounters((EventCapNo)cap->no,
+                      cap->stm_stats.commits,
+                      cap->stm_stats.aborts,
+                      cap->stm_stats.retries);
+}
+
 INLINE_HEADER void traceEventSparkCreate(Capability *cap STG_UNUSED)
 {
     traceSparkEvent(cap, EVENT_SPARK_CREATE);
@@ -68,8 +68,31 @@ roundUp2(StgWord val)
     return rounded;
 }
 
+/* The elements array is preceded by two words: elements[-1] is the
+   moduloSize of the array, elements[-2] links it into the list of
+   retired arrays once it has been replaced by a bigger one. */
+#define ELEMENTS_HDR 2
+
+static void **
+allocElements (StgWord realsize)
+{
+    void **space;
+
+    space = stgMallocBytes((realsize + ELEMENTS_HDR) * sizeof(StgClosurePtr),
+                           "newWSDeque:data space");
+    space[0] = NULL;
+    space[1] = (void *)(realsize - 1);
+    return space + ELEMENTS_HDR;
+}
+
+static void
+freeElements (void **elements)
+{
+    stgFree(elements - ELEMENTS_HDR);
+}
+
 WSDeque *
-newWSDeque (nat size)
+newGrowableWSDeque (nat size, nat max_size)
 {
     StgWord realsize; 
     WSDeque *q;
@@ -78,27 +101,48 @@ newWSDeque (nat size)
     
     q = (WSDeque*) stgMallocBytes(sizeof(WSDeque),   /* admin fields */
                                   "newWSDeque");
-    q->elements = stgMallocBytes(realsize * sizeof(StgClosurePtr), /* dataspace */
-                                 "newWSDeque:data space");
+    q->elements = allocElements(realsize);              /* dataspace */
     q->top=0;
     q->bottom=0;
     q->topBound=0; /* read by writer, updated each time top is read */
     
     q->size = realsize;  /* power of 2 */
     q->moduloSize = realsize - 1; /* n % size == n & moduloSize  */
+
+    q->maxSize = max_size > size ? roundUp2(max_size) : realsize;
+    q->retired = NULL;
     
     ASSERT_WSDEQUE_INVARIANTS(q); 
     return q;
 }
 
+WSDeque *
+newWSDeque (nat size)
+{
+    return newGrowableWSDeque(size, size);
+}
+
 /* -----------------------------------------------------------------------------
  * freeWSDeque
  * -------------------------------------------------------------------------- */
 
+void
+freeRetiredWSDeque (WSDeque *q)
+{
+    void **elems, **next;
+
+    for (elems = q->retired; elems != NULL; elems = next) {
+        next = (void **)elems[-2];
+        freeElements(elems);
+    }
+    q->retired = NULL;
+}
+
 void
 freeWSDeque (WSDeque *q)
 {
-    stgFree(q->elements);
+    freeRetiredWSDeque(q);
+    freeElements(q->elements);
     stgFree(q);
 }
 
@@ -178,6 +222,7 @@ void *
 stealWSDeque_ (WSDeque *q)
 {
     void * stolen;
+    void ** elems;
     StgWord b,t; 
     
 // Can't do this on someone else's spark pool:
@@ -195,9 +240,17 @@ stealWSDeque_ (WSDeque *q)
     if ((long)b - (long)t <= 0 ) { 
         return NULL; /* already looks empty, abort */
   }
+
+    // The array may have been replaced by a bigger one since we read
+    // top.  Read the array after bottom: the owner publishes a new
+    // array before it pushes anything into it, so this array holds
+    // every element up to b.  The mask has to come from the array
+    // itself, since q->moduloSize may already belong to another one.
+    load_load_barrier();
+    elems = q->elements;
     
     /* now access array, see pushBottom() */
-    stolen = q->elements[t & q->moduloSize];
+    stolen = elems[t & (StgWord)elems[-1]];
     
     /* now decide whether we have won */
     if ( !(CASTOP(&(q->top),t,t+1)) ) {
@@ -229,10 +282,37 @@ stealWSDeque (WSDeque *q)
  * pushWSQueue
  * -------------------------------------------------------------------------- */
 
-#define DISCARD_NEW
+/* Double the size of the elements array.  The elements between top
+   and bottom are copied to their places in the new array; concurrent
+   steal()s may go on using the old array in the meantime, and only
+   modify top, so the old array cannot be freed until nobody is
+   stealing (see freeRetiredWSDeque()). */
+static void
+growWSDeque (WSDeque *q, StgWord t, StgWord b)
+{
+    void **old, **new;
+    StgWord newsize, i;
+
+    old = q->elements;
+    newsize = q->size * 2;
+    new = allocElements(newsize);
+
+    for (i = t; i != b; i++) {
+        new[i & (newsize - 1)] = old[i & q->moduloSize];
+    }
+
+    // the new array has to be filled in before thieves can see it
+    write_barrier();
+    q->elements = new;
+    q->size = newsize;
+    q->moduloSize = newsize - 1;
+
+    old[-2] = (void *)q->retired;
+    q->retired = old;
+}
 
-/* enqueue an element. Should always succeed by resizing the array
-   (not implemented yet, silently fails in that case). */
+/* enqueue an element.  The array is enlarged if it is full, unless
+   it has reached maxSize; the push fails in that case. */
 rtsBool
 pushWSDeque (WSDeque* q, void * elem)
 {
@@ -256,25 +336,12 @@ pushWSDeque (WSDeque* q, void * elem)
         t = q->top;
         q->topBound = t;
         if (b - t >= sz) { /* really no space left :-( */
-            /* reallocate the array, copying the values. Concurrent steal()s
-               will in the meantime use the old one and modify only top.
-               This means: we cannot safely free the old space! Can keep it
-               on a free list internally here...
-               
-               Potential bug in combination with steal(): if array is
-               replaced, it is unclear which one concurrent steal operations
-               use. Must read the array base address in advance in steal().
-            */
-#if defined(DISCARD_NEW)
-            ASSERT_WSDEQUE_INVARIANTS(q); 
-            return rtsFalse; // we didn't push anything
-#else
-            /* could make room by incrementing the top position here.  In
-             * this case, should use CASTOP. If this fails, someone else has
-             * removed something, and new room will be available.
-             */
-            ASSERT_WSDEQUE_INVARIANTS(q); 
-#endif
+            if (q->size >= q->maxSize) {
+                ASSERT_WSDEQUE_INVARIANTS(q); 
+                return rtsFalse; // we didn't push anything
+            }
+            growWSDeque(q, t, b);
+            sz = q->moduloSize;
         }
     }
 
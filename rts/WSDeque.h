@@ -30,13 +30,24 @@ typedef struct WSDeque_ {
     // inside pushBottom
     volatile StgWord topBound;
 
-    // The elements array
+    // The elements array.  Two words in front of it hold the
+    // moduloSize of this particular array (elements[-1]), which is
+    // what a thief uses, and a link to the next retired array
+    // (elements[-2]).
     void ** elements;
 
     //  Please note: the dataspace cannot follow the admin fields
     //  immediately, as it should be possible to enlarge it without
     //  disposing the old one automatically (as realloc would)!
 
+    // The owner doubles the elements array when it is full, up to
+    // maxSize elements.  A thief may still be reading an array that
+    // has been replaced, so the old ones are kept on the retired list
+    // until freeRetiredWSDeque() is called at a point when nobody can
+    // be stealing.
+    StgWord maxSize;
+    void ** retired;
+
 } WSDeque;
 
 /* INVARIANTS, in this order: reasonable size,
@@ -66,16 +77,23 @@ typedef struct WSDeque_ {
  *
  * -------------------------------------------------------------------------- */
 
-// Allocation, deallocation
-WSDeque * newWSDeque  (nat size);
-void      freeWSDeque (WSDeque *q);
+// Allocation, deallocation.  A deque from newWSDeque() has a fixed
+// size; one from newGrowableWSDeque() starts at size elements and is
+// enlarged on demand up to max_size.
+WSDeque * newWSDeque         (nat size);
+WSDeque * newGrowableWSDeque (nat size, nat max_size);
+void      freeWSDeque        (WSDeque *q);
+
+// Free the arrays left behind by enlarging the deque.  Owner only,
+// and only when no other thread can be stealing (e.g. during GC).
+void      freeRetiredWSDeque (WSDeque *q);
 
 // Take an element from the "write" end of the pool.  Can be called
 // by the pool owner only.
 void* popWSDeque (WSDeque *q);
 
 // Push onto the "write" end of the pool.  Return true if the push
-// succeeded, or false if the deque is full.
+// succeeded, or false if the deque is full and cannot grow any more.
 rtsBool pushWSDeque (WSDeque *q, void *elem);
 
 // Removes all elements from the deque
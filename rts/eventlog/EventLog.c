@@ -60,6 +60,7 @@ char *EventDesc[] = {
   [EVENT_STOP_THREAD]         = "Stop thread",
   [EVENT_THREAD_RUNNABLE]     = "Thread runnable",
   [EVENT_MIGRATE_THREAD]      = "Migrate thread",
+  [EVENT_STEAL_THREAD]        = "Steal thread",
   [EVENT_THREAD_WAKEUP]       = "Wakeup thread",
   [EVENT_THREAD_LABEL]        = "Thread label",
   [EVENT_STARTUP]             = "Create capabilities",
@@ -77,6 +78,8 @@ char *EventDesc[] = {
   [EVENT_HEAP_ALLOCATED]      = "Total heap mem ever allocated",
   [EVENT_HEAP_SIZE]           = "Current heap size",
   [EVENT_HEAP_LIVE]           = "Current heap live data",
+  [EVENT_NURSERY_SIZE]        = "Allocation area size per capability",
+  [EVENT_MUT_LIST_SIZE]       = "Remembered set size after GC",
   [EVENT_CREATE_SPARK_THREAD] = "Create spark thread",
   [EVENT_LOG_MSG]             = "Log message",
   [EVENT_USER_MSG]            = "User message",
@@ -102,6 +105,7 @@ char *EventDesc[] = {
   [EVENT_SPARK_STEAL]         = "Spark steal",
   [EVENT_SPARK_FIZZLE]        = "Spark fizzle",
   [EVENT_SPARK_GC]            = "Spark GC",
+  [EVENT_STM_COUNTERS]        = "STM counters",
 };
 
 // Event type. 
@@ -289,6 +293,7 @@ initEventLogging(void)
             break;
 
         case EVENT_MIGRATE_THREAD:  // (cap, thread, new_cap)
+        case EVENT_STEAL_THREAD:    // (cap, thread, victim_cap)
         case EVENT_THREAD_WAKEUP:   // (cap, thread, other_cap)
             eventTypes[t].size =
                 sizeof(EventThreadID) + sizeof(EventCapNo);
@@ -368,9 +373,15 @@ initEventLogging(void)
             eventTypes[t].size = 7 * sizeof(StgWord64);
             break;
 
+        case EVENT_STM_COUNTERS:     // (cap, 3*counter)
+            eventTypes[t].size = 3 * sizeof(StgWord64);
+            break;
+
         case EVENT_HEAP_ALLOCATED:    // (heap_capset, alloc_bytes)
         case EVENT_HEAP_SIZE:         // (heap_capset, size_bytes)
         case EVENT_HEAP_LIVE:         // (heap_capset, live_bytes)
+        case EVENT_NURSERY_SIZE:      // (heap_capset, size_bytes)
+        case EVENT_MUT_LIST_SIZE:     // (heap_capset, size_bytes)
             eventTypes[t].size = sizeof(EventCapsetID) + sizeof(StgWord64);
             break;
 
@@ -545,6 +556,7 @@ postSchedEvent (Capability *cap,
     }
 
     case EVENT_MIGRATE_THREAD:  // (cap, thread, new_cap)
+    case EVENT_STEAL_THREAD:    // (cap, thread, victim_cap)
     case EVENT_THREAD_WAKEUP:   // (cap, thread, other_cap)
     {
         postThreadID(eb,thread);
@@ -634,6 +646,25 @@ postSparkCountersEvent (Capability *cap,
     postWord64(eb,remaining);
 }
 
+void
+postStmCountersEvent (Capability *cap, StmCounters counters)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!hasRoomForEvent(eb, EVENT_STM_COUNTERS)) {
+        // Flush event buffer to make room for new event.
+        printAndClearEventBuf(eb);
+    }
+
+    postEventHeader(eb, EVENT_STM_COUNTERS);
+    /* EVENT_STM_COUNTERS (commits,aborts,retries) */
+    postWord64(eb,counters.commits);
+    postWord64(eb,counters.aborts);
+    postWord64(eb,counters.retries);
+}
+
 void
 postCapEvent (EventTypeNum  tag,
               EventCapNo    capno)
@@ -842,6 +873,8 @@ void postHeapEvent (Capability    *cap,
     case EVENT_HEAP_ALLOCATED:     // (heap_capset, alloc_bytes)
     case EVENT_HEAP_SIZE:          // (heap_capset, size_bytes)
     case EVENT_HEAP_LIVE:          // (heap_capset, live_bytes)
+    case EVENT_NURSERY_SIZE:       // (heap_capset, size_bytes)
+    case EVENT_MUT_LIST_SIZE:      // (heap_capset, size_bytes)
     {
         postCapsetID(eb, heap_capset);
         postWord64(eb, info1 /* alloc/size/live_bytes */);
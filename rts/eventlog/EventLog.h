@@ -93,6 +93,11 @@ void postSparkCountersEvent (Capability *cap,
                              SparkCounters counters,
                              StgWord remaining);
 
+/*
+ * Post an event with the STM commit/abort/retry counters of a capability.
+ */
+void postStmCountersEvent (Capability *cap, StmCounters counters);
+
 /*
  * Post an event to annotate a thread with a label
  */
@@ -32,6 +32,16 @@
 
 #include <errno.h>
 
+#if defined(linux_HOST_OS)
+#include <stdio.h>
+#endif
+
+#if defined(HAVE_LIBNUMA) && defined(HAVE_NUMA_H) && defined(HAVE_NUMAIF_H)
+#define USE_LIBNUMA 1
+#include <numa.h>
+#include <numaif.h>
+#endif
+
 #if darwin_HOST_OS
 #include <mach/mach.h>
 #include <mach/vm_map.h>
@@ -211,6 +221,40 @@ void osFreeMBlocks(char *addr, nat n)
     munmap(addr, n * MBLOCK_SIZE);
 }
 
+/* -----------------------------------------------------------------------------
+   Giving free memory back to the OS
+
+   The memory stays mapped (and in the block allocator's free lists),
+   but the OS may reclaim the pages.  With MADV_DONTNEED it does so at
+   once and the pages read as zero next time; with MADV_FREE (lazy) it
+   only reclaims them under memory pressure, which is cheaper if we
+   reuse the memory soon.  Either way we don't have to do anything
+   before touching the memory again.
+   -------------------------------------------------------------------------- */
+
+void osDecommitMemory(void *at, lnat size, rtsBool lazy)
+{
+#if defined(HAVE_MADVISE)
+    int r;
+
+#if defined(MADV_FREE)
+    if (lazy) {
+        r = madvise(at, size, MADV_FREE);
+        if (r == 0) return;
+        // older kernels don't know MADV_FREE: fall through
+        if (errno != EINVAL) {
+            sysErrorBelch("osDecommitMemory: madvise(MADV_FREE)");
+            return;
+        }
+    }
+#endif
+    r = madvise(at, size, MADV_DONTNEED);
+    if (r != 0) {
+        sysErrorBelch("osDecommitMemory: madvise(MADV_DONTNEED)");
+    }
+#endif
+}
+
 void osReleaseFreeMemory(void) {
     /* Nothing to do on POSIX */
 }
@@ -255,3 +299,125 @@ void setExecutable (void *p, lnat len, rtsBool exec)
 	barf("setExecutable: failed to protect 0x%p\n", p);
     }
 }
+
+/* -----------------------------------------------------------------------------
+   osCacheSize(level)
+
+   The size in bytes of the level 1, 2 or 3 data (or unified) cache of
+   the first CPU, or 0 if we can't tell.  On Linux we read it from
+   /sys/devices/system/cpu/cpu0/cache/index<n>/{level,type,size}.
+   -------------------------------------------------------------------------- */
+
+#if defined(linux_HOST_OS)
+static rtsBool
+readSysFile (char *path, char *buf, int len)
+{
+    FILE *f;
+    char *p;
+
+    f = fopen(path, "r");
+    if (f == NULL) return rtsFalse;
+    p = fgets(buf, len, f);
+    fclose(f);
+    return (p != NULL);
+}
+
+lnat osCacheSize (nat level)
+{
+    char path[128], buf[32];
+    char *unit;
+    nat i;
+    lnat size;
+
+    for (i = 0; ; i++) {
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+        if (!readSysFile(path, buf, sizeof(buf))) break;
+        if ((nat)strtol(buf, NULL, 10) != level) continue;
+
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+        if (!readSysFile(path, buf, sizeof(buf))) continue;
+        if (strncmp(buf, "Instruction", 11) == 0) continue;
+
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+        if (!readSysFile(path, buf, sizeof(buf))) continue;
+        size = strtoul(buf, &unit, 10);
+        switch (*unit) {
+        case 'K': case 'k': size *= 1024; break;
+        case 'M': case 'm': size *= 1024 * 1024; break;
+        default: break;
+        }
+        return size;
+    }
+    return 0;
+}
+#else
+lnat osCacheSize (nat level STG_UNUSED)
+{
+    return 0;
+}
+#endif
+
+/* -----------------------------------------------------------------------------
+   NUMA
+
+   We use libnuma to find out which nodes the process may allocate
+   memory on, and mbind() to place megablocks on a particular node.
+   Without libnuma there is a single node and binding is a no-op.
+   -------------------------------------------------------------------------- */
+
+rtsBool osNumaAvailable (void)
+{
+#if defined(USE_LIBNUMA)
+    return (numa_available() != -1);
+#else
+    return rtsFalse;
+#endif
+}
+
+nat osNumaNodes (void)
+{
+#if defined(USE_LIBNUMA)
+    return numa_num_configured_nodes();
+#else
+    return 1;
+#endif
+}
+
+StgWord osNumaMask (void)
+{
+#if defined(USE_LIBNUMA)
+    struct bitmask *mask;
+    StgWord r;
+
+    mask = numa_get_mems_allowed();
+    r = (StgWord)mask->maskp[0];
+    numa_bitmask_free(mask);
+    return r;
+#else
+    return 1;
+#endif
+}
+
+void osBindMBlocksToNode (void *addr   STG_UNUSED,
+                          lnat  size   STG_UNUSED,
+                          nat   node   STG_UNUSED)
+{
+#if defined(USE_LIBNUMA)
+    unsigned long mask;
+
+    if (!RtsFlags.GcFlags.numa) return;
+
+    // MPOL_PREFERRED rather than MPOL_BIND: if the node runs out of
+    // memory we would rather take a remote page than fail.  The pages
+    // aren't touched yet, so this decides where they will be placed.
+    mask = 1UL << node;
+    if (mbind(addr, (unsigned long)size, MPOL_PREFERRED,
+              &mask, sizeof(mask) * 8, 0) != 0) {
+        sysErrorBelch("osBindMBlocksToNode: mbind");
+        stg_exit(EXIT_FAILURE);
+    }
+#endif
+}
@@ -61,6 +61,10 @@
 # include <signal.h>
 #endif
 
+#if defined(HAVE_LIBNUMA) && defined(HAVE_NUMA_H)
+#include <numa.h>
+#endif
+
 /*
  * This (allegedly) OS threads independent layer was initially
  * abstracted away from code that used Pthreads, so the functions
@@ -293,6 +297,23 @@ setThreadAffinity (nat n GNUC3_ATTRIBUTE(__unused__),
 }
 #endif
 
+// Restrict the current thread to the CPUs of the given OS NUMA node.
+#if defined(HAVE_LIBNUMA) && defined(HAVE_NUMA_H)
+void
+setThreadNode (nat node)
+{
+    if (numa_run_on_node(node) == -1) {
+        sysErrorBelch("numa_run_on_node");
+        stg_exit(EXIT_FAILURE);
+    }
+}
+#else
+void
+setThreadNode (nat node GNUC3_ATTRIBUTE(__unused__))
+{
+}
+#endif
+
 void
 interruptOSThread (OSThreadId id)
 {
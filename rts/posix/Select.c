@@ -17,6 +17,7 @@
 #include "RtsUtils.h"
 #include "Itimer.h"
 #include "Capability.h"
+#include "Threads.h"
 #include "Select.h"
 #include "AwaitEvent.h"
 #include "Stats.h"
@@ -35,6 +36,13 @@
 
 #include "Clock.h"
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CTL)
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #if !defined(THREADED_RTS)
 
 // The target time for a threadDelay is stored in a one-word quantity
@@ -82,18 +90,168 @@ LowResTime getDelayTarget (HsInt us)
  *
  * if this is true, then our time has expired.
  * (idea due to Andy Gill).
+ *
+ * The same trick orders two targets in the sleepers heap.
  */
+#define TimeBefore(a,b) (((long)(a) - (long)(b)) < 0)
+
+/* -----------------------------------------------------------------------------
+ * The sleepers heap
+ *
+ * Threads blocked in threadDelay are kept in a binary min-heap ordered
+ * by target time, so a delay costs O(log n) to start and O(log n) to
+ * expire, rather than the O(n) of the old sorted sleeping_queue.
+ *
+ * Removing an arbitrary thread from the heap (throwTo, e.g. killing
+ * the timer thread of System.Timeout.timeout) would need the thread's
+ * index in the heap, which we have nowhere to keep.  So removal is
+ * lazy instead: each entry remembers the target it was inserted with,
+ * and an entry is only live if its thread is still BlockedOnDelay
+ * with that same target.  Stale entries are discarded when they reach
+ * the top of the heap, or all at once by compactSleepers() when they
+ * make up more than half of the heap, so that they don't keep too
+ * many dead threads alive.
+ *
+ * The heap is a GC root (markAwaitEvent()).
+ * -------------------------------------------------------------------------- */
+
+typedef struct {
+    StgTSO     *tso;
+    LowResTime  target;
+} Sleeper;
+
+static Sleeper *sleepers = NULL;
+static nat      sleepers_size = 0;
+static nat      n_sleepers = 0;
+static nat      n_stale_sleepers = 0;
+
+#define MIN_STALE_SLEEPERS_TO_COMPACT 64
+
+STATIC_INLINE rtsBool
+sleeperIsLive (Sleeper *s)
+{
+    return s->tso->why_blocked == BlockedOnDelay
+        && s->tso->block_info.target == s->target;
+}
+
+static void
+siftUpSleeper (nat i)
+{
+    Sleeper s = sleepers[i];
+    nat parent;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (!TimeBefore(s.target, sleepers[parent].target)) break;
+        sleepers[i] = sleepers[parent];
+        i = parent;
+    }
+    sleepers[i] = s;
+}
+
+static void
+siftDownSleeper (nat i)
+{
+    Sleeper s = sleepers[i];
+    nat child;
+
+    while ((child = 2 * i + 1) < n_sleepers) {
+        if (child + 1 < n_sleepers &&
+            TimeBefore(sleepers[child+1].target, sleepers[child].target)) {
+            child++;
+        }
+        if (!TimeBefore(sleepers[child].target, s.target)) break;
+        sleepers[i] = sleepers[child];
+        i = child;
+    }
+    sleepers[i] = s;
+}
+
+static void
+deleteMinSleeper (void)
+{
+    ASSERT(n_sleepers > 0);
+    n_sleepers--;
+    if (n_sleepers > 0) {
+        sleepers[0] = sleepers[n_sleepers];
+        siftDownSleeper(0);
+    }
+}
+
+/* Drop all the stale entries, and rebuild the heap in O(n). */
+static void
+compactSleepers (void)
+{
+    nat i, n;
+
+    n = 0;
+    for (i = 0; i < n_sleepers; i++) {
+        if (sleeperIsLive(&sleepers[i])) {
+            sleepers[n++] = sleepers[i];
+        }
+    }
+    n_sleepers = n;
+    for (i = n / 2; i > 0; i--) {
+        siftDownSleeper(i - 1);
+    }
+    n_stale_sleepers = 0;
+}
+
+/* Called from stg_delayzh, with tso->block_info.target already set.
+ */
+void
+insertSleepingThread (StgTSO *tso)
+{
+    if (n_sleepers == sleepers_size) {
+        sleepers_size = sleepers_size == 0 ? 64 : sleepers_size * 2;
+        sleepers = stgReallocBytes(sleepers, sleepers_size * sizeof(Sleeper),
+                                   "insertSleepingThread");
+    }
+    sleepers[n_sleepers].tso    = tso;
+    sleepers[n_sleepers].target = tso->block_info.target;
+    n_sleepers++;
+    siftUpSleeper(n_sleepers - 1);
+}
+
+void
+removeThreadFromSleepers (StgTSO *tso STG_UNUSED)
+{
+    // the caller sets tso->why_blocked, which makes the entry stale
+    n_stale_sleepers++;
+}
+
+rtsBool
+emptySleepingThreads (void)
+{
+    if (n_sleepers == 0) return rtsTrue;
+    if (n_sleepers > n_stale_sleepers) return rtsFalse;
+    // The stale count is only a hint; check properly before we let
+    // the scheduler decide that nobody is going to wake up.
+    compactSleepers();
+    return n_sleepers == 0;
+}
+
 static rtsBool wakeUpSleepingThreads (LowResTime now)
 {
     StgTSO *tso;
     rtsBool flag = rtsFalse;
 
-    while (sleeping_queue != END_TSO_QUEUE) {
-	tso = sleeping_queue;
-        if (((long)now - (long)tso->block_info.target) < 0) {
+    if (n_stale_sleepers > MIN_STALE_SLEEPERS_TO_COMPACT &&
+        n_stale_sleepers > n_sleepers / 2) {
+        compactSleepers();
+    }
+
+    while (n_sleepers > 0) {
+        if (TimeBefore(now, sleepers[0].target)) {
             break;
         }
-	sleeping_queue = tso->_link;
+        if (!sleeperIsLive(&sleepers[0])) {
+            if (n_stale_sleepers > 0) n_stale_sleepers--;
+            deleteMinSleeper();
+            continue;
+        }
+        tso = sleepers[0].tso;
+        deleteMinSleeper();
 	tso->why_blocked = NotBlocked;
 	tso->_link = END_TSO_QUEUE;
 	IF_DEBUG(scheduler,debugBelch("Waking up sleeping thread %lu\n", (unsigned long)tso->id));
@@ -104,13 +262,499 @@ static rtsBool wakeUpSleepingThreads (LowResTime now)
     return flag;
 }
 
+/* The target of the next thread to wake up, if there is one. */
+static rtsBool
+nextSleeperTarget (LowResTime *target)
+{
+    if (n_sleepers == 0) return rtsFalse;
+    // might be a stale entry, in which case we wake up early and go
+    // round again.
+    *target = sleepers[0].target;
+    return rtsTrue;
+}
+
 static void GNUC3_ATTRIBUTE(__noreturn__)
 fdOutOfRange (int fd)
 {
-    errorBelch("file descriptor %d out of range for select (0--%d).\nRecompile with -threaded to work around this.", fd, (int)FD_SETSIZE);
+    errorBelch("file descriptor %d out of range for select (0--%d).\nRecompile with -threaded, or use +RTS --io-manager=epoll, to work around this.", fd, (int)FD_SETSIZE);
     stg_exit(EXIT_FAILURE);
 }
 
+/* The wait for I/O was interrupted by a signal (EINTR).  Returns
+ * rtsTrue if we should return to the scheduler straight away, or
+ * rtsFalse to carry on waiting.
+ */
+static rtsBool
+interruptedWait (void)
+{
+    /* We got a signal; could be one of ours.  If so, we need
+     * to start up the signal handler straight away, otherwise
+     * we could block for a long time before the signal is
+     * serviced.
+     */
+#if defined(RTS_USER_SIGNALS)
+    if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
+        startSignalHandlers(&MainCapability);
+        return rtsTrue; /* still hold the lock */
+    }
+#endif
+
+    /* we were interrupted, return to the scheduler immediately.
+     */
+    if (sched_state >= SCHED_INTERRUPTING) {
+        return rtsTrue; /* still hold the lock */
+    }
+
+    /* check for threads that need waking up
+     */
+    wakeUpSleepingThreads(getLowResTimeOfDay());
+
+    /* If new runnable threads have arrived, stop waiting for
+     * I/O and run them.
+     */
+    if (!emptyRunQueue(&MainCapability)) {
+        return rtsTrue; /* still hold the lock */
+    }
+
+    return rtsFalse;
+}
+
+static void
+wakeUpBlockedThread (StgTSO *tso)
+{
+    IF_DEBUG(scheduler,debugBelch("Waking up blocked thread %lu\n", (unsigned long)tso->id));
+    tso->why_blocked = NotBlocked;
+    tso->_link = END_TSO_QUEUE;
+    pushOnRunQueue(&MainCapability,tso);
+}
+
+#if defined(USE_EPOLL)
+
+/* -----------------------------------------------------------------------------
+ * The epoll backend
+ *
+ * The select() backend below rebuilds its fd_sets from blocked_queue_hd
+ * on every call, so it costs O(blocked threads) each time round the
+ * scheduler loop, and it can't handle an fd >= FD_SETSIZE at all.
+ *
+ * The epoll backend instead keeps the threads blocked on I/O in
+ * per-fd queues (fd_waiters), and leaves each fd registered with the
+ * kernel for as long as it is in use.  awaitEvent() then only has to
+ * deal with:
+ *
+ *   - the threads that have blocked since the last call.
+ *     stg_waitReadzh and stg_waitWritezh still append to
+ *     blocked_queue_hd, and registerBlockedThreads() moves them onto
+ *     the per-fd queues, registering the fd if necessary;
+ *
+ *   - the fds that epoll_wait() reports as ready.
+ *
+ * Registrations are dropped lazily: when epoll reports an event that
+ * no thread is waiting for any more, we take it out of the interest
+ * set.  So an fd that is waited on again and again (the common case
+ * for a socket) costs no epoll_ctl() calls at all after the first.
+ *
+ * The per-fd queues are GC roots (markAwaitEvent()), and
+ * removeThreadFromFdWaiters() takes a thread off them when it receives
+ * an asynchronous exception.
+ * -------------------------------------------------------------------------- */
+
+typedef struct {
+    StgTSO *readers;    // threads BlockedOnRead this fd, linked by _link
+    StgTSO *writers;    // threads BlockedOnWrite this fd
+    nat     events;     // events currently registered with epoll
+} FdWaiters;
+
+#define MAX_EPOLL_EVENTS 256
+
+static rtsBool     use_epoll = rtsFalse;
+static int         epoll_fd  = -1;
+static FdWaiters * fd_waiters = NULL;
+static nat         fd_waiters_size = 0;
+static nat         n_fd_waiters = 0;    // threads on the fd_waiters queues
+static struct epoll_event epoll_events[MAX_EPOLL_EVENTS];
+
+static void
+ensureFdWaiters (int fd)
+{
+    nat i, old_size;
+
+    if ((nat)fd < fd_waiters_size) return;
+
+    old_size = fd_waiters_size;
+    if (fd_waiters_size == 0) fd_waiters_size = 64;
+    while ((nat)fd >= fd_waiters_size) {
+        fd_waiters_size *= 2;
+    }
+    fd_waiters = stgReallocBytes(fd_waiters,
+                                 fd_waiters_size * sizeof(FdWaiters),
+                                 "ensureFdWaiters");
+    for (i = old_size; i < fd_waiters_size; i++) {
+        fd_waiters[i].readers = END_TSO_QUEUE;
+        fd_waiters[i].writers = END_TSO_QUEUE;
+        fd_waiters[i].events  = 0;
+    }
+}
+
+/* Change the set of events registered for fd.  Returns -1 and sets
+ * errno if epoll_ctl() fails, in which case the fd is left
+ * unregistered.
+ *
+ * Registrations are only dropped lazily (see wakeUpFdWaiters()), so
+ * w->events may describe an fd that has since been closed, which
+ * removes it from the epoll set, and perhaps reopened.  With refresh
+ * set, the registration is renewed even if w->events says it is
+ * already there.
+ */
+static int
+setFdEvents (int fd, nat events, rtsBool refresh)
+{
+    FdWaiters *w = &fd_waiters[fd];
+    struct epoll_event ev;
+    int r;
+
+    if (events == w->events && !refresh) return 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = events;
+    ev.data.fd = fd;
+
+    if (events == 0) {
+        // ENOENT or EBADF here just means the fd has been closed,
+        // which has removed it from the interest set already.
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+        w->events = 0;
+        return 0;
+    }
+
+    if (w->events == 0) {
+        r = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    } else {
+        r = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+        if (r < 0 && errno == ENOENT) {
+            // the fd was closed (and perhaps reopened) since we
+            // registered it
+            r = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        }
+    }
+
+    if (r < 0) {
+        w->events = 0;
+        return -1;
+    }
+    w->events = events;
+    return 0;
+}
+
+static void
+wakeUpFdQueue (StgTSO **queue)
+{
+    StgTSO *tso;
+
+    while (*queue != END_TSO_QUEUE) {
+        tso = *queue;
+        *queue = tso->_link;
+        n_fd_waiters--;
+        wakeUpBlockedThread(tso);
+    }
+}
+
+/* Move the threads that have blocked since the last call from
+ * blocked_queue_hd onto the per-fd queues.
+ */
+static void
+registerBlockedThreads (void)
+{
+    StgTSO *tso, *next, **queue;
+    FdWaiters *w;
+    nat event;
+    int fd;
+
+    for (tso = blocked_queue_hd; tso != END_TSO_QUEUE; tso = next) {
+        next = tso->_link;
+        tso->_link = END_TSO_QUEUE;
+        fd = tso->block_info.fd;
+
+        if (fd < 0) {
+            // let the thread discover the bad fd for itself
+            wakeUpBlockedThread(tso);
+            continue;
+        }
+
+        ensureFdWaiters(fd);
+        w = &fd_waiters[fd];
+
+        switch (tso->why_blocked) {
+        case BlockedOnRead:
+            event = EPOLLIN;
+            queue = &w->readers;
+            break;
+        case BlockedOnWrite:
+            event = EPOLLOUT;
+            queue = &w->writers;
+            break;
+        default:
+            barf("registerBlockedThreads");
+        }
+
+        // The first waiter on an fd renews its registration, in case
+        // the fd has been closed and reused since it was made.
+        if (setFdEvents(fd, w->events | event,
+                        w->readers == END_TSO_QUEUE &&
+                        w->writers == END_TSO_QUEUE) < 0) {
+            /* EPERM: regular files and directories can't be polled,
+             * but select() always says they are ready, so do the same.
+             *
+             * EBADF: the fd has been closed under our feet.  As in the
+             * select() backend, wake up everything that was waiting
+             * on it and let the threads find out when they try the
+             * I/O.
+             */
+            if (errno != EPERM && errno != EBADF) {
+                sysErrorBelch("epoll_ctl");
+                stg_exit(EXIT_FAILURE);
+            }
+            wakeUpFdQueue(&w->readers);
+            wakeUpFdQueue(&w->writers);
+            wakeUpBlockedThread(tso);
+            continue;
+        }
+
+        setTSOLink(&MainCapability, tso, *queue);
+        *queue = tso;
+        n_fd_waiters++;
+    }
+
+    blocked_queue_hd = END_TSO_QUEUE;
+    blocked_queue_tl = END_TSO_QUEUE;
+}
+
+static void
+wakeUpFdWaiters (int fd, nat events)
+{
+    FdWaiters *w = &fd_waiters[fd];
+    nat stale = 0;
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        events |= EPOLLIN | EPOLLOUT;
+    }
+
+    if (events & EPOLLIN) {
+        if (w->readers == END_TSO_QUEUE) {
+            stale |= EPOLLIN;
+        } else {
+            wakeUpFdQueue(&w->readers);
+        }
+    }
+
+    if (events & EPOLLOUT) {
+        if (w->writers == END_TSO_QUEUE) {
+            stale |= EPOLLOUT;
+        } else {
+            wakeUpFdQueue(&w->writers);
+        }
+    }
+
+    // Nobody was waiting for these events any more, so stop epoll
+    // from reporting them.
+    if (stale != 0) {
+        setFdEvents(fd, w->events & ~stale, rtsFalse);
+    }
+}
+
+static void
+awaitEventEpoll (rtsBool wait)
+{
+    int numFound, timeout, i;
+    LowResTime now, target;
+
+    do {
+
+      now = getLowResTimeOfDay();
+      if (wakeUpSleepingThreads(now)) {
+          return;
+      }
+
+      registerBlockedThreads();
+
+      if (!wait || !emptyRunQueue(&MainCapability)) {
+          // just poll
+          timeout = 0;
+      } else if (nextSleeperTarget(&target)) {
+          Time min = LowResTimeToTime(target - now);
+          // round up, as in getDelayTarget()
+          timeout = (int)((TimeToUS(min) + 999) / 1000);
+      } else {
+          timeout = -1;
+      }
+
+      while (1) { // repeat the epoll_wait on EINTR
+
+          // Disable the timer signal while blocked, to conserve
+          // power. (#1623, #5991)
+          if (timeout != 0) stopTimer();
+
+          numFound = epoll_wait(epoll_fd, epoll_events,
+                                MAX_EPOLL_EVENTS, timeout);
+
+          if (timeout != 0) startTimer();
+
+          if (numFound >= 0) break;
+
+          if (errno != EINTR) {
+              sysErrorBelch("epoll_wait");
+              stg_exit(EXIT_FAILURE);
+          }
+
+          if (interruptedWait()) {
+              return; /* still hold the lock */
+          }
+      }
+
+      for (i = 0; i < numFound; i++) {
+          wakeUpFdWaiters(epoll_events[i].data.fd, epoll_events[i].events);
+      }
+
+    } while (wait && sched_state == SCHED_RUNNING
+	     && emptyRunQueue(&MainCapability));
+}
+
+#endif /* USE_EPOLL */
+
+void
+initAwaitEvent (void)
+{
+#if defined(USE_EPOLL)
+    if (RtsFlags.MiscFlags.ioManager != IO_MANAGER_EPOLL) return;
+
+    // the size argument is only a hint, and is ignored by Linux >= 2.6.8
+    epoll_fd = epoll_create(MAX_EPOLL_EVENTS);
+    if (epoll_fd < 0) {
+        // fall back to select()
+        IF_DEBUG(scheduler, sysErrorBelch("epoll_create"));
+        return;
+    }
+    fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+    use_epoll = rtsTrue;
+#endif
+}
+
+void
+resetAwaitEvent (void)
+{
+#if defined(USE_EPOLL)
+    nat fd;
+
+    if (!use_epoll) return;
+
+    // all the threads have been deleted by now
+    ASSERT(n_fd_waiters == 0);
+
+    close(epoll_fd);
+    epoll_fd = -1;
+    use_epoll = rtsFalse;
+    for (fd = 0; fd < fd_waiters_size; fd++) {
+        fd_waiters[fd].events = 0;
+    }
+    initAwaitEvent();
+#endif
+}
+
+void
+exitAwaitEvent (void)
+{
+    if (sleepers != NULL) {
+        stgFree(sleepers);
+        sleepers = NULL;
+    }
+    sleepers_size = 0;
+    n_sleepers = 0;
+    n_stale_sleepers = 0;
+
+#if defined(USE_EPOLL)
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    if (fd_waiters != NULL) {
+        stgFree(fd_waiters);
+        fd_waiters = NULL;
+    }
+    fd_waiters_size = 0;
+    n_fd_waiters = 0;
+    use_epoll = rtsFalse;
+#endif
+}
+
+void
+markAwaitEvent (evac_fn evac, void *user)
+{
+    nat i;
+
+    for (i = 0; i < n_sleepers; i++) {
+        evac(user, (StgClosure **)(void *)&sleepers[i].tso);
+    }
+
+#if defined(USE_EPOLL)
+    if (n_fd_waiters == 0) return;
+
+    for (i = 0; i < fd_waiters_size; i++) {
+        if (fd_waiters[i].readers != END_TSO_QUEUE) {
+            evac(user, (StgClosure **)(void *)&fd_waiters[i].readers);
+        }
+        if (fd_waiters[i].writers != END_TSO_QUEUE) {
+            evac(user, (StgClosure **)(void *)&fd_waiters[i].writers);
+        }
+    }
+#endif
+}
+
+rtsBool
+emptyFdWaiters (void)
+{
+#if defined(USE_EPOLL)
+    return n_fd_waiters == 0;
+#else
+    return rtsTrue;
+#endif
+}
+
+/* Remove a thread BlockedOnRead/BlockedOnWrite from wherever it is
+ * waiting, for throwTo.
+ */
+void
+removeThreadFromFdWaiters (Capability *cap, StgTSO *tso)
+{
+#if defined(USE_EPOLL)
+    StgTSO *t, *prev, **queue;
+    int fd = tso->block_info.fd;
+
+    if (use_epoll && fd >= 0 && (nat)fd < fd_waiters_size) {
+        if (tso->why_blocked == BlockedOnRead) {
+            queue = &fd_waiters[fd].readers;
+        } else {
+            queue = &fd_waiters[fd].writers;
+        }
+        prev = NULL;
+        for (t = *queue; t != END_TSO_QUEUE; prev = t, t = t->_link) {
+            if (t == tso) {
+                if (prev) {
+                    setTSOLink(cap, prev, t->_link);
+                } else {
+                    *queue = t->_link;
+                }
+                t->_link = END_TSO_QUEUE;
+                n_fd_waiters--;
+                // the fd stays registered; see wakeUpFdWaiters()
+                return;
+            }
+        }
+    }
+#endif
+    // not registered yet, or we're using select()
+    removeThreadFromDeQueue(cap, &blocked_queue_hd, &blocked_queue_tl, tso);
+}
+
 /* Argument 'wait' says whether to wait for I/O to become available,
  * or whether to just check and return immediately.  If there are
  * other threads ready to run, we normally do the non-waiting variety,
@@ -124,8 +768,8 @@ fdOutOfRange (int fd)
  * not write handles.
  *
  */
-void
-awaitEvent(rtsBool wait)
+static void
+awaitEventSelect(rtsBool wait)
 {
     StgTSO *tso, *prev, *next;
     rtsBool ready;
@@ -135,15 +779,7 @@ awaitEvent(rtsBool wait)
     rtsBool select_succeeded = rtsTrue;
     rtsBool unblock_all = rtsFalse;
     struct timeval tv, *ptv;
-    LowResTime now;
-
-    IF_DEBUG(scheduler,
-	     debugBelch("scheduler: checking for threads blocked on I/O");
-	     if (wait) {
-		 debugBelch(" (waiting)");
-	     }
-	     debugBelch("\n");
-	     );
+    LowResTime now, target;
 
     /* loop until we've woken up some threads.  This loop is needed
      * because the select timing isn't accurate, we sometimes sleep
@@ -203,8 +839,8 @@ awaitEvent(rtsBool wait)
           tv.tv_sec  = 0;
           tv.tv_usec = 0;
           ptv = &tv;
-      } else if (sleeping_queue != END_TSO_QUEUE) {
-          Time min = LowResTimeToTime(sleeping_queue->block_info.target - now);
+      } else if (nextSleeperTarget(&target)) {
+          Time min = LowResTimeToTime(target - now);
           tv.tv_sec  = TimeToSeconds(min);
           tv.tv_usec = TimeToUS(min) % 1000000;
           ptv = &tv;
@@ -251,32 +887,7 @@ awaitEvent(rtsBool wait)
             }
 	  }
 
-	  /* We got a signal; could be one of ours.  If so, we need
-	   * to start up the signal handler straight away, otherwise
-	   * we could block for a long time before the signal is
-	   * serviced.
-	   */
-#if defined(RTS_USER_SIGNALS)
-	  if (RtsFlags.MiscFlags.install_signal_handlers && signals_pending()) {
-	      startSignalHandlers(&MainCapability);
-	      return; /* still hold the lock */
-	  }
-#endif
-
-	  /* we were interrupted, return to the scheduler immediately.
-	   */
-	  if (sched_state >= SCHED_INTERRUPTING) {
-	      return; /* still hold the lock */
-	  }
-	  
-	  /* check for threads that need waking up 
-	   */
-          wakeUpSleepingThreads(getLowResTimeOfDay());
-
-	  /* If new runnable threads have arrived, stop waiting for
-	   * I/O and run them.
-	   */
-	  if (!emptyRunQueue(&MainCapability)) {
+          if (interruptedWait()) {
 	      return; /* still hold the lock */
 	  }
       }
@@ -302,10 +913,7 @@ awaitEvent(rtsBool wait)
 	      }
       
 	      if (ready) {
-		IF_DEBUG(scheduler,debugBelch("Waking up blocked thread %lu\n", (unsigned long)tso->id));
-		  tso->why_blocked = NotBlocked;
-		  tso->_link = END_TSO_QUEUE;
-		  pushOnRunQueue(&MainCapability,tso);
+		  wakeUpBlockedThread(tso);
 	      } else {
 		  if (prev == NULL)
 		      blocked_queue_hd = tso;
@@ -327,5 +935,25 @@ awaitEvent(rtsBool wait)
 	     && emptyRunQueue(&MainCapability));
 }
 
+void
+awaitEvent(rtsBool wait)
+{
+    IF_DEBUG(scheduler,
+	     debugBelch("scheduler: checking for threads blocked on I/O");
+	     if (wait) {
+		 debugBelch(" (waiting)");
+	     }
+	     debugBelch("\n");
+	     );
+
+#if defined(USE_EPOLL)
+    if (use_epoll) {
+        awaitEventEpoll(wait);
+        return;
+    }
+#endif
+    awaitEventSelect(wait);
+}
+
 #endif /* THREADED_RTS */
 
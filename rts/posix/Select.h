@@ -14,4 +14,7 @@ typedef StgWord LowResTime;
 
 RTS_PRIVATE LowResTime getDelayTarget (HsInt us);
 
+// Called from stg_delayzh
+RTS_PRIVATE void insertSleepingThread (StgTSO *tso);
+
 #endif /* POSIX_SELECT_H */
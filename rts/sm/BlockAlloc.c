@@ -25,7 +25,11 @@
 
 #include <string.h>
 
-static void  initMBlock(void *mblock);
+static void  initMBlock(void *mblock, nat node);
+static nat   returnNodeMemoryToOS(nat node, nat n);
+#ifdef DEBUG
+static void  checkNodeFreeListSanity(nat node);
+#endif
 
 /* -----------------------------------------------------------------------------
 
@@ -117,6 +121,31 @@ static void  initMBlock(void *mblock);
 
   checkFreeListSanity() checks all the invariants on the free lists.
 
+  NUMA
+
+  With +RTS --numa there is a separate set of free lists (free_list
+  and free_mblock_list) for each logical NUMA node, and every block
+  descriptor records the node its memory lives on (bd->node).
+  allocGroupOnNode() only takes memory from its node's lists, asking
+  for fresh megablocks bound to the node when they are empty, and
+  freeGroup() puts a group back on the lists of the node it came from.
+  Groups never coalesce across nodes, because two groups are only ever
+  on the same list if they are on the same node.  Without --numa
+  everything lives on node 0.
+
+  Decommitting
+
+  returnMemoryToOS() unmaps whole megablock groups, but only from the
+  low end of the free mblock list and only after a major GC, so a
+  heap that grows and shrinks again often keeps its peak RSS.
+  decommitFreeMemory() instead tells the OS that it can have the
+  memory of free megablock groups back (osDecommitMemory), wherever
+  they are, while leaving them mapped and on the free list.  Such a
+  group is marked BF_DECOMMITTED; the mark goes when it is allocated,
+  or coalesced with a group that isn't decommitted, and the memory is
+  simply faulted back in when it is used.  The bdescrs of the first
+  megablock of the group are kept, so the free list stays intact.
+
   --------------------------------------------------------------------------- */
 
 /* ---------------------------------------------------------------------------
@@ -133,10 +162,10 @@ static void  initMBlock(void *mblock);
 
 // In THREADED_RTS mode, the free list is protected by sm_mutex.
 
-static bdescr *free_list[MAX_FREE_LIST];
-static bdescr *free_mblock_list;
+static bdescr *free_list[MAX_NUMA_NODES][MAX_FREE_LIST];
+static bdescr *free_mblock_list[MAX_NUMA_NODES];
 
-// free_list[i] contains blocks that are at least size 2^i, and at
+// free_list[node][i] contains blocks that are at least size 2^i, and at
 // most size 2^(i+1) - 1.  
 // 
 // To find the free list in which to place a block, use log_2(size).
@@ -145,19 +174,26 @@ static bdescr *free_mblock_list;
 lnat n_alloc_blocks;   // currently allocated blocks
 lnat hw_alloc_blocks;  // high-water allocated blocks
 
+lnat      decommitted_mblocks;        // free mblocks currently decommitted
+StgWord64 total_decommitted_mblocks;  // mblocks decommitted, ever
+
 /* -----------------------------------------------------------------------------
    Initialisation
    -------------------------------------------------------------------------- */
 
 void initBlockAllocator(void)
 {
-    nat i;
-    for (i=0; i < MAX_FREE_LIST; i++) {
-        free_list[i] = NULL;
+    nat i, node;
+    for (node=0; node < MAX_NUMA_NODES; node++) {
+        for (i=0; i < MAX_FREE_LIST; i++) {
+            free_list[node][i] = NULL;
+        }
+        free_mblock_list[node] = NULL;
     }
-    free_mblock_list = NULL;
     n_alloc_blocks = 0;
     hw_alloc_blocks = 0;
+    decommitted_mblocks = 0;
+    total_decommitted_mblocks = 0;
 }
 
 /* -----------------------------------------------------------------------------
@@ -215,7 +251,7 @@ free_list_insert (bdescr *bd)
     ASSERT(bd->blocks < BLOCKS_PER_MBLOCK);
     ln = log_2(bd->blocks);
     
-    dbl_link_onto(bd, &free_list[ln]);
+    dbl_link_onto(bd, &free_list[bd->node][ln]);
 }
 
 
@@ -244,23 +280,34 @@ setup_tail (bdescr *bd)
 // Take a free block group bd, and split off a group of size n from
 // it.  Adjust the free list as necessary, and return the new group.
 static bdescr *
-split_free_block (bdescr *bd, nat n, nat ln)
+split_free_block (bdescr *bd, nat node, nat n, nat ln)
 {
     bdescr *fg; // free group
 
     ASSERT(bd->blocks > n);
-    dbl_link_remove(bd, &free_list[ln]);
+    dbl_link_remove(bd, &free_list[node][ln]);
     fg = bd + bd->blocks - n; // take n blocks off the end
     fg->blocks = n;
     bd->blocks -= n;
     setup_tail(bd);
     ln = log_2(bd->blocks);
-    dbl_link_onto(bd, &free_list[ln]);
+    dbl_link_onto(bd, &free_list[node][ln]);
     return fg;
 }
 
+// Forget that a free megablock group was decommitted, because we are
+// about to use it (or to merge it with memory that is committed).
+STATIC_INLINE void
+recommit_mega_group (bdescr *mg)
+{
+    if (mg->flags & BF_DECOMMITTED) {
+        decommitted_mblocks -= BLOCKS_TO_MBLOCKS(mg->blocks);
+        mg->flags &= ~BF_DECOMMITTED;
+    }
+}
+
 static bdescr *
-alloc_mega_group (nat mblocks)
+alloc_mega_group (nat node, nat mblocks)
 {
     bdescr *best, *bd, *prev;
     nat n;
@@ -269,15 +316,16 @@ alloc_mega_group (nat mblocks)
 
     best = NULL;
     prev = NULL;
-    for (bd = free_mblock_list; bd != NULL; prev = bd, bd = bd->link)
+    for (bd = free_mblock_list[node]; bd != NULL; prev = bd, bd = bd->link)
     {
         if (bd->blocks == n) 
         {
             if (prev) {
                 prev->link = bd->link;
             } else {
-                free_mblock_list = bd->link;
+                free_mblock_list[node] = bd->link;
             }
+            recommit_mega_group(bd);
             initGroup(bd);
             return bd;
         }
@@ -298,12 +346,17 @@ alloc_mega_group (nat mblocks)
                           (best_mblocks-mblocks)*MBLOCK_SIZE);
 
         best->blocks = MBLOCK_GROUP_BLOCKS(best_mblocks - mblocks);
-        initMBlock(MBLOCK_ROUND_DOWN(bd));
+        if (best->flags & BF_DECOMMITTED) {
+            // the rest of best stays decommitted
+            decommitted_mblocks -= mblocks;
+        }
+        initMBlock(MBLOCK_ROUND_DOWN(bd), node);
+        bd->flags = 0;
     }
     else
     {
-        void *mblock = getMBlocks(mblocks);
-        initMBlock(mblock);		// only need to init the 1st one
+        void *mblock = getMBlocksOnNode(node, mblocks);
+        initMBlock(mblock, node);	// only need to init the 1st one
         bd = FIRST_BDESCR(mblock);
     }
     bd->blocks = MBLOCK_GROUP_BLOCKS(mblocks);
@@ -311,12 +364,13 @@ alloc_mega_group (nat mblocks)
 }
 
 bdescr *
-allocGroup (nat n)
+allocGroupOnNode (nat node, nat n)
 {
     bdescr *bd, *rem;
     nat ln;
 
     if (n == 0) barf("allocGroup: requested zero blocks");
+    ASSERT(node < MAX_NUMA_NODES);
     
     if (n >= BLOCKS_PER_MBLOCK)
     {
@@ -329,7 +383,7 @@ allocGroup (nat n)
         n_alloc_blocks += mblocks * BLOCKS_PER_MBLOCK;
         if (n_alloc_blocks > hw_alloc_blocks) hw_alloc_blocks = n_alloc_blocks;
 
-        bd = alloc_mega_group(mblocks);
+        bd = alloc_mega_group(node, mblocks);
         // only the bdescrs of the first MB are required to be initialised
         initGroup(bd);
         goto finish;
@@ -340,7 +394,7 @@ allocGroup (nat n)
 
     ln = log_2_ceil(n);
 
-    while (ln < MAX_FREE_LIST && free_list[ln] == NULL) {
+    while (ln < MAX_FREE_LIST && free_list[node][ln] == NULL) {
         ln++;
     }
 
@@ -354,7 +408,7 @@ allocGroup (nat n)
         }
 #endif
 
-        bd = alloc_mega_group(1);
+        bd = alloc_mega_group(node, 1);
         bd->blocks = n;
         initGroup(bd);		         // we know the group will fit
         rem = bd + n;
@@ -365,16 +419,16 @@ allocGroup (nat n)
         goto finish;
     }
 
-    bd = free_list[ln];
+    bd = free_list[node][ln];
 
     if (bd->blocks == n)	        // exactly the right size!
     {
-        dbl_link_remove(bd, &free_list[ln]);
+        dbl_link_remove(bd, &free_list[node][ln]);
         initGroup(bd);
     }
     else if (bd->blocks >  n)            // block too big...
     {                              
-        bd = split_free_block(bd, n, ln);
+        bd = split_free_block(bd, node, n, ln);
         ASSERT(bd->blocks == n);
         initGroup(bd);
     }
@@ -389,6 +443,22 @@ finish:
     return bd;
 }
 
+bdescr *
+allocGroup (nat n)
+{
+    return allocGroupOnNode(0, n);
+}
+
+bdescr *
+allocGroupOnNode_lock(nat node, nat n)
+{
+    bdescr *bd;
+    ACQUIRE_SM_LOCK;
+    bd = allocGroupOnNode(node, n);
+    RELEASE_SM_LOCK;
+    return bd;
+}
+
 bdescr *
 allocGroup_lock(nat n)
 {
@@ -415,6 +485,156 @@ allocBlock_lock(void)
     return bd;
 }
 
+/* -----------------------------------------------------------------------------
+   Block caches
+
+   A BlockCache holds free groups of up to BLOCK_CACHE_MAX_BLOCKS
+   blocks for a single Capability or GC thread, so that allocating a
+   small group doesn't have to take the lock on the global free list
+   (sm_mutex, or gc_alloc_block_sync during GC).  It is refilled a
+   batch at a time, by allocating one group big enough for the batch
+   and carving it up.
+
+   As far as the rest of the block allocator is concerned, cached
+   groups are allocated: they are counted in n_alloc_blocks, and
+   memInventory() has to count them separately.
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+void
+initBlockCache (BlockCache *cache, nat node)
+{
+    nat i;
+
+    cache->node = node;
+    for (i = 0; i < BLOCK_CACHE_MAX_BLOCKS; i++) {
+        cache->groups[i] = NULL;
+    }
+    cache->n_blocks = 0;
+    cache->hits     = 0;
+    cache->refills  = 0;
+}
+
+// Refill the cache with groups of n blocks.  The caller must hold
+// the lock on the global free list.
+void
+refillBlockCache (BlockCache *cache, nat n)
+{
+    bdescr *bd, *g;
+    nat i, groups;
+
+    ASSERT(n > 0 && n <= BLOCK_CACHE_MAX_BLOCKS);
+
+    groups = stg_max(1, BLOCK_CACHE_REFILL_BLOCKS / n);
+    bd = allocGroupOnNode(cache->node, groups * n);
+
+    for (i = 0; i < groups; i++) {
+        g = bd + i * n;
+        g->blocks = n;
+        initGroup(g);
+        g->link = cache->groups[n-1];
+        cache->groups[n-1] = g;
+    }
+    cache->n_blocks += groups * n;
+    cache->refills++;
+}
+
+// Return everything in the cache to the global free list.  The
+// caller must hold the lock on the global free list.
+void
+flushBlockCache (BlockCache *cache)
+{
+    nat i;
+
+    for (i = 0; i < BLOCK_CACHE_MAX_BLOCKS; i++) {
+        freeChain(cache->groups[i]);
+        cache->groups[i] = NULL;
+    }
+    cache->n_blocks = 0;
+}
+
+bdescr *
+allocGroupCached_lock (BlockCache *cache, nat n)
+{
+    bdescr *bd;
+
+    if (n > BLOCK_CACHE_MAX_BLOCKS) {
+        return allocGroupOnNode_lock(cache->node, n);
+    }
+
+    bd = takeCachedGroup(cache, n);
+    if (bd != NULL) {
+        cache->hits++;
+        return bd;
+    }
+
+    ACQUIRE_SM_LOCK;
+    refillBlockCache(cache, n);
+    RELEASE_SM_LOCK;
+    return takeCachedGroup(cache, n);
+}
+
+#endif /* THREADED_RTS */
+
+/* -----------------------------------------------------------------------------
+   Large object caches
+
+   A LargeCache holds the groups of large objects that died in the
+   last GC, by size, for one Capability.  Array-heavy code tends to
+   allocate objects of the same few sizes over and over, so allocate()
+   can often reuse one of these without taking sm_mutex, and without
+   splitting a group on the free list that freeGroup() has just
+   coalesced.  Whatever is still in the cache at the next GC wasn't
+   needed, and goes back to the free list.
+
+   Cached groups count as allocated, like those in a BlockCache.
+   -------------------------------------------------------------------------- */
+
+void
+initLargeCache (LargeCache *cache)
+{
+    nat i;
+
+    for (i = 0; i < LARGE_CACHE_MAX_BLOCKS; i++) {
+        cache->groups[i] = NULL;
+    }
+    cache->n_blocks = 0;
+    cache->hits     = 0;
+    cache->misses   = 0;
+}
+
+// Add a free group to the cache, if it is the right size and the
+// cache has room for it.  Called by the GC.
+rtsBool
+cacheLargeGroup (LargeCache *cache, bdescr *bd)
+{
+    nat n = bd->blocks;
+
+    if (n > LARGE_CACHE_MAX_BLOCKS ||
+        cache->n_blocks + n > LARGE_CACHE_LIMIT_BLOCKS) {
+        return rtsFalse;
+    }
+    bd->link = cache->groups[n-1];
+    cache->groups[n-1] = bd;
+    cache->n_blocks += n;
+    return rtsTrue;
+}
+
+// Return everything in the cache to the global free list.  The
+// caller must hold the lock on the global free list.
+void
+flushLargeCache (LargeCache *cache)
+{
+    nat i;
+
+    for (i = 0; i < LARGE_CACHE_MAX_BLOCKS; i++) {
+        freeChain(cache->groups[i]);
+        cache->groups[i] = NULL;
+    }
+    cache->n_blocks = 0;
+}
+
 /* -----------------------------------------------------------------------------
    De-Allocation
    -------------------------------------------------------------------------- */
@@ -429,7 +649,12 @@ coalesce_mblocks (bdescr *p)
         MBLOCK_ROUND_DOWN(q) == 
         (StgWord8*)MBLOCK_ROUND_DOWN(p) + 
         BLOCKS_TO_MBLOCKS(p->blocks) * MBLOCK_SIZE) {
-        // can coalesce
+        // can coalesce.  The result is only decommitted if both
+        // halves were.
+        if ((p->flags ^ q->flags) & BF_DECOMMITTED) {
+            recommit_mega_group(p);
+            recommit_mega_group(q);
+        }
         p->blocks  = MBLOCK_GROUP_BLOCKS(BLOCKS_TO_MBLOCKS(p->blocks) +
                                          BLOCKS_TO_MBLOCKS(q->blocks));
         p->link = q->link;
@@ -442,11 +667,16 @@ static void
 free_mega_group (bdescr *mg)
 {
     bdescr *bd, *prev;
+    nat node;
+
+    // The memory of a group we're freeing has been in use
+    mg->flags &= ~BF_DECOMMITTED;
 
     // Find the right place in the free list.  free_mblock_list is
     // sorted by *address*, not by size as the free_list is.
+    node = mg->node;
     prev = NULL;
-    bd = free_mblock_list;
+    bd = free_mblock_list[node];
     while (bd && bd->start < mg->start) {
         prev = bd;
         bd = bd->link;
@@ -461,8 +691,8 @@ free_mega_group (bdescr *mg)
     }
     else
     {
-        mg->link = free_mblock_list;
-        free_mblock_list = mg;
+        mg->link = free_mblock_list[node];
+        free_mblock_list[node] = mg;
     }
     // coalesce forwards
     coalesce_mblocks(mg);
@@ -474,7 +704,7 @@ free_mega_group (bdescr *mg)
 void
 freeGroup(bdescr *p)
 {
-  nat ln;
+  nat ln, node;
 
   // Todo: not true in multithreaded GC
   // ASSERT_SM_LOCK();
@@ -489,6 +719,8 @@ freeGroup(bdescr *p)
 
   if (p->blocks == 0) barf("freeGroup: block size is zero");
 
+  node = p->node;
+
   if (p->blocks >= BLOCKS_PER_MBLOCK)
   {
       nat mblocks;
@@ -513,8 +745,9 @@ freeGroup(bdescr *p)
       if (next <= LAST_BDESCR(MBLOCK_ROUND_DOWN(p)) && next->free == (P_)-1)
       {
           p->blocks += next->blocks;
+          ASSERT(next->node == node);
           ln = log_2(next->blocks);
-          dbl_link_remove(next, &free_list[ln]);
+          dbl_link_remove(next, &free_list[node][ln]);
           if (p->blocks == BLOCKS_PER_MBLOCK)
           {
               free_mega_group(p);
@@ -533,8 +766,9 @@ freeGroup(bdescr *p)
 
       if (prev->free == (P_)-1)
       {
+          ASSERT(prev->node == node);
           ln = log_2(prev->blocks);
-          dbl_link_remove(prev, &free_list[ln]);
+          dbl_link_remove(prev, &free_list[node][ln]);
           prev->blocks += p->blocks;
           if (prev->blocks >= BLOCKS_PER_MBLOCK)
           {
@@ -579,7 +813,7 @@ freeChain_lock(bdescr *bd)
 }
 
 static void
-initMBlock(void *mblock)
+initMBlock(void *mblock, nat node)
 {
     bdescr *bd;
     StgWord8 *block;
@@ -595,6 +829,7 @@ initMBlock(void *mblock)
     for (; block <= (StgWord8*)LAST_BLOCK(mblock); bd += 1, 
              block += BLOCK_SIZE) {
         bd->start = (void*)block;
+        bd->node  = node;
     }
 }
 
@@ -634,10 +869,32 @@ countAllocdBlocks(bdescr *bd)
 
 void returnMemoryToOS(nat n /* megablocks */)
 {
-    static bdescr *bd;
+    nat node;
+
+    // Take the free megablocks from each node in turn.
+    for (node = 0; node < MAX_NUMA_NODES && n > 0; node++) {
+        n = returnNodeMemoryToOS(node, n);
+    }
+
+    osReleaseFreeMemory();
+
+    IF_DEBUG(gc,
+        if (n != 0) {
+            debugBelch("Wanted to free %d more MBlocks than are freeable\n",
+                       n);
+        }
+    );
+}
+
+// Free up to n megablocks from the node's free list, and return the
+// number we still have to free.
+static nat
+returnNodeMemoryToOS(nat node, nat n)
+{
+    bdescr *bd;
     nat size;
 
-    bd = free_mblock_list;
+    bd = free_mblock_list[node];
     while ((n > 0) && (bd != NULL)) {
         size = BLOCKS_TO_MBLOCKS(bd->blocks);
         if (size > n) {
@@ -645,26 +902,69 @@ void returnMemoryToOS(nat n /* megablocks */)
             char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
             freeAddr += newSize * MBLOCK_SIZE;
             bd->blocks = MBLOCK_GROUP_BLOCKS(newSize);
+            if (bd->flags & BF_DECOMMITTED) {
+                decommitted_mblocks -= n;
+            }
             freeMBlocks(freeAddr, n);
             n = 0;
         }
         else {
             char *freeAddr = MBLOCK_ROUND_DOWN(bd->start);
+            recommit_mega_group(bd);
             n -= size;
             bd = bd->link;
             freeMBlocks(freeAddr, size);
         }
     }
-    free_mblock_list = bd;
+    free_mblock_list[node] = bd;
 
-    osReleaseFreeMemory();
+    return n;
+}
 
-    IF_DEBUG(gc,
-        if (n != 0) {
-            debugBelch("Wanted to free %d more MBlocks than are freeable\n",
-                       n);
+// Give the memory of free megablock groups back to the OS, keeping
+// (committed) the first groups on each free list up to a total of
+// 'retain' megablocks.  Groups are decommitted whole, so we may keep
+// a little less than 'retain'.
+void
+decommitFreeMemory (nat retain /* megablocks */)
+{
+    bdescr *bd;
+    nat node, size;
+    lnat kept, page_size;
+    StgWord8 *from, *to;
+
+    if (RtsFlags.GcFlags.decommit == DECOMMIT_NONE) return;
+
+    page_size = getPageSize();
+    kept = 0;
+
+    for (node = 0; node < MAX_NUMA_NODES; node++) {
+        for (bd = free_mblock_list[node]; bd != NULL; bd = bd->link) {
+            if (bd->flags & BF_DECOMMITTED) continue;
+
+            size = BLOCKS_TO_MBLOCKS(bd->blocks);
+            if (kept + size <= retain) {
+                kept += size;
+                continue;
+            }
+
+            // Keep the block descriptors of the first megablock: they
+            // hold the free list.
+            from = (StgWord8*)bd->start;
+            from = (StgWord8*)(((W_)from + page_size - 1) & ~(page_size - 1));
+            to   = (StgWord8*)MBLOCK_ROUND_DOWN(bd) + (W_)size * MBLOCK_SIZE;
+            osDecommitMemory(from, to - from,
+                             RtsFlags.GcFlags.decommit == DECOMMIT_LAZY);
+
+            bd->flags |= BF_DECOMMITTED;
+            decommitted_mblocks       += size;
+            total_decommitted_mblocks += size;
         }
-    );
+    }
+
+    IF_DEBUG(gc,
+             debugBelch("decommit: %ld free mblocks kept, %ld decommitted\n",
+                        (long)kept, (long)decommitted_mblocks));
 }
 
 /* -----------------------------------------------------------------------------
@@ -687,6 +987,24 @@ check_tail (bdescr *bd)
 
 void
 checkFreeListSanity(void)
+{
+    bdescr *bd;
+    nat node;
+    lnat decommitted = 0;
+
+    for (node = 0; node < MAX_NUMA_NODES; node++) {
+        checkNodeFreeListSanity(node);
+        for (bd = free_mblock_list[node]; bd != NULL; bd = bd->link) {
+            if (bd->flags & BF_DECOMMITTED) {
+                decommitted += BLOCKS_TO_MBLOCKS(bd->blocks);
+            }
+        }
+    }
+    ASSERT(decommitted == decommitted_mblocks);
+}
+
+static void
+checkNodeFreeListSanity(nat node)
 {
     bdescr *bd, *prev;
     nat ln, min;
@@ -697,12 +1015,13 @@ checkFreeListSanity(void)
         IF_DEBUG(block_alloc, debugBelch("free block list [%d]:\n", ln));
 
         prev = NULL;
-        for (bd = free_list[ln]; bd != NULL; prev = bd, bd = bd->link)
+        for (bd = free_list[node][ln]; bd != NULL; prev = bd, bd = bd->link)
         {
             IF_DEBUG(block_alloc,
                      debugBelch("group at %p, length %ld blocks\n", 
                                 bd->start, (long)bd->blocks));
             ASSERT(bd->free == (P_)-1);
+            ASSERT(bd->node == node);
             ASSERT(bd->blocks > 0 && bd->blocks < BLOCKS_PER_MBLOCK);
             ASSERT(bd->blocks >= min && bd->blocks <= (min*2 - 1));
             ASSERT(bd->link != bd); // catch easy loops
@@ -727,13 +1046,14 @@ checkFreeListSanity(void)
     }
 
     prev = NULL;
-    for (bd = free_mblock_list; bd != NULL; prev = bd, bd = bd->link)
+    for (bd = free_mblock_list[node]; bd != NULL; prev = bd, bd = bd->link)
     {
         IF_DEBUG(block_alloc,
                  debugBelch("mega group at %p, length %ld blocks\n", 
                             bd->start, (long)bd->blocks));
 
         ASSERT(bd->link != bd); // catch easy loops
+        ASSERT(bd->node == node);
 
         if (bd->link != NULL)
         {
@@ -760,19 +1080,21 @@ countFreeList(void)
 {
   bdescr *bd;
   lnat total_blocks = 0;
-  nat ln;
+  nat ln, node;
 
-  for (ln=0; ln < MAX_FREE_LIST; ln++) {
-      for (bd = free_list[ln]; bd != NULL; bd = bd->link) {
+  for (node = 0; node < MAX_NUMA_NODES; node++) {
+    for (ln=0; ln < MAX_FREE_LIST; ln++) {
+      for (bd = free_list[node][ln]; bd != NULL; bd = bd->link) {
           total_blocks += bd->blocks;
       }
-  }
-  for (bd = free_mblock_list; bd != NULL; bd = bd->link) {
+    }
+    for (bd = free_mblock_list[node]; bd != NULL; bd = bd->link) {
       total_blocks += BLOCKS_PER_MBLOCK * BLOCKS_TO_MBLOCKS(bd->blocks);
       // The caller of this function, memInventory(), expects to match
       // the total number of blocks in the system against mblocks *
       // BLOCKS_PER_MBLOCK, so we must subtract the space for the
       // block descriptors from *every* mblock.
+    }
   }
   return total_blocks;
 }
@@ -16,6 +16,7 @@
 extern nat countBlocks       (bdescr *bd);
 extern nat countAllocdBlocks (bdescr *bd);
 extern void returnMemoryToOS(nat n);
+extern void decommitFreeMemory(nat retain);
 
 #ifdef DEBUG
 void checkFreeListSanity(void);
@@ -27,6 +28,102 @@ void reportUnmarkedBlocks (void);
 extern lnat n_alloc_blocks;   // currently allocated blocks
 extern lnat hw_alloc_blocks;  // high-water allocated blocks
 
+extern lnat      decommitted_mblocks;       // free mblocks given back to the OS
+extern StgWord64 total_decommitted_mblocks; // ... cumulatively
+
+/* Block caches ------------------------------------------------------------ */
+
+#if defined(THREADED_RTS)
+
+// Groups of up to this many blocks are served from a BlockCache
+#define BLOCK_CACHE_MAX_BLOCKS    4
+
+// Roughly how many blocks a refill takes from the global free list
+#define BLOCK_CACHE_REFILL_BLOCKS 16
+
+typedef struct BlockCache_ {
+    bdescr *groups[BLOCK_CACHE_MAX_BLOCKS]; // groups[n-1]: groups of n blocks,
+                                            // linked through bd->link
+    nat     n_blocks;                       // total blocks in the cache
+    nat     node;                           // NUMA node to refill from
+    lnat    hits;                           // allocations served by the cache
+    lnat    refills;                        // trips to the global free list
+} BlockCache;
+
+void    initBlockCache        (BlockCache *cache, nat node);
+void    refillBlockCache      (BlockCache *cache, nat n);
+void    flushBlockCache       (BlockCache *cache);
+bdescr *allocGroupCached_lock (BlockCache *cache, nat n);
+
+// Take a group of n blocks from the cache, or return NULL if there
+// isn't one.  Only the owner of the cache may call this.
+INLINE_HEADER bdescr *
+takeCachedGroup (BlockCache *cache, nat n)
+{
+    bdescr *bd;
+
+    bd = cache->groups[n-1];
+    if (bd != NULL) {
+        cache->groups[n-1] = bd->link;
+        cache->n_blocks -= n;
+        bd->link = NULL;
+    }
+    return bd;
+}
+
+#define allocGroupOnCap_lock(cap,n) allocGroupCached_lock(&(cap)->block_cache,n)
+
+#else
+
+#define allocGroupOnCap_lock(cap,n) allocGroupOnNode_lock((cap)->node,n)
+
+#endif
+
+#define allocBlockOnCap_lock(cap) allocGroupOnCap_lock(cap,1)
+
+/* Large object caches ----------------------------------------------------- */
+
+// The groups of dead large objects of up to this many blocks are kept
+// in a LargeCache for allocate() to reuse
+#define LARGE_CACHE_MAX_BLOCKS   16
+
+// The most blocks that one LargeCache holds
+#define LARGE_CACHE_LIMIT_BLOCKS 256
+
+typedef struct LargeCache_ {
+    bdescr *groups[LARGE_CACHE_MAX_BLOCKS]; // groups[n-1]: groups of n blocks,
+                                            // linked through bd->link
+    nat     n_blocks;                       // total blocks in the cache
+    lnat    hits;                           // large objects served by the cache
+    lnat    misses;                         // ... and not
+} LargeCache;
+
+void    initLargeCache  (LargeCache *cache);
+rtsBool cacheLargeGroup (LargeCache *cache, bdescr *bd);
+void    flushLargeCache (LargeCache *cache);
+
+// Take a group of n blocks from the cache, or return NULL if there
+// isn't one.  Only the owner of the cache may call this.
+INLINE_HEADER bdescr *
+takeLargeGroup (LargeCache *cache, nat n)
+{
+    bdescr *bd;
+
+    if (n > LARGE_CACHE_MAX_BLOCKS) {
+        return NULL;
+    }
+    bd = cache->groups[n-1];
+    if (bd != NULL) {
+        cache->groups[n-1] = bd->link;
+        cache->n_blocks -= n;
+        bd->link = NULL;
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+    return bd;
+}
+
 #include "EndPrivate.h"
 
 #endif /* BLOCK_ALLOC_H */
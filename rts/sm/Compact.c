@@ -26,6 +26,7 @@
 #include "Weak.h"
 #include "MarkWeak.h"
 #include "Stable.h"
+#include "STM.h"
 
 // Turn off inlining when debugging - it obfuscates things
 #ifdef DEBUG
@@ -945,6 +946,8 @@ compact(StgClosure *static_objects)
 
     markScheduler((evac_fn)thread_root, NULL);
 
+    markSTM((evac_fn)thread_root, NULL);
+
     // the weak pointer lists...
     if (weak_ptr_list != NULL) {
 	thread((void *)&weak_ptr_list);
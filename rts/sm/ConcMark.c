@@ -0,0 +1,882 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2012
+ *
+ * Marking the oldest generation concurrently with the mutator.
+ *
+ * Documentation on the architecture of the Garbage Collector can be
+ * found in the online commentary:
+ *
+ *   http://hackage.haskell.org/trac/ghc/wiki/Commentary/Rts/Storage/GC
+ *
+ * ---------------------------------------------------------------------------*/
+
+/* Overview
+ * --------
+ *
+ * With +RTS --concurrent-mark, a GC that would collect the oldest
+ * generation collects everything else instead, and starts a
+ * concurrent mark of the oldest generation: the blocks and large
+ * objects of the oldest generation as they are at that point form the
+ * "snapshot", and a marker thread traces the snapshot while the
+ * program carries on running.  A later minor GC finishes the mark and
+ * sweeps the snapshot, freeing the blocks with nothing marked in them,
+ * in the same way as sweep() does for the mark/sweep collector.
+ *
+ * The mark is an incremental-update mark that relies on the write
+ * barrier we already have for generational GC, rather than a
+ * snapshot-at-the-beginning barrier (which would need the code
+ * generator to record overwritten pointers):
+ *
+ *   - anything allocated into the oldest generation during the mark
+ *     (promotion by minor GCs) is outside the snapshot, and therefore
+ *     implicitly live;
+ *
+ *   - every GC during the mark greys each snapshot object and each
+ *     static object that it evacuates (see evacuate()).  This covers
+ *     the roots, everything reachable from the younger generations,
+ *     and - because an old object that has been written to is always
+ *     on a mutable list - the pointers that the mutator has stored
+ *     into old objects since the last GC;
+ *
+ *   - the GC that finishes the mark collects every generation except
+ *     the oldest, so that everything outside the snapshot is traced,
+ *     and it drains the grey stack completely before sweeping.
+ *
+ * Greying sets the object's bit in a mark bitmap, as for the
+ * compacting collector (or BF_SNAPSHOT_MARKED for a large object) and
+ * pushes it on conc_grey_stack.  Static objects cannot be marked
+ * through their static link field, because newCAF() writes that field
+ * while the marker is running, so we keep the statics we have visited
+ * in a hash table instead.
+ *
+ * The marker thread only scans objects whose layout cannot change
+ * under its feet; anything else (threads, stacks, STM records, PAPs,
+ * ...) goes on conc_deferred_stack, and the next GC scans it.  The
+ * marker thread never runs at the same time as a GC: GarbageCollect()
+ * pauses it first.
+ *
+ * Things that we cannot tell are dead without a full trace - the keys
+ * of weak pointers, stable names, sparks and threads in the oldest
+ * generation - are kept until the next major GC.  As a result a
+ * concurrent cycle never finds threads to be deadlocked either.
+ *
+ * A major GC (e.g. performGC, or when the heap has grown past twice
+ * its target size while a mark was running) abandons a mark in
+ * progress and collects the oldest generation in the usual way.
+ */
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Storage.h"
+#include "RtsUtils.h"
+#include "BlockAlloc.h"
+#include "Capability.h"
+#include "Hash.h"
+#include "Stable.h"
+#include "Trace.h"
+#include "Weak.h"
+#include "GC.h"
+#include "GCThread.h"
+#include "GCTDecl.h"
+#include "GCUtils.h"
+#include "Compact.h"
+#include "MarkStack.h"
+#include "ConcMark.h"
+
+#include <string.h> // for memset()
+
+rtsBool conc_mark_active    = rtsFalse;
+rtsBool conc_mark_finishing = rtsFalse;
+
+MarkStack conc_grey_stack;
+MarkStack conc_deferred_stack;
+
+nat conc_mark_cycles    = 0;
+nat conc_mark_abandoned = 0;
+
+// the mark bitmap for the blocks in the snapshot
+static bdescr *conc_mark_bitmap = NULL;
+
+// static objects that have been greyed in this cycle
+static HashTable *conc_statics = NULL;
+
+// set when the current GC starts a concurrent mark
+static rtsBool conc_mark_starting = rtsFalse;
+
+// a concurrent cycle left the oldest generation too big or too
+// fragmented: make the next collection of the oldest generation a
+// major GC.
+static rtsBool conc_mark_want_major = rtsFalse;
+
+#if defined(THREADED_RTS)
+
+typedef enum {
+    MARKER_IDLE,        // no mark in progress
+    MARKER_MARKING,     // the marker thread has work to do
+    MARKER_DONE,        // the grey stack is empty
+    MARKER_EXITING      // the RTS is shutting down
+} MarkerState;
+
+// Protects the mark bitmap and the grey stack while a parallel GC is
+// greying objects.
+static SpinLock conc_mark_sync;
+
+// Held by the marker thread while it is marking, and by
+// GarbageCollect() for the duration of a GC.
+static Mutex     conc_mark_mutex;
+static Condition conc_mark_cond;
+
+static MarkerState marker_state = MARKER_IDLE;
+static rtsBool     marker_started = rtsFalse;
+
+// A GC is waiting for the marker thread to stop.
+static volatile rtsBool gc_waiting = rtsFalse;
+
+#endif
+
+/* -----------------------------------------------------------------------------
+   Greying
+   -------------------------------------------------------------------------- */
+
+STATIC_INLINE rtsBool
+is_grey (StgClosure *q, bdescr *bd)
+{
+    if (bd->flags & BF_LARGE) {
+        return (bd->flags & BF_SNAPSHOT_MARKED) != 0;
+    } else {
+        return is_marked((P_)q, bd) != 0;
+    }
+}
+
+STATIC_INLINE void
+set_grey (StgClosure *q, bdescr *bd)
+{
+    if (bd->flags & BF_LARGE) {
+        bd->flags |= BF_SNAPSHOT_MARKED;
+    } else {
+        mark((P_)q, bd);
+    }
+}
+
+// q is an (untagged) object in a BF_SNAPSHOT block.  Called by
+// evacuate(), possibly from several GC threads at once.
+void
+concMarkGrey (StgClosure *q, bdescr *bd)
+{
+    // bits are only ever set during the mark, so a set bit can be
+    // trusted without taking the lock.
+    if (is_grey(q, bd)) return;
+
+    ACQUIRE_SPIN_LOCK(&conc_mark_sync);
+    if (!is_grey(q, bd)) {
+        set_grey(q, bd);
+        push_mark_stack_on(&conc_grey_stack, (StgPtr)q);
+    }
+    RELEASE_SPIN_LOCK(&conc_mark_sync);
+}
+
+// Static objects with no pointers to follow are not worth recording.
+STATIC_INLINE rtsBool
+static_needs_grey (const StgInfoTable *info)
+{
+    switch (info->type) {
+    case THUNK_STATIC:
+    case FUN_STATIC:
+        return info->srt_bitmap != 0;
+    case IND_STATIC:
+    case CONSTR_STATIC:
+        return rtsTrue;
+    case WHITEHOLE:
+        // a CAF that is being entered; it will be an IND_STATIC by
+        // the time we look at it again.
+        return rtsTrue;
+    default:
+        return rtsFalse;
+    }
+}
+
+void
+concMarkGreyStatic (StgClosure *q)
+{
+    if (!static_needs_grey(get_itbl(q))) return;
+
+    ACQUIRE_SPIN_LOCK(&conc_mark_sync);
+    if (lookupHashTable(conc_statics, (StgWord)q) == NULL) {
+        insertHashTable(conc_statics, (StgWord)q, q);
+        push_mark_stack_on(&conc_grey_stack, (StgPtr)q);
+    }
+    RELEASE_SPIN_LOCK(&conc_mark_sync);
+}
+
+static void
+grey_ptr (StgClosure *p)
+{
+    StgClosure *q;
+    bdescr *bd;
+
+    q = UNTAG_CLOSURE(p);
+    if (q == NULL) return;
+
+    if (!HEAP_ALLOCED(q)) {
+        concMarkGreyStatic(q);
+    } else {
+        bd = Bdescr((P_)q);
+        if (bd->flags & BF_SNAPSHOT) {
+            concMarkGrey(q, bd);
+        }
+    }
+}
+
+static void
+grey_root (void *user STG_UNUSED, StgClosure **root)
+{
+    grey_ptr(*root);
+}
+
+/* -----------------------------------------------------------------------------
+   The marker thread
+   -------------------------------------------------------------------------- */
+
+#if defined(THREADED_RTS)
+
+// The marker thread runs alongside the mutator, so it cannot use
+// allocBlock_sync() when a push runs off the end of a block.  Instead
+// it links a fresh block on above the current one before any push
+// that would need it.
+static void
+reserve_mark_stack (MarkStack *ms)
+{
+    bdescr *bd;
+
+    if (ms->bd->u.back == NULL && ((W_)(ms->sp + 1) & BLOCK_MASK) == 0) {
+        bd = allocBlock_lock();
+        bd->link = ms->bd;
+        bd->u.back = NULL;
+        ms->bd->u.back = bd;
+        ms->top_bd = bd;
+    }
+}
+
+static void
+mark_ptr (StgClosure *p)
+{
+    reserve_mark_stack(&conc_grey_stack);
+    grey_ptr(p);
+}
+
+// Leave p for the next GC to scan.
+static void
+defer (StgClosure *p)
+{
+    reserve_mark_stack(&conc_deferred_stack);
+    push_mark_stack_on(&conc_deferred_stack, (StgPtr)p);
+}
+
+static void
+mark_large_srt_bitmap (StgLargeSRT *large_srt)
+{
+    nat i, b, size;
+    StgWord bitmap;
+    StgClosure **p;
+
+    b = 0;
+    bitmap = large_srt->l.bitmap[b];
+    size   = (nat)large_srt->l.size;
+    p      = (StgClosure **)large_srt->srt;
+    for (i = 0; i < size; ) {
+        if ((bitmap & 1) != 0) {
+            mark_ptr(*p);
+        }
+        i++;
+        p++;
+        if (i % BITS_IN(W_) == 0) {
+            b++;
+            bitmap = large_srt->l.bitmap[b];
+        } else {
+            bitmap = bitmap >> 1;
+        }
+    }
+}
+
+static void
+mark_srt (StgClosure **srt, nat srt_bitmap)
+{
+    nat bitmap;
+
+    if (srt_bitmap == (StgHalfWord)(-1)) {
+        mark_large_srt_bitmap((StgLargeSRT *)srt);
+        return;
+    }
+
+    for (bitmap = srt_bitmap; bitmap != 0; bitmap >>= 1, srt++) {
+        if ((bitmap & 1) != 0) {
+#if defined(COMPILING_WINDOWS_DLL)
+            // see scavenge_srt()
+            if ((lnat)(*srt) & 0x1) {
+                mark_ptr(*(StgClosure **)((lnat)(*srt) & ~0x1));
+                continue;
+            }
+#endif
+            mark_ptr(*srt);
+        }
+    }
+}
+
+static void
+mark_thunk_srt (const StgInfoTable *info)
+{
+    StgThunkInfoTable *thunk_info = itbl_to_thunk_itbl(info);
+    mark_srt((StgClosure **)GET_SRT(thunk_info), thunk_info->i.srt_bitmap);
+}
+
+static void
+mark_fun_srt (const StgInfoTable *info)
+{
+    StgFunInfoTable *fun_info = itbl_to_fun_itbl(info);
+    mark_srt((StgClosure **)GET_FUN_SRT(fun_info), fun_info->i.srt_bitmap);
+}
+
+static void
+mark_payload (StgClosure **p, StgClosure **end)
+{
+    for (; p < end; p++) {
+        mark_ptr(*p);
+    }
+}
+
+// Scan one grey object.  The mutator may be updating the object while
+// we look at it, so read the info pointer once, before the fields.
+// Any pointer that the mutator stores into an old object puts the
+// object on a mutable list, so the next GC will look at it again.
+static void
+mark_object (StgClosure *p)
+{
+    const StgInfoTable *info;
+
+    info = get_itbl(p);
+    load_load_barrier();
+
+    if (!HEAP_ALLOCED(p)) {
+        switch (info->type) {
+
+        case THUNK_STATIC:
+            mark_thunk_srt(info);
+            return;
+
+        case FUN_STATIC:
+            mark_fun_srt(info);
+            return;
+
+        case IND_STATIC:
+            mark_ptr(((StgInd *)p)->indirectee);
+            return;
+
+        case CONSTR_STATIC:
+            mark_payload(p->payload, p->payload + info->layout.payload.ptrs);
+            return;
+
+        default:
+            defer(p);
+            return;
+        }
+    }
+
+    switch (info->type) {
+
+    case THUNK:
+    case THUNK_1_0:
+    case THUNK_0_1:
+    case THUNK_1_1:
+    case THUNK_0_2:
+    case THUNK_2_0:
+        mark_thunk_srt(info);
+        mark_payload(((StgThunk *)p)->payload,
+                     ((StgThunk *)p)->payload + info->layout.payload.ptrs);
+        return;
+
+    case FUN:
+    case FUN_1_0:
+    case FUN_0_1:
+    case FUN_1_1:
+    case FUN_0_2:
+    case FUN_2_0:
+        mark_fun_srt(info);
+        mark_payload(p->payload, p->payload + info->layout.payload.ptrs);
+        return;
+
+    case CONSTR:
+    case CONSTR_1_0:
+    case CONSTR_0_1:
+    case CONSTR_1_1:
+    case CONSTR_0_2:
+    case CONSTR_2_0:
+    case WEAK:
+    case PRIM:
+    case MUT_PRIM:
+    case IND_PERM:
+        mark_payload(p->payload, p->payload + info->layout.payload.ptrs);
+        return;
+
+    case THUNK_SELECTOR:
+        mark_ptr(((StgSelector *)p)->selectee);
+        return;
+
+    case IND:
+    case BLACKHOLE:
+        mark_ptr(((StgInd *)p)->indirectee);
+        return;
+
+    case MUT_VAR_CLEAN:
+    case MUT_VAR_DIRTY:
+        mark_ptr(((StgMutVar *)p)->var);
+        return;
+
+    case MVAR_CLEAN:
+    case MVAR_DIRTY:
+        mark_ptr((StgClosure *)((StgMVar *)p)->head);
+        mark_ptr((StgClosure *)((StgMVar *)p)->tail);
+        mark_ptr(((StgMVar *)p)->value);
+        return;
+
+    case MUT_ARR_PTRS_CLEAN:
+    case MUT_ARR_PTRS_DIRTY:
+    case MUT_ARR_PTRS_FROZEN:
+    case MUT_ARR_PTRS_FROZEN0:
+    {
+        StgMutArrPtrs *a = (StgMutArrPtrs *)p;
+        mark_payload(a->payload, a->payload + a->ptrs);
+        return;
+    }
+
+    case ARR_WORDS:
+        return;
+
+    default:
+        // TSO, STACK, TREC_CHUNK, BLOCKING_QUEUE, AP, PAP, AP_STACK,
+        // BCO, and anything that is locked (WHITEHOLE).
+        defer(p);
+        return;
+    }
+}
+
+static void OSThreadProcAttr
+concMarkerThread (void *arg STG_UNUSED)
+{
+    StgPtr p;
+
+    ACQUIRE_LOCK(&conc_mark_mutex);
+    for (;;) {
+        while (marker_state != MARKER_MARKING || gc_waiting) {
+            if (marker_state == MARKER_EXITING) {
+                RELEASE_LOCK(&conc_mark_mutex);
+                return;
+            }
+            waitCondition(&conc_mark_cond, &conc_mark_mutex);
+        }
+
+        while (!gc_waiting) {
+            p = pop_mark_stack_from(&conc_grey_stack);
+            if (p == NULL) {
+                marker_state = MARKER_DONE;
+                break;
+            }
+            mark_object((StgClosure *)p);
+        }
+    }
+}
+
+#endif /* THREADED_RTS */
+
+/* -----------------------------------------------------------------------------
+   Initialisation and shutdown
+   -------------------------------------------------------------------------- */
+
+void
+initConcMark (void)
+{
+#if defined(THREADED_RTS)
+    initSpinLock(&conc_mark_sync);
+    initMutex(&conc_mark_mutex);
+    initCondition(&conc_mark_cond);
+#endif
+}
+
+void
+exitConcMark (void)
+{
+#if defined(THREADED_RTS)
+    if (!marker_started) return;
+
+    gc_waiting = rtsTrue;
+    ACQUIRE_LOCK(&conc_mark_mutex);
+    marker_state = MARKER_EXITING;
+    broadcastCondition(&conc_mark_cond);
+    RELEASE_LOCK(&conc_mark_mutex);
+#endif
+    if (conc_statics != NULL) {
+        freeHashTable(conc_statics, NULL);
+        conc_statics = NULL;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Called by GarbageCollect()
+   -------------------------------------------------------------------------- */
+
+// Stop the marker thread for the duration of a GC.  This must happen
+// before the GC takes sm_mutex, because the marker thread allocates
+// blocks for its mark stacks with allocBlock_lock().
+void
+concMarkPause (void)
+{
+#if defined(THREADED_RTS)
+    if (!RtsFlags.GcFlags.concurrentMark) return;
+
+    gc_waiting = rtsTrue;
+    ACQUIRE_LOCK(&conc_mark_mutex);
+#endif
+}
+
+void
+concMarkResume (void)
+{
+#if defined(THREADED_RTS)
+    if (!RtsFlags.GcFlags.concurrentMark) return;
+
+    gc_waiting = rtsFalse;
+    if (conc_mark_active) {
+        // the GC may have greyed more objects
+        marker_state = MARKER_MARKING;
+        signalCondition(&conc_mark_cond);
+    }
+    RELEASE_LOCK(&conc_mark_mutex);
+#endif
+}
+
+/* Decide which generation to collect, given that the usual policy
+ * picked N.  A collection of the oldest generation turns into a
+ * collection of the others, which either starts a concurrent mark, or
+ * finishes one if the marker thread has run out of work or the old
+ * generation has grown to twice its target size.
+ */
+nat
+concMarkSelectGen (nat N, rtsBool force_major_gc)
+{
+    nat oldest = RtsFlags.GcFlags.generations - 1;
+    lnat blocks;
+
+    conc_mark_starting  = rtsFalse;
+    conc_mark_finishing = rtsFalse;
+
+    if (!RtsFlags.GcFlags.concurrentMark || oldest == 0 || oldest_gen->mark) {
+        return N;
+    }
+
+    if (N == oldest) {
+        if (force_major_gc || conc_mark_want_major) {
+            // GarbageCollect() abandons any mark in progress
+            conc_mark_want_major = rtsFalse;
+            return N;
+        }
+        if (!conc_mark_active) {
+            conc_mark_starting = rtsTrue;
+            return oldest - 1;
+        }
+        blocks = oldest_gen->n_words / BLOCK_SIZE_W
+               + oldest_gen->n_large_blocks;
+        if (blocks >= 2 * oldest_gen->max_blocks) {
+            conc_mark_finishing = rtsTrue;
+        }
+        N = oldest - 1;
+    }
+
+#if defined(THREADED_RTS)
+    if (conc_mark_active && marker_state == MARKER_DONE) {
+        conc_mark_finishing = rtsTrue;
+    }
+#endif
+
+    // Finishing the mark needs everything outside the snapshot to be
+    // traced.
+    if (conc_mark_finishing) {
+        N = oldest - 1;
+    }
+
+    return N;
+}
+
+rtsBool
+concMarkStarting (void)
+{
+    return conc_mark_starting;
+}
+
+// Take a snapshot of the oldest generation.  The GC calling this has
+// already retired its workspace blocks for the oldest generation onto
+// oldest_gen->blocks.
+void
+concMarkStart (void)
+{
+    generation *gen = oldest_gen;
+    bdescr *bd;
+    StgWord *bitmap;
+    lnat bitmap_size; // in bytes
+
+    ASSERT(!conc_mark_active);
+
+    bitmap_size = gen->n_blocks * BLOCK_SIZE / (sizeof(W_)*BITS_PER_BYTE);
+
+    bitmap = NULL;
+    conc_mark_bitmap = NULL;
+    if (bitmap_size > 0) {
+        conc_mark_bitmap = allocGroup((lnat)BLOCK_ROUND_UP(bitmap_size)
+                                      / BLOCK_SIZE);
+        bitmap = conc_mark_bitmap->start;
+        memset(bitmap, 0, bitmap_size);
+    }
+
+    for (bd = gen->blocks; bd != NULL; bd = bd->link) {
+        bd->u.bitmap = bitmap;
+        bitmap += BLOCK_SIZE_W / (sizeof(W_)*BITS_PER_BYTE);
+        bd->flags |= BF_SNAPSHOT;
+    }
+
+    for (bd = gen->large_objects; bd != NULL; bd = bd->link) {
+        bd->flags = (bd->flags | BF_SNAPSHOT) & ~BF_SNAPSHOT_MARKED;
+    }
+
+    init_mark_stack(&conc_grey_stack, allocBlock());
+    init_mark_stack(&conc_deferred_stack, allocBlock());
+    conc_statics = allocHashTable();
+
+    conc_mark_active = rtsTrue;
+
+#if defined(THREADED_RTS)
+    if (!marker_started) {
+        OSThreadId tid;
+        if (createOSThread(&tid, concMarkerThread, NULL) != 0) {
+            barf("concMarkStart: failed to create the marker thread");
+        }
+        marker_started = rtsTrue;
+    }
+    marker_state = MARKER_MARKING;
+#endif
+
+    debugTrace(DEBUG_gc, "concurrent mark: starting, %ld blocks and %ld large blocks in the snapshot",
+               (long)gen->n_blocks, (long)gen->n_large_blocks);
+}
+
+static void
+free_mark_state (void)
+{
+    freeChain(conc_grey_stack.top_bd);
+    freeChain(conc_deferred_stack.top_bd);
+    conc_grey_stack.bd = NULL;
+    conc_deferred_stack.bd = NULL;
+
+    if (conc_mark_bitmap != NULL) {
+        freeGroup(conc_mark_bitmap);
+        conc_mark_bitmap = NULL;
+    }
+
+    freeHashTable(conc_statics, NULL);
+    conc_statics = NULL;
+
+    conc_mark_active = rtsFalse;
+#if defined(THREADED_RTS)
+    marker_state = MARKER_IDLE;
+#endif
+}
+
+// A major GC is about to collect the oldest generation: drop the mark
+// in progress.
+void
+concMarkAbandon (void)
+{
+    bdescr *bd;
+
+    if (!conc_mark_active) return;
+
+    for (bd = oldest_gen->blocks; bd != NULL; bd = bd->link) {
+        bd->flags &= ~BF_SNAPSHOT;
+    }
+    for (bd = oldest_gen->large_objects; bd != NULL; bd = bd->link) {
+        bd->flags &= ~(BF_SNAPSHOT | BF_SNAPSHOT_MARKED);
+    }
+
+    free_mark_state();
+    conc_mark_abandoned++;
+
+    debugTrace(DEBUG_gc, "concurrent mark: abandoned");
+}
+
+// Grey the things that we don't know how to find dead in a concurrent
+// cycle (see the overview above).  Called before the finishing GC
+// marks its roots.
+void
+concMarkFinishRoots (void)
+{
+    StgWeak *w, *next;
+    StgTSO *t;
+
+    for (w = weak_ptr_list; w != NULL; w = next) {
+        if (w->header.info == &stg_DEAD_WEAK_info) {
+            next = (StgWeak *)((StgDeadWeak *)w)->link;
+            continue;
+        }
+        grey_ptr(w->key);
+        next = w->link;
+    }
+
+    for (t = oldest_gen->threads; t != END_TSO_QUEUE; t = t->global_link) {
+        grey_ptr((StgClosure *)t);
+    }
+
+    markStableNameTable(grey_root, NULL);
+
+    traverseSparkQueues(grey_root, NULL);
+}
+
+// Drop the unmarked objects in the snapshot from a mutable list.  A
+// dead object on a mutable list could point into blocks that the sweep
+// is about to free.  (The list may also contain CAFs; see newCAF().)
+static void
+filter_mut_list (bdescr *mut_list)
+{
+    bdescr *bd;
+    StgPtr p, q;
+    bdescr *obd;
+
+    for (bd = mut_list; bd != NULL; bd = bd->link) {
+        q = bd->start;
+        for (p = bd->start; p < bd->free; p++) {
+            if (HEAP_ALLOCED((P_)*p)) {
+                obd = Bdescr((P_)*p);
+                if ((obd->flags & BF_SNAPSHOT) &&
+                    !is_grey((StgClosure *)*p, obd)) {
+                    continue;
+                }
+            }
+            *q++ = *p;
+        }
+        bd->free = q;
+    }
+}
+
+// The grey stack is empty and the finishing GC has done all its
+// evacuation: free what the mark did not reach.
+void
+concMarkSweep (void)
+{
+    generation *gen = oldest_gen;
+    bdescr *bd, *prev, *next;
+    nat i, n;
+    lnat live, resid, blocks, freed, fragd, large_freed;
+
+    ASSERT(conc_mark_active);
+    ASSERT(mark_stack_is_empty(&conc_grey_stack));
+
+    for (n = 0; n < n_capabilities; n++) {
+        filter_mut_list(capabilities[n].mut_lists[gen->no]);
+    }
+
+    live = 0;
+    blocks = 0;
+    freed = 0;
+    fragd = 0;
+    prev = NULL;
+    for (bd = gen->blocks; bd != NULL; bd = next)
+    {
+        next = bd->link;
+
+        if (!(bd->flags & BF_SNAPSHOT)) {
+            // allocated during the mark
+            live += bd->free - bd->start;
+            prev = bd;
+            continue;
+        }
+
+        bd->flags &= ~BF_SNAPSHOT;
+        blocks++;
+
+        resid = 0;
+        for (i = 0; i < BLOCK_SIZE_W / BITS_IN(W_); i++)
+        {
+            if (bd->u.bitmap[i] != 0) resid++;
+        }
+        live += resid * BITS_IN(W_);
+
+        if (resid == 0)
+        {
+            freed++;
+            gen->n_blocks -= bd->blocks;
+            gen->n_words  -= bd->free - bd->start;
+            if (prev == NULL) {
+                gen->blocks = next;
+            } else {
+                prev->link = next;
+            }
+            freeGroup(bd);
+        }
+        else
+        {
+            prev = bd;
+            if (resid < (BLOCK_SIZE_W * 3) / (BITS_IN(W_) * 4)) {
+                fragd++;
+                bd->flags |= BF_FRAGMENTED;
+            }
+            bd->flags |= BF_SWEPT;
+        }
+    }
+
+    large_freed = 0;
+    for (bd = gen->large_objects; bd != NULL; bd = next)
+    {
+        next = bd->link;
+
+        if ((bd->flags & BF_SNAPSHOT) && !(bd->flags & BF_SNAPSHOT_MARKED)) {
+            dbl_link_remove(bd, &gen->large_objects);
+            gen->n_large_blocks -= bd->blocks;
+            large_freed += bd->blocks;
+            freeGroup(bd);
+        } else {
+            bd->flags &= ~(BF_SNAPSHOT | BF_SNAPSHOT_MARKED);
+        }
+    }
+
+    free_mark_state();
+
+    gen->live_estimate = live;
+    conc_mark_cycles++;
+
+    // If the cycle didn't get the oldest generation back under its
+    // target size, or left it badly fragmented, do a major GC next
+    // time instead.
+    if (gen->n_words / BLOCK_SIZE_W + gen->n_large_blocks >= gen->max_blocks
+        || (blocks - freed) < 2 * fragd) {
+        conc_mark_want_major = rtsTrue;
+    }
+
+    debugTrace(DEBUG_gc, "concurrent mark: swept %ld blocks, %ld freed, %ld fragmented, %ld large blocks freed, live estimate: %ld words",
+               (long)blocks, (long)freed, (long)fragd, (long)large_freed, (long)live);
+
+    ASSERT(countBlocks(gen->blocks) == gen->n_blocks);
+}
+
+// Blocks used by the mark stacks and the bitmap, for memInventory().
+lnat
+concMarkBlocks (void)
+{
+    lnat n = 0;
+
+    if (!conc_mark_active) return 0;
+
+    n += countBlocks(conc_grey_stack.top_bd);
+    n += countBlocks(conc_deferred_stack.top_bd);
+    if (conc_mark_bitmap != NULL) {
+        n += conc_mark_bitmap->blocks;
+    }
+    return n;
+}
@@ -0,0 +1,56 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2012
+ *
+ * Marking the oldest generation concurrently with the mutator.
+ *
+ * Documentation on the architecture of the Garbage Collector can be
+ * found in the online commentary:
+ *
+ *   http://hackage.haskell.org/trac/ghc/wiki/Commentary/Rts/Storage/GC
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_CONCMARK_H
+#define SM_CONCMARK_H
+
+#include "BeginPrivate.h"
+
+// A concurrent mark of the oldest generation is in progress: while
+// this is set, every GC greys the old objects and the static objects
+// it comes across (see evacuate()).
+extern rtsBool conc_mark_active;
+
+// The current GC is going to finish the concurrent mark.
+extern rtsBool conc_mark_finishing;
+
+// Objects that have been greyed but not yet scanned, and objects that
+// the marker thread left for the next GC to scan.
+extern struct MarkStack_ conc_grey_stack;
+extern struct MarkStack_ conc_deferred_stack;
+
+// Statistics
+extern nat conc_mark_cycles;
+extern nat conc_mark_abandoned;
+
+void    initConcMark        (void);
+void    exitConcMark        (void);
+
+void    concMarkPause       (void);
+void    concMarkResume      (void);
+
+nat     concMarkSelectGen   (nat N, rtsBool force_major_gc);
+rtsBool concMarkStarting    (void);
+void    concMarkStart       (void);
+void    concMarkAbandon     (void);
+void    concMarkFinishRoots (void);
+void    concMarkSweep       (void);
+
+void    concMarkGrey        (StgClosure *q, bdescr *bd);
+void    concMarkGreyStatic  (StgClosure *q);
+
+lnat    concMarkBlocks      (void);
+
+#include "EndPrivate.h"
+
+#endif /* SM_CONCMARK_H */
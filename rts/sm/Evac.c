@@ -22,6 +22,8 @@
 #include "GCUtils.h"
 #include "Compact.h"
 #include "MarkStack.h"
+#include "ConcMark.h"
+#include "Pinned.h"
 #include "Prelude.h"
 #include "Trace.h"
 #include "LdvProfile.h"
@@ -372,7 +374,10 @@ loop:
 
   if (!HEAP_ALLOCED_GC(q)) {
 
-      if (!major_gc) return;
+      if (!major_gc) {
+          if (conc_mark_active) concMarkGreyStatic(q);
+          return;
+      }
 
       info = get_itbl(q);
       switch (info->type) {
@@ -483,12 +488,24 @@ loop:
 	      gct->failed_to_evac = rtsTrue;
 	      TICK_GC_FAILED_PROMOTION();
 	  }
+          // An old object that a concurrent mark has to know about;
+          // see ConcMark.c.
+          if (bd->flags & BF_SNAPSHOT) {
+              concMarkGrey(q, bd);
+          }
+          // One of several objects in a pinned block: see Pinned.c.
+          if (bd->flags & BF_PINNED_MARKS) {
+              markPinnedObject(q, bd);
+          }
 	  return;
       }
 
       /* evacuate large objects by re-linking them onto a different list.
        */
       if (bd->flags & BF_LARGE) {
+          if (bd->flags & BF_PINNED_MARKS) {
+              markPinnedObject(q, bd);
+          }
           evacuate_large((P_)q);
 	  return;
       }
@@ -844,6 +861,9 @@ selector_chain:
                 gct->failed_to_evac = rtsTrue;
                 TICK_GC_FAILED_PROMOTION();
             }
+            if (evac && (bd->flags & BF_SNAPSHOT)) {
+                concMarkGrey((StgClosure *)p, bd);
+            }
             return;
         }
         // we don't update THUNK_SELECTORS in the compacted
@@ -37,6 +37,7 @@
 #include "RaiseAsync.h"
 #include "Papi.h"
 #include "Stable.h"
+#include "GetTime.h"
 
 #include "GC.h"
 #include "GCThread.h"
@@ -46,9 +47,12 @@
 #include "Scav.h"
 #include "GCUtils.h"
 #include "MarkStack.h"
+#include "ConcMark.h"
+#include "Pinned.h"
 #include "MarkWeak.h"
 #include "Sparks.h"
 #include "Sweep.h"
+#include "OSMem.h"
 
 #include <string.h> // for memset()
 #include <unistd.h>
@@ -110,6 +114,8 @@ nat mutlist_MUTVARS,
     mutlist_MUTARRS,
     mutlist_MVARS,
     mutlist_OTHERS;
+lnat mutlist_CARDS,             // cards in the arrays on the mutable lists
+     mutlist_DIRTY_CARDS;       // ... and those we had to scan
 #endif
 
 /* Thread-local data for each GC thread
@@ -127,8 +133,27 @@ nat n_gc_threads;
 // For stats:
 long copied;        // *words* copied & scavenged during this GC
 
+// The objects we have taken off the saved mutable lists so far in this
+// GC: an open-addressed table of 2^mut_list_set_bits pointers, so that
+// an object recorded more than once is only scavenged once (see
+// scavenge_mutable_list()).
+StgWord *mut_list_set;
+nat      mut_list_set_bits;
+
 rtsBool work_stealing;
 
+#if defined(THREADED_RTS)
+// GC threads that have run out of work spin for a while, and then go
+// to sleep on gc_idle_cond until there is work to steal or the GC is
+// over.  See scavenge_until_all_done().
+static Mutex     gc_idle_mutex;
+static Condition gc_idle_cond;
+volatile StgWord gc_sleeping_threads = 0;
+
+// How many times an idle GC thread looks for work before it sleeps.
+#define GC_IDLE_SPINS 100
+#endif
+
 DECLARE_GCT
 
 /* -----------------------------------------------------------------------------
@@ -140,9 +165,12 @@ static void zero_static_object_list (StgClosure* first_static);
 static nat  initialise_N            (rtsBool force_major_gc);
 static void prepare_collected_gen   (generation *gen);
 static void prepare_uncollected_gen (generation *gen);
+static void init_mut_list_set       (void);
+static void free_mut_list_set       (void);
 static void init_gc_thread          (gc_thread *t);
 static void resize_generations      (void);
-static void resize_nursery          (void);
+static void retire_workspace_blocks (generation *gen);
+static void resize_nursery          (lnat allocated);
 static void start_gc_threads        (void);
 static void scavenge_until_all_done (void);
 static StgWord inc_running          (void);
@@ -151,6 +179,8 @@ static void wakeup_gc_threads       (nat me);
 static void shutdown_gc_threads     (nat me);
 static void collect_gct_blocks      (void);
 static lnat collect_pinned_object_blocks (void);
+static void collect_large_objects        (void);
+static void free_large_objects           (bdescr *bd);
 
 #if 0 && defined(DEBUG)
 static void gcCAFs                  (void);
@@ -160,9 +190,7 @@ static void gcCAFs                  (void);
    The mark stack.
    -------------------------------------------------------------------------- */
 
-bdescr *mark_stack_top_bd; // topmost block in the mark stack
-bdescr *mark_stack_bd;     // current block in the mark stack
-StgPtr mark_sp;            // pointer to the next unallocated mark stack entry
+MarkStack mark_stack;
 
 /* -----------------------------------------------------------------------------
    GarbageCollect: the main entry point to the garbage collector.
@@ -179,6 +207,7 @@ GarbageCollect (rtsBool force_major_gc,
   bdescr *bd;
   generation *gen;
   lnat live_blocks, live_words, allocated, par_max_copied, par_tot_copied;
+  lnat mut_list_words, mut_list_dups;
 #if defined(THREADED_RTS)
   gc_thread *saved_gct;
 #endif
@@ -193,6 +222,10 @@ GarbageCollect (rtsBool force_major_gc,
   CostCentreStack *save_CCS[n_capabilities];
 #endif
 
+  // stop the concurrent marker, if there is one.  Before taking
+  // sm_mutex: the marker thread takes it to allocate blocks.
+  concMarkPause();
+
   ACQUIRE_SM_LOCK;
 
 #if defined(RTS_USER_SIGNALS)
@@ -218,6 +251,8 @@ GarbageCollect (rtsBool force_major_gc,
   mutlist_MUTVARS = 0;
   mutlist_MUTARRS = 0;
   mutlist_OTHERS = 0;
+  mutlist_CARDS = 0;
+  mutlist_DIRTY_CARDS = 0;
 #endif
 
   // attribute any costs to CCS_GC 
@@ -237,6 +272,21 @@ GarbageCollect (rtsBool force_major_gc,
    */
   n = initialise_N(force_major_gc);
 
+  // With --concurrent-mark, a collection of the oldest generation
+  // becomes a collection of the others, which starts or finishes a
+  // concurrent mark of the oldest generation instead; see ConcMark.c.
+  if (RtsFlags.GcFlags.concurrentMark) {
+      N = concMarkSelectGen(N, force_major_gc);
+      major_gc = (N == RtsFlags.GcFlags.generations-1);
+  }
+
+  if (major_gc) {
+      concMarkAbandon();
+  } else if (concMarkStarting()) {
+      retire_workspace_blocks(oldest_gen);
+      concMarkStart();
+  }
+
 #if defined(THREADED_RTS)
   work_stealing = RtsFlags.ParFlags.parGcLoadBalancingEnabled &&
                   N >= RtsFlags.ParFlags.parGcLoadBalancingGen;
@@ -286,10 +336,16 @@ GarbageCollect (rtsBool force_major_gc,
   // check sanity *before* GC
   IF_DEBUG(sanity, checkSanity(rtsFalse /* before GC */, major_gc));
 
-  // gather blocks allocated using allocatePinned() from each capability
-  // and put them on the g0->large_object list.
+  // gather the large objects allocated by each capability, and the
+  // blocks allocated using allocatePinned(), and put them on the
+  // g0->large_object list.
+  collect_large_objects();
   collect_pinned_object_blocks();
 
+  // give the pinned blocks of the collected generations mark bits, so
+  // that we can tell how much of each block is still in use.
+  startPinnedMarks(N);
+
   // Initialise all the generations/steps that we're collecting.
   for (g = 0; g <= N; g++) {
       prepare_collected_gen(&generations[g]);
@@ -298,6 +354,7 @@ GarbageCollect (rtsBool force_major_gc,
   for (g = N+1; g < RtsFlags.GcFlags.generations; g++) {
       prepare_uncollected_gen(&generations[g]);
   }
+  init_mut_list_set();
 
   // Prepare this gc_thread
   init_gc_thread(gct);
@@ -305,15 +362,11 @@ GarbageCollect (rtsBool force_major_gc,
   /* Allocate a mark stack if we're doing a major collection.
    */
   if (major_gc && oldest_gen->mark) {
-      mark_stack_bd     = allocBlock();
-      mark_stack_top_bd = mark_stack_bd;
-      mark_stack_bd->link = NULL;
-      mark_stack_bd->u.back = NULL;
-      mark_sp           = mark_stack_bd->start;
+      init_mark_stack(&mark_stack, allocBlock());
   } else {
-      mark_stack_bd     = NULL;
-      mark_stack_top_bd = NULL;
-      mark_sp           = NULL;
+      mark_stack.bd     = NULL;
+      mark_stack.top_bd = NULL;
+      mark_stack.sp     = NULL;
   }
 
   /* -----------------------------------------------------------------------
@@ -369,6 +422,9 @@ GarbageCollect (rtsBool force_major_gc,
 
   markScheduler(mark_root, gct);
 
+  // the contention manager's serialized transaction
+  markSTM(mark_root, gct);
+
 #if defined(RTS_USER_SIGNALS)
   // mark the signal handlers (signals should be already blocked)
   markSignalHandlers(mark_root, gct);
@@ -381,6 +437,12 @@ GarbageCollect (rtsBool force_major_gc,
   // Mark the stable pointer table.
   markStablePtrTable(mark_root, gct);
 
+  // Finishing a concurrent mark: keep the things that it can't tell
+  // are dead.
+  if (conc_mark_finishing) {
+      concMarkFinishRoots();
+  }
+
   /* -------------------------------------------------------------------------
    * Repeatedly scavenge all the areas we know about until there's no
    * more scavenging to be done.
@@ -391,6 +453,12 @@ GarbageCollect (rtsBool force_major_gc,
       // The other threads are now stopped.  We might recurse back to
       // here, but from now on this is the only thread.
       
+      // scavenge the objects that the concurrent marker left for us
+      if (conc_mark_active && scavenge_conc_mark_stacks()) {
+          inc_running();
+          continue;
+      }
+
       // must be last...  invariant is that everything is fully
       // scavenged at this point.
       if (traverseWeakPtrList()) { // returns rtsTrue if evaced something 
@@ -404,6 +472,8 @@ GarbageCollect (rtsBool force_major_gc,
 
   shutdown_gc_threads(gct->thread_index);
 
+  free_mut_list_set();
+
   // Now see which stable names are still alive.
   gcStablePtrTable();
 
@@ -434,17 +504,25 @@ GarbageCollect (rtsBool force_major_gc,
 
   // NO MORE EVACUATION AFTER THIS POINT!
 
+  // Count the free space in the surviving pinned blocks, and collect
+  // the holes that allocatePinned() may reuse.  This has to happen
+  // before we free the dead large objects below.
+  finishPinnedMarks(N);
+
   // Finally: compact or sweep the oldest generation.
   if (major_gc && oldest_gen->mark) {
       if (oldest_gen->compact) 
           compact(gct->scavenged_static_objects);
       else
           sweep(oldest_gen);
+  } else if (conc_mark_finishing) {
+      concMarkSweep();
   }
 
   copied = 0;
   par_max_copied = 0;
   par_tot_copied = 0;
+  mut_list_dups = 0;
   { 
       nat i;
       for (i=0; i < n_gc_threads; i++) {
@@ -455,8 +533,10 @@ GarbageCollect (rtsBool force_major_gc,
               debugTrace(DEBUG_gc,"   any_work         %ld", gc_threads[i]->any_work);
               debugTrace(DEBUG_gc,"   no_work          %ld", gc_threads[i]->no_work);
               debugTrace(DEBUG_gc,"   scav_find_work %ld",   gc_threads[i]->scav_find_work);
+              debugTrace(DEBUG_gc,"   sleeps         %ld",   gc_threads[i]->sleeps);
           }
           copied += gc_threads[i]->copied;
+          mut_list_dups += gc_threads[i]->mut_list_dups;
           par_max_copied = stg_max(gc_threads[i]->copied, par_max_copied);
       }
       par_tot_copied = copied;
@@ -475,6 +555,14 @@ GarbageCollect (rtsBool force_major_gc,
   //
   live_words = 0;
   live_blocks = 0;
+  mut_list_words = 0;
+
+  // The dead large objects that allocate() hasn't reused since the
+  // last GC go back to the free list, to make room in the large
+  // object caches for the ones that died in this GC.
+  for (n = 0; n < n_capabilities; n++) {
+      flushLargeCache(&capabilities[n].large_cache);
+  }
 
   for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
 
@@ -491,11 +579,15 @@ GarbageCollect (rtsBool force_major_gc,
             mut_list_size += countOccupied(capabilities[n].mut_lists[g]);
         }
 	copied +=  mut_list_size;
+        mut_list_words += mut_list_size;
 
 	debugTrace(DEBUG_gc,
 		   "mut_list_size: %lu (%d vars, %d arrays, %d MVARs, %d others)",
 		   (unsigned long)(mut_list_size * sizeof(W_)),
 		   mutlist_MUTVARS, mutlist_MUTARRS, mutlist_MVARS, mutlist_OTHERS);
+	debugTrace(DEBUG_gc,
+		   "mut_list arrays: %lu cards in dirty arrays, %lu of them scanned",
+		   (unsigned long)mutlist_CARDS, (unsigned long)mutlist_DIRTY_CARDS);
     }
 
     bdescr *next, *prev;
@@ -569,7 +661,7 @@ GarbageCollect (rtsBool force_major_gc,
          * collection from large_objects.  Any objects left on the
          * large_objects list are therefore dead, so we free them here.
          */
-        freeChain(gen->large_objects);
+        free_large_objects(gen->large_objects);
         gen->large_objects  = gen->scavenged_large_objects;
         gen->n_large_blocks = gen->n_scavenged_large_blocks;
         gen->n_new_large_words = 0;
@@ -609,16 +701,36 @@ GarbageCollect (rtsBool force_major_gc,
     }
   } // for all generations
 
+  debugTrace(DEBUG_gc, "mut_lists: %lu bytes, %lu duplicate entries dropped",
+             (unsigned long)(mut_list_words * sizeof(W_)),
+             (unsigned long)mut_list_dups);
+  traceEventMutListSize(gct->cap, CAPSET_HEAP_DEFAULT,
+                        mut_list_words * sizeof(W_));
+
   // update the max size of older generations after a major GC
   resize_generations();
   
   // Free the mark stack.
-  if (mark_stack_top_bd != NULL) {
+  if (mark_stack.top_bd != NULL) {
       debugTrace(DEBUG_gc, "mark stack: %d blocks",
-                 countBlocks(mark_stack_top_bd));
-      freeChain(mark_stack_top_bd);
+                 countBlocks(mark_stack.top_bd));
+      freeChain(mark_stack.top_bd);
   }
 
+#if defined(THREADED_RTS)
+  // Return the unused cached blocks of the GC threads and of the
+  // Capabilities, so that their megablocks can be freed below.  The
+  // GC threads have all stopped allocating by now, and the
+  // mutators are stopped until the GC is over.
+  {
+      nat i;
+      for (i = 0; i < n_capabilities; i++) {
+          flushBlockCache(&gc_threads[i]->block_cache);
+          flushBlockCache(&capabilities[i].block_cache);
+      }
+  }
+#endif
+
   // Free any bitmaps.
   for (g = 0; g <= N; g++) {
       gen = &generations[g];
@@ -631,7 +743,7 @@ GarbageCollect (rtsBool force_major_gc,
   // Reset the nursery: make the blocks empty
   allocated += clearNurseries();
 
-  resize_nursery();
+  resize_nursery(allocated);
 
   resetNurseries();
 
@@ -711,6 +823,18 @@ GarbageCollect (rtsBool force_major_gc,
       }
   }
 
+  // Give the OS back any free memory beyond what we expect to reuse
+  // soon: by default, as much as the heap has in use.
+  if (RtsFlags.GcFlags.decommit != DECOMMIT_NONE) {
+      nat retain;
+      if (RtsFlags.GcFlags.retainFreeAuto) {
+          retain = BLOCKS_TO_MBLOCKS(n_alloc_blocks);
+      } else {
+          retain = BLOCKS_TO_MBLOCKS(RtsFlags.GcFlags.retainFree);
+      }
+      decommitFreeMemory(retain);
+  }
+
   // extra GC trace info
   IF_DEBUG(gc, statDescribeGens());
 
@@ -754,6 +878,8 @@ GarbageCollect (rtsBool force_major_gc,
 
   RELEASE_SM_LOCK;
 
+  concMarkResume();
+
   SET_GCT(saved_gct);
 }
 
@@ -826,8 +952,12 @@ new_gc_thread (nat n, gc_thread *t)
 
     t->thread_index = n;
     t->idle = rtsFalse;
-    t->free_blocks = NULL;
+#ifdef THREADED_RTS
+    initBlockCache(&t->block_cache, capNoToNumaNode(n));
+#endif
     t->gc_count = 0;
+    t->tot_idle_spin_time = 0;
+    t->tot_idle_sleep_time = 0;
 
     init_gc_thread(t);
     
@@ -883,6 +1013,8 @@ initGcThreads (nat from USED_IF_THREADS, nat to USED_IF_THREADS)
     } else {
         gc_threads = stgMallocBytes (to * sizeof(gc_thread*),
                                      "initGcThreads");
+        initMutex(&gc_idle_mutex);
+        initCondition(&gc_idle_cond);
     }
 
     // We have to update the gct->cap pointers to point to the new
@@ -922,6 +1054,8 @@ freeGcThreads (void)
             stgFree (gc_threads[i]);
 	}
         stgFree (gc_threads);
+        closeMutex(&gc_idle_mutex);
+        closeCondition(&gc_idle_cond);
 #else
         for (g = 0; g < RtsFlags.GcFlags.generations; g++)
         {
@@ -966,7 +1100,7 @@ any_work (void)
     write_barrier();
 
     // scavenge objects in compacted generation
-    if (mark_stack_bd != NULL && !mark_stack_empty()) {
+    if (mark_stack.bd != NULL && !mark_stack_empty()) {
 	return rtsTrue;
     }
     
@@ -995,18 +1129,76 @@ any_work (void)
 #endif
 
     gct->no_work++;
-#if defined(THREADED_RTS)
-    yieldThread();
-#endif
 
     return rtsFalse;
 }    
 
+// Only read the clock for the idle time stats if someone wants them.
+STATIC_INLINE Time
+idle_clock (void)
+{
+    if (RtsFlags.GcFlags.giveStats != NO_GC_STATS) {
+        return getProcessElapsedTime();
+    }
+    return 0;
+}
+
+#if defined(THREADED_RTS)
+
+/* Sleep until there is work to steal, or every GC thread has run out
+ * of work.  Whoever makes either of those true checks
+ * gc_sleeping_threads after a full barrier, and we increment it before
+ * we look, so that one of us is sure to see the other.
+ */
+static void
+gc_idle_sleep (void)
+{
+    Time start;
+
+    start = idle_clock();
+
+    ACQUIRE_LOCK(&gc_idle_mutex);
+    atomic_inc(&gc_sleeping_threads);
+    while (gc_running_threads != 0 && !any_work()) {
+        waitCondition(&gc_idle_cond, &gc_idle_mutex);
+    }
+    atomic_dec(&gc_sleeping_threads);
+    RELEASE_LOCK(&gc_idle_mutex);
+
+    gct->sleeps++;
+    gct->idle_sleep_time += idle_clock() - start;
+}
+
+// Called by a GC thread that has just pushed some work on its todo_q.
+void
+notifyIdleGcThreads (void)
+{
+    ACQUIRE_LOCK(&gc_idle_mutex);
+    signalCondition(&gc_idle_cond);
+    RELEASE_LOCK(&gc_idle_mutex);
+}
+
+#endif
+
+/* ----------------------------------------------------------------------------
+   Scavenge until all the GC threads have run out of work.
+
+   When a thread runs out of work it looks for work to steal, yielding
+   in between, GC_IDLE_SPINS times; then it goes to sleep until
+   another thread pushes some work, or the last running thread runs
+   out of work and wakes everybody up.
+   ------------------------------------------------------------------------- */
+
 static void
 scavenge_until_all_done (void)
 {
-    DEBUG_ONLY( nat r );
-	
+#if defined(THREADED_RTS) || defined(DEBUG)
+    StgWord r;
+#endif
+    Time idle_start, slept;
+#if defined(THREADED_RTS)
+    nat spins;
+#endif
 
 loop:
 #if defined(THREADED_RTS)
@@ -1023,7 +1215,7 @@ loop:
 
     // scavenge_loop() only exits when there's no work to do
 
-#ifdef DEBUG
+#if defined(THREADED_RTS) || defined(DEBUG)
     r = dec_running();
 #else
     dec_running();
@@ -1031,11 +1223,26 @@ loop:
 
     traceEventGcIdle(gct->cap);
 
-    debugTrace(DEBUG_gc, "%d GC threads still running", r);
+    debugTrace(DEBUG_gc, "%d GC threads still running", (int)r);
+
+#if defined(THREADED_RTS)
+    // If we were the last one running, the GC is over: wake up the
+    // threads that are asleep, so that they can finish too.
+    if (r == 0 && gc_sleeping_threads != 0) {
+        ACQUIRE_LOCK(&gc_idle_mutex);
+        broadcastCondition(&gc_idle_cond);
+        RELEASE_LOCK(&gc_idle_mutex);
+    }
+    spins = 0;
+#endif
+
+    idle_start = idle_clock();
+    slept = gct->idle_sleep_time;
     
     while (gc_running_threads != 0) {
-        // usleep(1);
         if (any_work()) {
+            gct->idle_spin_time += idle_clock() - idle_start
+                                   - (gct->idle_sleep_time - slept);
             inc_running();
             traceEventGcWork(gct->cap);
             goto loop;
@@ -1044,8 +1251,19 @@ loop:
         // just checks for the presence of work.  If we find any,
         // then we increment gc_running_threads and go back to 
         // scavenge_loop() to perform any pending work.
+#if defined(THREADED_RTS)
+        if (++spins < GC_IDLE_SPINS) {
+            yieldThread();
+        } else {
+            gc_idle_sleep();
+            spins = 0;
+        }
+#endif
     }
     
+    gct->idle_spin_time += idle_clock() - idle_start
+                           - (gct->idle_sleep_time - slept);
+
     traceEventGcDone(gct->cap);
 }
 
@@ -1382,6 +1600,91 @@ prepare_uncollected_gen (generation *gen)
     ASSERT(gen->n_scavenged_large_blocks == 0);
 }
 
+/* -----------------------------------------------------------------------------
+   The set of objects on the saved mutable lists.
+
+   Every capability that dirties an old object records it on its own
+   mutable list, so between two GCs the same object can turn up on the
+   lists of several capabilities.  We make room for every entry of the
+   saved lists, keeping the table at most two-thirds full; the lists
+   themselves are rebuilt with one entry per object.
+   ------------------------------------------------------------------------- */
+
+static void
+init_mut_list_set (void)
+{
+    nat g, i;
+    lnat entries, size;
+
+    entries = 0;
+    for (g = N+1; g < RtsFlags.GcFlags.generations; g++) {
+        for (i = 0; i < n_capabilities; i++) {
+            entries += countOccupied(capabilities[i].saved_mut_lists[g]);
+        }
+    }
+
+    mut_list_set = NULL;
+    mut_list_set_bits = 0;
+    if (entries == 0) {
+        return;
+    }
+
+    size = 2;
+    mut_list_set_bits = 1;
+    while (size < entries + entries / 2 + 1) {
+        size *= 2;
+        mut_list_set_bits++;
+    }
+
+    mut_list_set = stgCallocBytes(size, sizeof(StgWord), "init_mut_list_set");
+}
+
+static void
+free_mut_list_set (void)
+{
+    if (mut_list_set != NULL) {
+        stgFree(mut_list_set);
+        mut_list_set = NULL;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Move the partly-filled blocks in the gc_thread workspaces of an
+   uncollected generation onto its block list, so that a concurrent
+   mark of the generation can see them.
+   -------------------------------------------------------------------------- */
+
+static void
+retire_workspace_blocks (generation *gen)
+{
+    nat n;
+    gen_workspace *ws;
+    bdescr *bd, *next;
+
+    for (n = 0; n < n_capabilities; n++) {
+        ws = &gc_threads[n]->gens[gen->no];
+
+        for (bd = ws->part_list; bd != NULL; bd = next) {
+            next = bd->link;
+            bd->link = gen->blocks;
+            gen->blocks = bd;
+            gen->n_blocks += bd->blocks;
+            gen->n_words  += bd->free - bd->start;
+        }
+        ws->part_list = NULL;
+        ws->n_part_blocks = 0;
+
+        if (ws->todo_free != ws->todo_bd->start) {
+            ws->todo_bd->free = ws->todo_free;
+            ws->todo_bd->link = gen->blocks;
+            gen->blocks = ws->todo_bd;
+            gen->n_blocks += ws->todo_bd->blocks;
+            gen->n_words  += ws->todo_free - ws->todo_bd->start;
+            alloc_todo_block(ws,0); // always has one block.
+        }
+    }
+}
+
 /* -----------------------------------------------------------------------------
    Collect the completed blocks from a GC thread and attach them to
    the generation.
@@ -1462,6 +1765,67 @@ collect_pinned_object_blocks (void)
     return allocated;
 }
 
+/* -----------------------------------------------------------------------------
+   Large objects allocated by allocate() are kept on cap->large_objects
+   until the next GC, so that allocating them doesn't need sm_mutex.
+   Here we put them on the g0->large_objects list.
+   -------------------------------------------------------------------------- */
+
+static void
+collect_large_objects (void)
+{
+    nat n;
+    bdescr *bd, *prev;
+
+    for (n = 0; n < n_capabilities; n++) {
+        prev = NULL;
+        for (bd = capabilities[n].large_objects; bd != NULL; bd = bd->link) {
+            g0->n_large_blocks += bd->blocks; // might be larger than requested
+            prev = bd;
+        }
+        if (prev != NULL) {
+            prev->link = g0->large_objects;
+            if (g0->large_objects != NULL) {
+                g0->large_objects->u.back = prev;
+            }
+            g0->large_objects = capabilities[n].large_objects;
+            capabilities[n].large_objects = NULL;
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Free the dead large objects of a collected generation.  The small
+   ones go into the capabilities' large object caches, for allocate()
+   to reuse until the next GC (see BlockAlloc.c); we share them out
+   round-robin, keeping each group on its NUMA node.
+   -------------------------------------------------------------------------- */
+
+static void
+free_large_objects (bdescr *bd)
+{
+    static nat next_cap = 0;
+    bdescr *next;
+    Capability *cap;
+    nat i;
+
+    for (; bd != NULL; bd = next) {
+        next = bd->link;
+        if (bd->blocks <= LARGE_CACHE_MAX_BLOCKS) {
+            for (i = 0; i < n_capabilities; i++) {
+                cap = &capabilities[(next_cap + i) % n_capabilities];
+                if (cap->node == bd->node &&
+                    cacheLargeGroup(&cap->large_cache, bd)) {
+                    next_cap = (cap->no + 1) % n_capabilities;
+                    break;
+                }
+            }
+            if (i < n_capabilities) continue;
+        }
+        freeGroup(bd);
+    }
+}
+
 /* -----------------------------------------------------------------------------
    Initialise a gc_thread before GC
    -------------------------------------------------------------------------- */
@@ -1482,6 +1846,10 @@ init_gc_thread (gc_thread *t)
     t->any_work = 0;
     t->no_work = 0;
     t->scav_find_work = 0;
+    t->sleeps = 0;
+    t->mut_list_dups = 0;
+    t->idle_spin_time = 0;
+    t->idle_sleep_time = 0;
 }
 
 /* -----------------------------------------------------------------------------
@@ -1539,7 +1907,7 @@ resize_generations (void)
 {
     nat g;
 
-    if (major_gc && RtsFlags.GcFlags.generations > 1) {
+    if ((major_gc || conc_mark_finishing) && RtsFlags.GcFlags.generations > 1) {
 	nat live, size, min_alloc, words;
 	const nat max  = RtsFlags.GcFlags.maxHeapSize;
 	const nat gens = RtsFlags.GcFlags.generations;
@@ -1572,7 +1940,10 @@ resize_generations (void)
              oldest_gen->n_blocks > 
              (RtsFlags.GcFlags.compactThreshold * max) / 100)) {
 	    oldest_gen->mark = 1;
-	    oldest_gen->compact = 1;
+            // with --compact-budget, sweep and copy out the most
+            // fragmented blocks a few at a time (see Sweep.c),
+            // rather than compacting the whole generation.
+	    oldest_gen->compact = (RtsFlags.GcFlags.compactBudget == 0);
 //	  debugBelch("compaction: on\n", live);
 	} else {
 	    oldest_gen->mark = 0;
@@ -1597,7 +1968,8 @@ resize_generations (void)
 		heapOverflow();
 	    }
 	    
-	    if (oldest_gen->compact) {
+	    if (oldest_gen->compact ||
+                (oldest_gen->mark && RtsFlags.GcFlags.compactBudget != 0)) {
 		if ( (size + (size - 1) * (gens - 2) * 2) + min_alloc > max ) {
 		    size = (max - min_alloc) / ((gens - 1) * 2 - 1);
 		}
@@ -1623,12 +1995,97 @@ resize_generations (void)
     }
 }
 
+/* -----------------------------------------------------------------------------
+   Adaptive nursery sizing (+RTS --adaptive-nursery)
+
+   Each Capability starts with an allocation area that fits in its
+   cache: the L2 cache, or the Capability's share of the L3 cache if
+   that is bigger.  After each minor GC we look at the fraction of
+   what was allocated that survived:
+
+     - if a lot survived, objects are not getting enough time to die,
+       so we double the allocation area (up to NURSERY_MAX_FACTOR
+       times the cache size);
+
+     - if almost nothing survived, the allocation area is bigger than
+       it needs to be, so we halve it, back towards the cache size
+       where allocation is cheapest.
+
+   Every change is reported in the eventlog (EVENT_NURSERY_SIZE).
+   -------------------------------------------------------------------------- */
+
+#define NURSERY_GROW_SURVIVAL   5  /* percent */
+#define NURSERY_SHRINK_SURVIVAL 1  /* percent */
+#define NURSERY_MAX_FACTOR      8
+
+static nat nursery_cache_blocks = 0; // cache-sized nursery, per Capability
+static nat nursery_blocks = 0;       // current nursery size, per Capability
+
+static nat
+cache_nursery_blocks (void)
+{
+    lnat l2, l3, bytes;
+
+    l2 = osCacheSize(2);
+    l3 = osCacheSize(3) / n_capabilities;
+    bytes = stg_max(l2, l3);
+
+    debugTrace(DEBUG_gc, "adaptive nursery: L2 %ldk, L3 share %ldk",
+               (long)(l2 / 1024), (long)(l3 / 1024));
+
+    if (bytes == 0) {
+        // we don't know: fall back to -A
+        return RtsFlags.GcFlags.minAllocAreaSize;
+    }
+    return stg_max(1, bytes / BLOCK_SIZE);
+}
+
+static nat
+adapt_nursery (lnat allocated)
+{
+    nat old_blocks;
+    lnat survival;
+
+    if (nursery_cache_blocks == 0) {
+        nursery_cache_blocks = cache_nursery_blocks();
+        nursery_blocks = nursery_cache_blocks;
+        traceEventNurserySize(gct->cap, CAPSET_HEAP_DEFAULT,
+                              (lnat)nursery_blocks * BLOCK_SIZE);
+        return nursery_blocks;
+    }
+
+    // only a minor GC tells us about the nursery
+    if (N != 0 || allocated == 0) {
+        return nursery_blocks;
+    }
+
+    old_blocks = nursery_blocks;
+    survival = ((lnat)copied * 100) / allocated;
+
+    if (survival >= NURSERY_GROW_SURVIVAL) {
+        nursery_blocks = stg_min(nursery_blocks * 2,
+                                 nursery_cache_blocks * NURSERY_MAX_FACTOR);
+    } else if (survival < NURSERY_SHRINK_SURVIVAL) {
+        nursery_blocks = stg_max(nursery_blocks / 2, nursery_cache_blocks);
+    }
+
+    if (nursery_blocks != old_blocks) {
+        debugTrace(DEBUG_gc, "adaptive nursery: %ld%% survived, "
+                   "resizing from %d to %d blocks",
+                   (long)survival, old_blocks, nursery_blocks);
+        traceEventNurserySize(gct->cap, CAPSET_HEAP_DEFAULT,
+                              (lnat)nursery_blocks * BLOCK_SIZE);
+    }
+
+    return nursery_blocks;
+}
+
 /* -----------------------------------------------------------------------------
    Calculate the new size of the nursery, and resize it.
    -------------------------------------------------------------------------- */
 
 static void
-resize_nursery (void)
+resize_nursery (lnat allocated)
 {
     const lnat min_nursery = RtsFlags.GcFlags.minAllocAreaSize * n_capabilities;
 
@@ -1729,6 +2186,10 @@ resize_nursery (void)
 	    
 	    resizeNurseries((nat)blocks);
 	}
+	else if (RtsFlags.GcFlags.adaptiveNursery)
+	{
+	    resizeNurseriesFixed(adapt_nursery(allocated));
+	}
 	else
 	{
 	    // we might have added extra large blocks to the nursery, so
@@ -28,16 +28,18 @@ void         markCAFs     ( evac_fn evac, void *user );
 extern nat N;
 extern rtsBool major_gc;
 
-extern bdescr *mark_stack_bd;
-extern bdescr *mark_stack_top_bd;
-extern StgPtr mark_sp;
+extern struct MarkStack_ mark_stack;
 
 extern long copied;
 
 extern rtsBool work_stealing;
 
+extern StgWord *mut_list_set;
+extern nat      mut_list_set_bits;
+
 #ifdef DEBUG
 extern nat mutlist_MUTVARS, mutlist_MUTARRS, mutlist_MVARS, mutlist_OTHERS;
+extern lnat mutlist_CARDS, mutlist_DIRTY_CARDS;
 #endif
 
 #if defined(PROF_SPIN) && defined(THREADED_RTS)
@@ -51,6 +53,9 @@ void freeGcThreads (void);
 #if defined(THREADED_RTS)
 void waitForGcThreads (Capability *cap);
 void releaseGCThreads (Capability *cap);
+
+extern volatile StgWord gc_sleeping_threads;
+void notifyIdleGcThreads (void);
 #endif
 
 #define WORK_UNIT_WORDS 128
@@ -13,6 +13,7 @@
 #include "GC.h"
 #include "Storage.h"
 #include "Compact.h"
+#include "Pinned.h"
 #include "Task.h"
 #include "Capability.h"
 #include "Trace.h"
@@ -60,8 +61,12 @@ isAlive(StgClosure *p)
     // ignore closures in generations that we're not collecting. 
     bd = Bdescr((P_)q);
 
-    // if it's a pointer into to-space, then we're done
+    // if it's a pointer into to-space, then we're done.  A pinned
+    // block may be alive when some of the objects in it are not.
     if (bd->flags & BF_EVACUATED) {
+        if ((bd->flags & BF_PINNED_MARKS) && !isPinnedObjectMarked(q, bd)) {
+            return NULL;
+        }
 	return p;
     }
 
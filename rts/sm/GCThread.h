@@ -15,6 +15,7 @@
 #define SM_GCTHREAD_H
 
 #include "WSDeque.h"
+#include "BlockAlloc.h"
 #include "GetTime.h" // for Ticks
 
 #include "BeginPrivate.h"
@@ -127,9 +128,11 @@ typedef struct gc_thread_ {
     nat thread_index;              // a zero based index identifying the thread
     rtsBool idle;                  // sitting out of this GC cycle
 
-    bdescr * free_blocks;          // a buffer of free blocks for this thread
+#ifdef THREADED_RTS
+    BlockCache block_cache;        // a buffer of free blocks for this thread
                                    //  during GC without accessing the block
                                    //   allocators spin lock. 
+#endif
 
     StgClosure* static_objects;      // live static objects
     StgClosure* scavenged_static_objects;   // static objects scavenged so far
@@ -181,6 +184,13 @@ typedef struct gc_thread_ {
     lnat any_work;
     lnat no_work;
     lnat scav_find_work;
+    lnat sleeps;                   // times we slept waiting for work
+    lnat mut_list_dups;            // mutable list entries seen twice
+
+    Time idle_spin_time;           // time spent looking for work, and
+    Time idle_sleep_time;          //   asleep waiting for it, in this GC
+    Time tot_idle_spin_time;       // totals over all GCs, see
+    Time tot_idle_sleep_time;      //   stat_gcWorkerThreadDone()
 
     Time gc_start_cpu;   // process CPU time
     Time gc_start_elapsed;  // process elapsed time
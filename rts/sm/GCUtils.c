@@ -30,24 +30,44 @@
 SpinLock gc_alloc_block_sync;
 #endif
 
-bdescr *
-allocBlock_sync(void)
+// Small groups come from this GC thread's BlockCache, which we only
+// need the spin lock to refill; the cache is flushed at the end of
+// each GC (see GarbageCollect()).
+static bdescr *
+allocGroup_sync(nat n)
 {
     bdescr *bd;
+
+#if defined(THREADED_RTS)
+    if (n <= BLOCK_CACHE_MAX_BLOCKS) {
+        bd = takeCachedGroup(&gct->block_cache, n);
+        if (bd != NULL) {
+            gct->block_cache.hits++;
+            return bd;
+        }
+        ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
+        refillBlockCache(&gct->block_cache, n);
+        RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
+        return takeCachedGroup(&gct->block_cache, n);
+    }
+
+    // bigger groups still come from this GC thread's NUMA node
     ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
-    bd = allocBlock();
+    bd = allocGroupOnNode(gct->block_cache.node, n);
     RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
     return bd;
-}
-
-static bdescr *
-allocGroup_sync(nat n)
-{
-    bdescr *bd;
+#else
     ACQUIRE_SPIN_LOCK(&gc_alloc_block_sync);
     bd = allocGroup(n);
     RELEASE_SPIN_LOCK(&gc_alloc_block_sync);
     return bd;
+#endif
+}
+
+bdescr *
+allocBlock_sync(void)
+{
+    return allocGroup_sync(1);
 }
 
 
@@ -222,6 +242,16 @@ todo_block_full (nat size, gen_workspace *ws)
                 ws->todo_overflow = bd;
                 ws->n_todo_overflow++;
             }
+#if defined(THREADED_RTS)
+            else if (work_stealing) {
+                // there is work to steal: wake up a GC thread that has
+                // gone to sleep waiting for some.
+                store_load_barrier();
+                if (gc_sleeping_threads != 0) {
+                    notifyIdleGcThreads();
+                }
+            }
+#endif
         }
     }
 
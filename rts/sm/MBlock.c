@@ -15,6 +15,7 @@
 #include "BlockAlloc.h"
 #include "Trace.h"
 #include "OSMem.h"
+#include "Capability.h"
 
 #include <string.h>
 
@@ -246,6 +247,30 @@ getMBlocks(nat n)
     return ret;
 }
 
+// Allocate 'n' mblocks on the given logical NUMA node (see
+// numa_map[]).  The memory is bound to the node before it is touched,
+// so the pages are placed there when they are first faulted in.
+
+void *
+getMBlocksOnNode(nat node, nat n)
+{
+    void *ret;
+
+    ret = getMBlocks(n);
+
+#ifdef DEBUG
+    // with --debug-numa the nodes are made up, so there is nothing
+    // to bind the memory to.
+    if (RtsFlags.DebugFlags.numa) return ret;
+#endif
+
+    if (RtsFlags.GcFlags.numa) {
+        osBindMBlocksToNode(ret, (lnat)n * MBLOCK_SIZE, numa_map[node]);
+    }
+
+    return ret;
+}
+
 void
 freeMBlocks(void *addr, nat n)
 {
@@ -16,54 +16,93 @@
 
 #include "BeginPrivate.h"
 
+/* A mark stack is a chain of blocks, doubly-linked so that the blocks
+ * can be reused as the stack shrinks and grows again.  The compacting
+ * and mark/sweep collectors use the global mark_stack (see GC.c); the
+ * concurrent marker keeps its own (see ConcMark.c).
+ */
+typedef struct MarkStack_ {
+    bdescr *top_bd;     // topmost block in the mark stack
+    bdescr *bd;         // current block in the mark stack
+    StgPtr  sp;         // pointer to the next unallocated mark stack entry
+} MarkStack;
+
 INLINE_HEADER void
-push_mark_stack(StgPtr p)
+init_mark_stack (MarkStack *ms, bdescr *bd)
+{
+    bd->link   = NULL;
+    bd->u.back = NULL;
+    ms->top_bd = bd;
+    ms->bd     = bd;
+    ms->sp     = bd->start;
+}
+
+INLINE_HEADER void
+push_mark_stack_on (MarkStack *ms, StgPtr p)
 {
     bdescr *bd;
 
-    *mark_sp++ = (StgWord)p;
+    *ms->sp++ = (StgWord)p;
 
-    if (((W_)mark_sp & BLOCK_MASK) == 0)
+    if (((W_)ms->sp & BLOCK_MASK) == 0)
     {
-        if (mark_stack_bd->u.back != NULL)
+        if (ms->bd->u.back != NULL)
         {
-            mark_stack_bd = mark_stack_bd->u.back;
+            ms->bd = ms->bd->u.back;
         }
         else
         {
             bd = allocBlock_sync();
-            bd->link = mark_stack_bd;
+            bd->link = ms->bd;
             bd->u.back = NULL;
-            mark_stack_bd->u.back = bd; // double-link the new block on
-            mark_stack_top_bd = bd;
-            mark_stack_bd = bd;
+            ms->bd->u.back = bd; // double-link the new block on
+            ms->top_bd = bd;
+            ms->bd = bd;
         }
-        mark_sp     = mark_stack_bd->start;
+        ms->sp = ms->bd->start;
     }
 }
 
 INLINE_HEADER StgPtr
-pop_mark_stack(void)
+pop_mark_stack_from (MarkStack *ms)
 {
-    if (((W_)mark_sp & BLOCK_MASK) == 0)
+    if (((W_)ms->sp & BLOCK_MASK) == 0)
     {
-        if (mark_stack_bd->link == NULL)
+        if (ms->bd->link == NULL)
         {
             return NULL;
         } 
         else
         {
-            mark_stack_bd = mark_stack_bd->link;
-            mark_sp       = mark_stack_bd->start + BLOCK_SIZE_W;
+            ms->bd = ms->bd->link;
+            ms->sp = ms->bd->start + BLOCK_SIZE_W;
         }
     }
-    return (StgPtr)*--mark_sp;
+    return (StgPtr)*--ms->sp;
+}
+
+INLINE_HEADER rtsBool
+mark_stack_is_empty (MarkStack *ms)
+{
+    return (((W_)ms->sp & BLOCK_MASK) == 0 && ms->bd->link == NULL);
+}
+
+INLINE_HEADER void
+push_mark_stack(StgPtr p)
+{
+    push_mark_stack_on(&mark_stack, p);
+}
+
+INLINE_HEADER StgPtr
+pop_mark_stack(void)
+{
+    return pop_mark_stack_from(&mark_stack);
 }
 
 INLINE_HEADER rtsBool
 mark_stack_empty(void)
 {
-    return (((W_)mark_sp & BLOCK_MASK) == 0 && mark_stack_bd->link == NULL);
+    return mark_stack_is_empty(&mark_stack);
 }
 
 #include "EndPrivate.h"
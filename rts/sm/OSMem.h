@@ -14,10 +14,17 @@
 void osMemInit(void);
 void *osGetMBlocks(nat n);
 void osFreeMBlocks(char *addr, nat n);
+void osDecommitMemory(void *at, lnat size, rtsBool lazy);
 void osReleaseFreeMemory(void);
 void osFreeAllMBlocks(void);
 lnat getPageSize (void);
 void setExecutable (void *p, lnat len, rtsBool exec);
+lnat osCacheSize (nat level);
+
+rtsBool osNumaAvailable(void);
+nat     osNumaNodes(void);
+StgWord osNumaMask(void);
+void    osBindMBlocksToNode(void *addr, lnat size, nat node);
 
 #include "EndPrivate.h"
 
@@ -0,0 +1,429 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2012
+ *
+ * Finding and reusing the free space in blocks of pinned objects.
+ *
+ * Documentation on the architecture of the Garbage Collector can be
+ * found in the online commentary:
+ *
+ *   http://hackage.haskell.org/trac/ghc/wiki/Commentary/Rts/Storage/GC
+ *
+ * ---------------------------------------------------------------------------*/
+
+/* Overview
+ * --------
+ *
+ * allocatePinned() allocates small pinned objects into whole blocks,
+ * and the GC treats each such block as one large object: it is kept
+ * if anything in it is alive.  So one live ByteString keeps the rest
+ * of its block alive, and a program that hangs on to a few of the
+ * many small pinned objects that it allocates can end up holding a
+ * lot of memory that nothing uses.
+ *
+ * Pinned objects cannot be moved, so we cannot compact these blocks.
+ * Instead, each GC gives the pinned blocks of the generations that
+ * it collects a bitmap (one bit per word, as for the compacting
+ * collector), and evacuate() sets the bit of each pinned object that
+ * it reaches.  After GC, the space in a surviving block that is not
+ * taken by a marked object is wasted: we count it for each
+ * generation (see getGCStats() and statDescribeGens()).
+ *
+ * With +RTS --reuse-pinned, the wasted space in the blocks that are
+ * mostly empty is handed back to allocatePinned(): the gaps of at
+ * least MIN_HOLE_W words between the live objects are threaded into
+ * a list of holes, whose first two words hold the end of the hole
+ * and the next hole in the block.  A capability that runs out of
+ * room in its pinned block takes a block with holes and allocates
+ * into them, one after the other.
+ *
+ * A reused block stays where it is, on the large_objects list of an
+ * old generation, so the new objects in it are promoted straight
+ * away.  That is safe because pinned objects are ByteArrays, and
+ * contain no pointers.  The exceptions are the blocks in the snapshot
+ * of a concurrent mark, which we leave alone: an object allocated
+ * into one of those would look dead to the marker (see ConcMark.c).
+ *
+ * Now that we may reuse the space of a dead object in a live block,
+ * the block being alive no longer tells us that an object in it is:
+ * isAlive() checks the mark bit instead.
+ */
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "Storage.h"
+#include "RtsUtils.h"
+#include "Capability.h"
+#include "Hash.h"
+#include "Trace.h"
+#include "Pinned.h"
+
+// Holes smaller than this are left as slop.
+#define MIN_HOLE_W 8
+
+#define PINNED_BITMAP_WORDS (BLOCK_SIZE_W / BITS_IN(W_))
+
+// The pinned blocks of the generations being collected, and their
+// mark bits, PINNED_BITMAP_WORDS words per block in the same order.
+// pinned_marks maps each block to its bits.  It is only written
+// before and after the GC proper, so GC threads read it without
+// taking a lock.
+static bdescr   **marked_blocks   = NULL;
+static StgWord   *pinned_bits     = NULL;
+static nat        n_marked_blocks = 0;
+static HashTable *pinned_marks    = NULL;
+
+typedef struct {
+    bdescr *bd;
+    StgPtr  holes;              // the first hole in bd
+} ReusableBlock;
+
+// Blocks with holes that allocatePinned() may use.  Protected by
+// sm_mutex.
+static ReusableBlock *reusable      = NULL;
+static nat            n_reusable    = 0;
+static nat            reusable_size = 0;
+
+/* -----------------------------------------------------------------------------
+   Holes
+   -------------------------------------------------------------------------- */
+
+static void
+add_reusable (bdescr *bd, StgPtr holes)
+{
+    if (n_reusable == reusable_size) {
+        reusable_size = reusable_size == 0 ? 64 : reusable_size * 2;
+        reusable = stgReallocBytes(reusable,
+                                   reusable_size * sizeof(ReusableBlock),
+                                   "add_reusable");
+    }
+    reusable[n_reusable].bd    = bd;
+    reusable[n_reusable].holes = holes;
+    n_reusable++;
+}
+
+// Link the hole [start, end) onto the end of a list of holes, and
+// return the place to link the next one.
+STATIC_INLINE StgPtr *
+link_hole (StgPtr *last, StgPtr start, StgPtr end)
+{
+    *last = start;
+    start[0] = (W_)end;
+    start[1] = (W_)NULL;
+    return (StgPtr *)&start[1];
+}
+
+// Count the words taken by the marked objects in bd, and thread the
+// gaps between them into a list of holes.  The gaps are dead, so we
+// may write to them.
+static StgPtr
+find_holes (bdescr *bd, StgWord *bits, lnat *live)
+{
+    StgPtr p, q, end, holes, *last;
+    nat off;
+    StgWord w;
+
+    p     = bd->start;          // the end of the last marked object
+    end   = bd->start + BLOCK_SIZE_W;
+    holes = NULL;
+    last  = &holes;
+    *live = 0;
+
+    for (off = 0; off < BLOCK_SIZE_W; off++) {
+        w = bits[off / BITS_IN(W_)];
+        if (w == 0) {
+            // skip the rest of this word of the bitmap
+            off |= BITS_IN(W_) - 1;
+            continue;
+        }
+        if (!(w & ((W_)1 << (off % BITS_IN(W_))))) {
+            continue;
+        }
+        q = bd->start + off;
+        if (q - p >= MIN_HOLE_W) {
+            last = link_hole(last, p, q);
+        }
+        p = q + arr_words_sizeW((StgArrWords *)q);
+        *live += p - q;
+    }
+
+    if (end - p >= MIN_HOLE_W) {
+        link_hole(last, p, end);
+    }
+
+    return holes;
+}
+
+// Move cap on to the next hole in the block that it is reusing that
+// has room for n words.  The holes that are too small are passed
+// over, and stay slop until the next GC of the block's generation.
+static rtsBool
+next_hole (Capability *cap, lnat n)
+{
+    StgPtr hole, end;
+
+    while (cap->pinned_object_holes != NULL) {
+        hole = cap->pinned_object_holes;
+        end  = (StgPtr)hole[0];
+        cap->pinned_object_holes = (StgPtr)hole[1];
+        if (hole + n <= end) {
+            cap->pinned_object_block->free = hole;
+            cap->pinned_object_limit = end;
+            return rtsTrue;
+        }
+    }
+    return rtsFalse;
+}
+
+// cap has finished with the block that it was reusing.  From now on
+// the whole block counts as occupied (see genLiveWords()).
+static void
+retire_block (Capability *cap)
+{
+    bdescr *bd;
+
+    bd = cap->pinned_object_block;
+    bd->flags &= ~BF_PINNED_REUSED;
+    bd->free = bd->start + BLOCK_SIZE_W;
+
+    cap->pinned_object_block = NULL;
+    cap->pinned_object_limit = NULL;
+    cap->pinned_object_holes = NULL;
+}
+
+/* -----------------------------------------------------------------------------
+   Allocating into holes
+
+   Called by allocatePinned() when the block that cap is allocating
+   into is full, or cap doesn't have one.  Returns NULL if there is no
+   hole with room for n words, in which case the caller gets a fresh
+   block.
+   -------------------------------------------------------------------------- */
+
+StgPtr
+allocateReusedPinned (Capability *cap, lnat n)
+{
+    bdescr *bd;
+    StgPtr p;
+
+    bd = cap->pinned_object_block;
+    if (bd != NULL) {
+        ASSERT(bd->flags & BF_PINNED_REUSED);
+        if (next_hole(cap, n)) goto alloc;
+        retire_block(cap);
+    }
+
+    // a peek without the lock, so that we don't take it when there
+    // is nothing to reuse.
+    if (n_reusable == 0) {
+        return NULL;
+    }
+
+    ACQUIRE_SM_LOCK;
+    while (n_reusable > 0) {
+        n_reusable--;
+        bd = reusable[n_reusable].bd;
+        bd->flags |= BF_PINNED_REUSED;
+        cap->pinned_object_block = bd;
+        cap->pinned_object_holes = reusable[n_reusable].holes;
+        if (next_hole(cap, n)) {
+            RELEASE_SM_LOCK;
+            goto alloc;
+        }
+        retire_block(cap);
+    }
+    RELEASE_SM_LOCK;
+    return NULL;
+
+alloc:
+    p = bd->free;
+    bd->free += n;
+    return p;
+}
+
+/* -----------------------------------------------------------------------------
+   Marking
+
+   startPinnedMarks() is called at the start of GC, once the pinned
+   blocks filled since the last GC are on g0->large_objects, and
+   finishPinnedMarks() after the last evacuation, before the dead
+   large objects are freed.
+   -------------------------------------------------------------------------- */
+
+void
+startPinnedMarks (nat N)
+{
+    nat g, i, n;
+    bdescr *bd;
+    Capability *cap;
+
+    // Take back the blocks that the capabilities are reusing, keeping
+    // what is left of the current hole.
+    for (i = 0; i < n_capabilities; i++) {
+        cap = &capabilities[i];
+        bd = cap->pinned_object_block;
+        if (bd == NULL || !(bd->flags & BF_PINNED_REUSED)) {
+            continue;
+        }
+        if (bd->free + MIN_HOLE_W <= cap->pinned_object_limit) {
+            bd->free[0] = (W_)cap->pinned_object_limit;
+            bd->free[1] = (W_)cap->pinned_object_holes;
+            cap->pinned_object_holes = bd->free;
+        }
+        if (cap->pinned_object_holes != NULL) {
+            add_reusable(bd, cap->pinned_object_holes);
+        }
+        retire_block(cap);
+    }
+
+    // Forget the reusable blocks that this GC might free, and those
+    // in the snapshot of a concurrent mark.
+    n = 0;
+    for (i = 0; i < n_reusable; i++) {
+        bd = reusable[i].bd;
+        if (bd->gen_no > N && !(bd->flags & BF_SNAPSHOT)) {
+            reusable[n++] = reusable[i];
+        }
+    }
+    n_reusable = n;
+
+    // Give each pinned block of the generations being collected a
+    // bitmap.  Pinned large objects of more than one block have
+    // nothing to share their space with, so we leave them out.
+    n = 0;
+    for (g = 0; g <= N; g++) {
+        for (bd = generations[g].large_objects; bd != NULL; bd = bd->link) {
+            if ((bd->flags & BF_PINNED) && bd->blocks == 1) {
+                n++;
+            }
+        }
+    }
+
+    n_marked_blocks = n;
+    if (n == 0) {
+        return;
+    }
+
+    marked_blocks = stgMallocBytes(n * sizeof(bdescr *), "startPinnedMarks");
+    pinned_bits   = stgCallocBytes(n * PINNED_BITMAP_WORDS, sizeof(W_),
+                                   "startPinnedMarks");
+    pinned_marks  = allocHashTable();
+
+    n = 0;
+    for (g = 0; g <= N; g++) {
+        for (bd = generations[g].large_objects; bd != NULL; bd = bd->link) {
+            if ((bd->flags & BF_PINNED) && bd->blocks == 1) {
+                marked_blocks[n] = bd;
+                insertHashTable(pinned_marks, (StgWord)bd,
+                                pinned_bits + n * PINNED_BITMAP_WORDS);
+                bd->flags |= BF_PINNED_MARKS;
+                n++;
+            }
+        }
+    }
+}
+
+// q is an (untagged) object in a BF_PINNED_MARKS block.  Called by
+// evacuate(), possibly from several GC threads at once.
+void
+markPinnedObject (StgClosure *q, bdescr *bd)
+{
+    StgWord *bits, *w, bit;
+    nat off;
+
+    ASSERT(get_itbl(q)->type == ARR_WORDS);
+
+    bits = lookupHashTable(pinned_marks, (StgWord)bd);
+    off  = (P_)q - bd->start;
+    w    = &bits[off / BITS_IN(W_)];
+    bit  = (W_)1 << (off % BITS_IN(W_));
+
+#if defined(THREADED_RTS)
+    {
+        StgWord old;
+        do {
+            old = *w;
+            if (old & bit) return;
+        } while (cas(w, old, old | bit) != old);
+    }
+#else
+    *w |= bit;
+#endif
+}
+
+rtsBool
+isPinnedObjectMarked (StgClosure *q, bdescr *bd)
+{
+    StgWord *bits;
+    nat off;
+
+    bits = lookupHashTable(pinned_marks, (StgWord)bd);
+    off  = (P_)q - bd->start;
+    return (bits[off / BITS_IN(W_)] & ((W_)1 << (off % BITS_IN(W_)))) != 0;
+}
+
+void
+finishPinnedMarks (nat N)
+{
+    nat g, i, reused;
+    bdescr *bd;
+    StgPtr holes;
+    lnat live, wasted;
+
+    for (g = 0; g <= N; g++) {
+        generations[g].n_pinned_blocks = 0;
+        generations[g].n_pinned_waste_words = 0;
+    }
+
+    reused = 0;
+    wasted = 0;
+    for (i = 0; i < n_marked_blocks; i++) {
+        bd = marked_blocks[i];
+        bd->flags &= ~BF_PINNED_MARKS;
+
+        // evacuate_large() didn't reach this block, so it is about to
+        // be freed.
+        if (!(bd->flags & BF_EVACUATED)) {
+            continue;
+        }
+
+        holes = find_holes(bd, pinned_bits + i * PINNED_BITMAP_WORDS, &live);
+
+        // bd->gen is the generation it has been promoted to
+        bd->gen->n_pinned_blocks++;
+        bd->gen->n_pinned_waste_words += BLOCK_SIZE_W - live;
+        wasted += BLOCK_SIZE_W - live;
+
+        if (holes != NULL
+            && live * 100 < BLOCK_SIZE_W * RtsFlags.GcFlags.reusePinned
+            && !(bd->flags & BF_SNAPSHOT)) {
+            add_reusable(bd, holes);
+            reused++;
+        }
+    }
+
+    debugTrace(DEBUG_gc, "pinned blocks: %d marked, %ld bytes wasted, %d to reuse (%d in all)",
+               n_marked_blocks, (long)(wasted * sizeof(W_)), reused, n_reusable);
+
+    if (n_marked_blocks != 0) {
+        freeHashTable(pinned_marks, NULL);
+        stgFree(pinned_bits);
+        stgFree(marked_blocks);
+        pinned_marks    = NULL;
+        pinned_bits     = NULL;
+        marked_blocks   = NULL;
+        n_marked_blocks = 0;
+    }
+}
+
+void
+freePinned (void)
+{
+    if (reusable != NULL) {
+        stgFree(reusable);
+        reusable = NULL;
+    }
+    n_reusable = 0;
+    reusable_size = 0;
+}
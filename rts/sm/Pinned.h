@@ -0,0 +1,30 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team 2012
+ *
+ * Finding and reusing the free space in blocks of pinned objects.
+ *
+ * Documentation on the architecture of the Garbage Collector can be
+ * found in the online commentary:
+ *
+ *   http://hackage.haskell.org/trac/ghc/wiki/Commentary/Rts/Storage/GC
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef SM_PINNED_H
+#define SM_PINNED_H
+
+#include "BeginPrivate.h"
+
+void    startPinnedMarks     (nat N);
+void    finishPinnedMarks    (nat N);
+void    freePinned           (void);
+
+void    markPinnedObject     (StgClosure *q, bdescr *bd);
+rtsBool isPinnedObjectMarked (StgClosure *q, bdescr *bd);
+
+StgPtr  allocateReusedPinned (Capability *cap, lnat n);
+
+#include "EndPrivate.h"
+
+#endif /* SM_PINNED_H */
@@ -22,6 +22,7 @@
 #include "sm/Storage.h"
 #include "sm/BlockAlloc.h"
 #include "GCThread.h"
+#include "ConcMark.h"
 #include "Sanity.h"
 #include "Schedule.h"
 #include "Apply.h"
@@ -742,7 +743,7 @@ static void checkFullHeap (rtsBool after_major_gc)
     for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
         checkGeneration(&generations[g], after_major_gc);
     }
-    for (n = 0; n < n_capabilities; n++) {
+    for (n = 0; n < n_nurseries; n++) {
         checkNurserySanity(&nurseries[n]);
     }
 }
@@ -783,9 +784,16 @@ findMemoryLeak (void)
         markBlocks(generations[g].large_objects);
     }
 
-    for (i = 0; i < n_capabilities; i++) {
+    for (i = 0; i < n_nurseries; i++) {
         markBlocks(nurseries[i].blocks);
-        markBlocks(capabilities[i].pinned_object_block);
+    }
+    for (i = 0; i < n_capabilities; i++) {
+        // a block being reused is on its generation's large_objects
+        if (capabilities[i].pinned_object_block != NULL &&
+            !(capabilities[i].pinned_object_block->flags & BF_PINNED_REUSED)) {
+            markBlocks(capabilities[i].pinned_object_block);
+        }
+        markBlocks(capabilities[i].large_objects);
     }
 
 #ifdef PROFILING
@@ -856,7 +864,7 @@ memInventory (rtsBool show)
   nat g, i;
   lnat gen_blocks[RtsFlags.GcFlags.generations];
   lnat nursery_blocks, retainer_blocks,
-       arena_blocks, exec_blocks;
+       arena_blocks, exec_blocks, conc_mark_blocks;
   lnat live_blocks = 0, free_blocks = 0;
   rtsBool leak;
 
@@ -874,13 +882,17 @@ memInventory (rtsBool show)
   }
 
   nursery_blocks = 0;
-  for (i = 0; i < n_capabilities; i++) {
+  for (i = 0; i < n_nurseries; i++) {
       ASSERT(countBlocks(nurseries[i].blocks) == nurseries[i].n_blocks);
       nursery_blocks += nurseries[i].n_blocks;
-      if (capabilities[i].pinned_object_block != NULL) {
+  }
+  for (i = 0; i < n_capabilities; i++) {
+      if (capabilities[i].pinned_object_block != NULL &&
+          !(capabilities[i].pinned_object_block->flags & BF_PINNED_REUSED)) {
           nursery_blocks += capabilities[i].pinned_object_block->blocks;
       }
       nursery_blocks += countBlocks(capabilities[i].pinned_object_blocks);
+      nursery_blocks += countBlocks(capabilities[i].large_objects);
   }
 
   retainer_blocks = 0;
@@ -893,18 +905,31 @@ memInventory (rtsBool show)
   // count the blocks allocated by the arena allocator
   arena_blocks = arenaBlocks();
 
+  // count the mark stacks and bitmap of a concurrent mark
+  conc_mark_blocks = concMarkBlocks();
+
   // count the blocks containing executable memory
   exec_blocks = countAllocdBlocks(exec_block);
 
-  /* count the blocks on the free list */
+  /* count the blocks on the free list, and in the block caches */
   free_blocks = countFreeList();
+  for (i = 0; i < n_capabilities; i++) {
+      free_blocks += capabilities[i].large_cache.n_blocks;
+  }
+#if defined(THREADED_RTS)
+  for (i = 0; i < n_capabilities; i++) {
+      free_blocks += capabilities[i].block_cache.n_blocks;
+      free_blocks += gc_threads[i]->block_cache.n_blocks;
+  }
+#endif
 
   live_blocks = 0;
   for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
       live_blocks += gen_blocks[g];
   }
   live_blocks += nursery_blocks + 
-               + retainer_blocks + arena_blocks + exec_blocks;
+               + retainer_blocks + arena_blocks + exec_blocks
+               + conc_mark_blocks;
 
 #define MB(n) (((n) * BLOCK_SIZE_W) / ((1024*1024)/sizeof(W_)))
 
@@ -929,6 +954,8 @@ memInventory (rtsBool show)
                  arena_blocks, MB(arena_blocks));
       debugBelch("  exec         : %5" FMT_SizeT " blocks (%" FMT_SizeT " MB)\n", 
                  exec_blocks, MB(exec_blocks));
+      debugBelch("  conc. mark   : %5" FMT_SizeT " blocks (%" FMT_SizeT " MB)\n", 
+                 conc_mark_blocks, MB(conc_mark_blocks));
       debugBelch("  free         : %5" FMT_SizeT " blocks (%" FMT_SizeT " MB)\n", 
                  free_blocks, MB(free_blocks));
       debugBelch("  total        : %5" FMT_SizeT " blocks (%" FMT_SizeT " MB)\n",
@@ -20,6 +20,7 @@
 #include "GCUtils.h"
 #include "Compact.h"
 #include "MarkStack.h"
+#include "ConcMark.h"
 #include "Evac.h"
 #include "Scav.h"
 #include "Apply.h"
@@ -40,6 +41,7 @@ static void scavenge_large_bitmap (StgPtr p,
 # define scavenge_block(a) scavenge_block1(a)
 # define scavenge_mutable_list(bd,g) scavenge_mutable_list1(bd,g)
 # define scavenge_capability_mut_lists(cap) scavenge_capability_mut_Lists1(cap)
+# define scavenge_conc_mark_stacks(a) scavenge_conc_mark_stacks1(a)
 #endif
 
 /* -----------------------------------------------------------------------------
@@ -137,17 +139,30 @@ static StgPtr scavenge_mut_arr_ptrs (StgMutArrPtrs *a)
     return (StgPtr)a + mut_arr_ptrs_sizeW(a);
 }
     
-// scavenge only the marked areas of a MUT_ARR_PTRS
+// scavenge only the marked areas of a MUT_ARR_PTRS.  In a big array
+// that is only written to here and there, nearly all the cards are
+// clean, so we look at the card table a word at a time and skip the
+// words with no marked cards in them.  (The card table starts on a
+// word boundary, straight after the payload.)
 static StgPtr scavenge_mut_arr_ptrs_marked (StgMutArrPtrs *a)
 {
-    lnat m;
+    lnat m, cards;
     StgPtr p, q;
     rtsBool any_failed;
 
     any_failed = rtsFalse;
-    for (m = 0; m < mutArrPtrsCards(a->ptrs); m++)
+    cards = mutArrPtrsCards(a->ptrs);
+    for (m = 0; m < cards; m++)
     {
+        if (m % sizeof(W_) == 0 && m + sizeof(W_) <= cards &&
+            *(StgWord *)mutArrPtrsCard(a,m) == 0) {
+            m += sizeof(W_) - 1;
+            continue;
+        }
         if (*mutArrPtrsCard(a,m) != 0) {
+#ifdef DEBUG
+            mutlist_DIRTY_CARDS++;
+#endif
             p = (StgPtr)&a->payload[m << MUT_ARR_PTRS_CARD_BITS];
             q = stg_min(p + (1 << MUT_ARR_PTRS_CARD_BITS),
                         (StgPtr)&a->payload[a->ptrs]);
@@ -342,7 +357,7 @@ scavenge_thunk_srt(const StgInfoTable *info)
 {
     StgThunkInfoTable *thunk_info;
 
-    if (!major_gc) return;
+    if (!major_gc && !conc_mark_active) return;
 
     thunk_info = itbl_to_thunk_itbl(info);
     scavenge_srt((StgClosure **)GET_SRT(thunk_info), thunk_info->i.srt_bitmap);
@@ -353,7 +368,7 @@ scavenge_fun_srt(const StgInfoTable *info)
 {
     StgFunInfoTable *fun_info;
 
-    if (!major_gc) return;
+    if (!major_gc && !conc_mark_active) return;
   
     fun_info = itbl_to_fun_itbl(info);
     scavenge_srt((StgClosure **)GET_FUN_SRT(fun_info), fun_info->i.srt_bitmap);
@@ -1284,6 +1299,14 @@ scavenge_one(StgPtr p)
 	break;
       }
 
+    case BCO: {
+	StgBCO *bco = (StgBCO *)p;
+	evacuate((StgClosure **)&bco->instrs);
+	evacuate((StgClosure **)&bco->literals);
+	evacuate((StgClosure **)&bco->ptrs);
+	break;
+    }
+
     case IND:
         // IND can happen, for example, when the interpreter allocates
         // a gigantic AP closure (more than one block), which ends up
@@ -1328,6 +1351,95 @@ scavenge_one(StgPtr p)
     return (no_luck);
 }
 
+/* -----------------------------------------------------------------------------
+   Scavenge the objects that a concurrent mark of the oldest generation
+   has left for the GC (see ConcMark.c): those that the marker thread
+   could not scan while the mutator was running and, when this GC
+   finishes the mark, everything still on the grey stack.  Evacuating
+   the fields greys any more snapshot objects we find.
+
+   Returns rtsTrue if there was anything to scavenge.
+   -------------------------------------------------------------------------- */
+
+rtsBool
+scavenge_conc_mark_stacks (void)
+{
+    StgPtr p;
+    const StgInfoTable *info;
+    nat saved_evac_gen_no;
+    rtsBool did_something = rtsFalse;
+
+    saved_evac_gen_no = gct->evac_gen_no;
+    gct->evac_gen_no = oldest_gen->no;
+
+    for (;;) {
+        p = pop_mark_stack_from(&conc_deferred_stack);
+        if (p == NULL && conc_mark_finishing) {
+            p = pop_mark_stack_from(&conc_grey_stack);
+        }
+        if (p == NULL) break;
+
+        did_something = rtsTrue;
+        info = get_itbl((StgClosure *)p);
+
+        if (!HEAP_ALLOCED_GC(p)) {
+            switch (info->type) {
+            case THUNK_STATIC:
+                scavenge_thunk_srt(info);
+                break;
+            case FUN_STATIC:
+                scavenge_fun_srt(info);
+                break;
+            case CONSTR_STATIC:
+            {
+                StgPtr q, end;
+                end = (P_)((StgClosure *)p)->payload + info->layout.payload.ptrs;
+                for (q = (P_)((StgClosure *)p)->payload; q < end; q++) {
+                    evacuate((StgClosure **)q);
+                }
+                break;
+            }
+            case IND_STATIC:
+                scavenge_one(p);
+                break;
+            default:
+                // a CAF that was being entered when the marker
+                // thread looked at it, and has since been reverted.
+                break;
+            }
+            continue;
+        }
+
+        switch (info->type) {
+        case THUNK:
+        case THUNK_1_0:
+        case THUNK_0_1:
+        case THUNK_1_1:
+        case THUNK_0_2:
+        case THUNK_2_0:
+            scavenge_thunk_srt(info);
+            break;
+        case FUN:
+        case FUN_1_0:
+        case FUN_0_1:
+        case FUN_1_1:
+        case FUN_0_2:
+        case FUN_2_0:
+            scavenge_fun_srt(info);
+            break;
+        default:
+            break;
+        }
+
+        if (scavenge_one(p)) {
+            recordMutableGen_GC((StgClosure *)p, oldest_gen->no);
+        }
+    }
+
+    gct->evac_gen_no = saved_evac_gen_no;
+    return did_something;
+}
+
 /* -----------------------------------------------------------------------------
    Scavenging mutable lists.
 
@@ -1336,6 +1448,40 @@ scavenge_one(StgPtr p)
    remove non-mutable objects from the mutable list at this point.
    -------------------------------------------------------------------------- */
 
+/* An object can be on the saved mutable lists more than once; the
+   first visit scavenges it and records it again if it still needs to
+   be, so the rest can be dropped.  Returns rtsFalse for a duplicate.
+ */
+STATIC_INLINE rtsBool
+first_mut_list_visit (StgPtr p)
+{
+    StgWord i, mask, w;
+
+    mask = ((StgWord)1 << mut_list_set_bits) - 1;
+#if SIZEOF_VOID_P == 8
+    i = ((StgWord)p * 0x9E3779B97F4A7C15ULL) >> (64 - mut_list_set_bits);
+#else
+    i = ((StgWord)p * 0x9E3779B9UL) >> (32 - mut_list_set_bits);
+#endif
+
+    for (;;) {
+        w = mut_list_set[i];
+        if (w == 0) {
+#if defined(THREADED_RTS)
+            if (n_gc_threads > 1) {
+                w = cas(&mut_list_set[i], 0, (StgWord)p);
+            } else
+#endif
+            {
+                mut_list_set[i] = (StgWord)p;
+            }
+            if (w == 0) return rtsTrue;
+        }
+        if (w == (StgWord)p) return rtsFalse;
+        i = (i + 1) & mask;
+    }
+}
+
 void
 scavenge_mutable_list(bdescr *bd, generation *gen)
 {
@@ -1349,6 +1495,11 @@ scavenge_mutable_list(bdescr *bd, generation *gen)
 	    p = (StgPtr)*q;
 	    ASSERT(LOOKS_LIKE_CLOSURE_PTR(p));
 
+            if (!first_mut_list_visit(p)) {
+                gct->mut_list_dups++;
+                continue;
+            }
+
 #ifdef DEBUG	    
 	    switch (get_itbl((StgClosure *)p)->type) {
 	    case MUT_VAR_CLEAN:
@@ -1386,6 +1537,9 @@ scavenge_mutable_list(bdescr *bd, generation *gen)
                 saved_eager_promotion = gct->eager_promotion;
                 gct->eager_promotion = rtsFalse;
 
+#ifdef DEBUG
+                mutlist_CARDS += mutArrPtrsCards(((StgMutArrPtrs *)p)->ptrs);
+#endif
                 scavenge_mut_arr_ptrs_marked((StgMutArrPtrs *)p);
 
                 if (gct->failed_to_evac) {
@@ -1654,7 +1808,7 @@ scavenge_stack(StgPtr p, StgPtr stack_end)
 	p = scavenge_small_bitmap(p, size, bitmap);
 
     follow_srt:
-	if (major_gc) 
+	if (major_gc || conc_mark_active)
 	    scavenge_srt((StgClosure **)GET_SRT(info), info->i.srt_bitmap);
 	continue;
 
@@ -1880,7 +2034,7 @@ loop:
     }
     
     // scavenge objects in compacted generation
-    if (mark_stack_bd != NULL && !mark_stack_empty()) {
+    if (mark_stack.bd != NULL && !mark_stack_empty()) {
 	scavenge_mark_stack();
 	work_to_do = rtsTrue;
     }
@@ -19,11 +19,13 @@
 void    scavenge_loop (void);
 void    scavenge_mutable_list (bdescr *bd, generation *gen);
 void    scavenge_capability_mut_lists (Capability *cap);
+rtsBool scavenge_conc_mark_stacks (void);
 
 #ifdef THREADED_RTS
 void    scavenge_loop1 (void);
 void    scavenge_mutable_list1 (bdescr *bd, generation *gen);
 void    scavenge_capability_mut_Lists1 (Capability *cap);
+rtsBool scavenge_conc_mark_stacks1 (void);
 #endif
 
 #include "EndPrivate.h"
@@ -29,6 +29,8 @@
 #include "Trace.h"
 #include "GC.h"
 #include "Evac.h"
+#include "ConcMark.h"
+#include "Pinned.h"
 
 #include <string.h>
 
@@ -50,7 +52,18 @@ generation *generations = NULL; /* all the generations */
 generation *g0          = NULL; /* generation 0, for convenience */
 generation *oldest_gen  = NULL; /* oldest generation, for convenience */
 
-nursery *nurseries = NULL;     /* array of nurseries, size == n_capabilities */
+nursery *nurseries = NULL;     /* array of nurseries, size == n_nurseries */
+nat n_nurseries = 0;
+
+/*
+ * When the allocation area is divided into chunks (+RTS -n), each
+ * Capability starts off with one chunk after GC, and takes the next
+ * unused one from here when it has filled its current chunk.  We only
+ * GC when they have all been used, so a Capability that allocates a
+ * lot can use the part of the allocation area that the quiet
+ * Capabilities didn't need, rather than making everyone stop for GC.
+ */
+static volatile StgWord next_nursery = 0;
 
 #ifdef THREADED_RTS
 /*
@@ -61,6 +74,8 @@ Mutex sm_mutex;
 #endif
 
 static void allocNurseries (nat from, nat to);
+static void assignNurseriesToCapabilities (nat from, nat to);
+static nat  nurseryChunkBlocks (void);
 
 static void
 initGeneration (generation *gen, int g)
@@ -69,6 +84,8 @@ initGeneration (generation *gen, int g)
     gen->collections = 0;
     gen->par_collections = 0;
     gen->failed_promotions = 0;
+    gen->n_pinned_blocks = 0;
+    gen->n_pinned_waste_words = 0;
     gen->max_blocks = 0;
     gen->blocks = NULL;
     gen->n_blocks = 0;
@@ -158,7 +175,11 @@ initStorage (void)
           errorBelch("WARNING: compact/sweep is incompatible with -G1; disabled");
       } else {
           oldest_gen->mark = 1;
-          if (RtsFlags.GcFlags.compact)
+          // with --compact-budget the oldest generation is swept and
+          // defragmented a little at a time instead (see
+          // resize_generations())
+          if (RtsFlags.GcFlags.compact &&
+              RtsFlags.GcFlags.compactBudget == 0)
               oldest_gen->compact = 1;
       }
   }
@@ -179,6 +200,8 @@ initStorage (void)
   whitehole_spin = 0;
 #endif
 
+  initConcMark();
+
   N = 0;
 
   storageAddCapabilities(0, n_capabilities);
@@ -197,20 +220,31 @@ initStorage (void)
 
 void storageAddCapabilities (nat from, nat to)
 {
-    nat n, g, i;
+    nat n, g, i, new_n_nurseries;
+    nursery *old_nurseries;
 
+    if (RtsFlags.GcFlags.nurseryChunkSize == 0) {
+        new_n_nurseries = to;
+    } else {
+        new_n_nurseries = stg_max(to, (to * RtsFlags.GcFlags.minAllocAreaSize)
+                                      / nurseryChunkBlocks());
+    }
+
+    old_nurseries = nurseries;
     if (from > 0) {
-        nurseries = stgReallocBytes(nurseries, to * sizeof(struct nursery_),
+        nurseries = stgReallocBytes(nurseries,
+                                    new_n_nurseries * sizeof(struct nursery_),
                                     "storageAddCapabilities");
     } else {
-        nurseries = stgMallocBytes(to * sizeof(struct nursery_),
+        nurseries = stgMallocBytes(new_n_nurseries * sizeof(struct nursery_),
                                    "storageAddCapabilities");
     }
 
     // we've moved the nurseries, so we have to update the rNursery
-    // pointers from the Capabilities.
-    for (i = 0; i < to; i++) {
-        capabilities[i].r.rNursery = &nurseries[i];
+    // pointers from the existing Capabilities.
+    for (i = 0; i < from; i++) {
+        capabilities[i].r.rNursery =
+            &nurseries[capabilities[i].r.rNursery - old_nurseries];
     }
 
     /* The allocation area.  Policy: keep the allocation area
@@ -219,7 +253,12 @@ void storageAddCapabilities (nat from, nat to)
      * don't want it to be a big one.  This vague idea is borne out by
      * rigorous experimental evidence.
      */
-    allocNurseries(from, to);
+    allocNurseries(n_nurseries, new_n_nurseries);
+    n_nurseries = new_n_nurseries;
+
+    // the new Capabilities take their nurseries from the pool, like
+    // the existing ones did after the last GC
+    assignNurseriesToCapabilities(from, to);
 
     // allocate a block for each mut list
     for (n = from; n < to; n++) {
@@ -235,7 +274,12 @@ void storageAddCapabilities (nat from, nat to)
 void
 exitStorage (void)
 {
-    lnat allocated = updateNurseriesStats();
+    lnat allocated;
+
+    // stop the concurrent marker before we look at the heap
+    exitConcMark();
+
+    allocated = updateNurseriesStats();
     stat_exit(allocated);
 }
 
@@ -248,6 +292,7 @@ freeStorage (rtsBool free_heap)
     closeMutex(&sm_mutex);
 #endif
     stgFree(nurseries);
+    freePinned();
     freeGcThreads();
 }
 
@@ -425,7 +470,7 @@ newDynCAF (StgRegTable *reg STG_UNUSED, StgClosure *caf, StgClosure *bh)
    -------------------------------------------------------------------------- */
 
 static bdescr *
-allocNursery (bdescr *tail, nat blocks)
+allocNursery (nat node, bdescr *tail, nat blocks)
 {
     bdescr *bd = NULL;
     nat i, n;
@@ -435,12 +480,15 @@ allocNursery (bdescr *tail, nat blocks)
     // that the nursery blocks are adjacent, so that the processor's
     // automatic prefetching works across nursery blocks.  This is a
     // tiny optimisation (~0.5%), but it's free.
+    //
+    // The blocks come from the owning capability's NUMA node, so that
+    // the mutator allocates into local memory.
 
     while (blocks > 0) {
         n = stg_min(blocks, BLOCKS_PER_MBLOCK);
         blocks -= n;
 
-        bd = allocGroup(n);
+        bd = allocGroupOnNode(node, n);
         for (i = 0; i < n; i++) {
             initBdescr(&bd[i], g0, g0);
 
@@ -471,29 +519,50 @@ allocNursery (bdescr *tail, nat blocks)
     return &bd[0];
 }
 
+// The size of each nursery, when the allocation area is divided into
+// chunks.  A chunk is never bigger than a whole allocation area.
+static nat
+nurseryChunkBlocks (void)
+{
+    return stg_min(RtsFlags.GcFlags.nurseryChunkSize,
+                   RtsFlags.GcFlags.minAllocAreaSize);
+}
+
+static void
+assignNurseryToCapability (Capability *cap, nat n)
+{
+    cap->r.rNursery        = &nurseries[n];
+    cap->r.rCurrentNursery = nurseries[n].blocks;
+    cap->r.rCurrentAlloc   = NULL;
+}
+
 static void
 assignNurseriesToCapabilities (nat from, nat to)
 {
     nat i;
 
     for (i = from; i < to; i++) {
-        capabilities[i].r.rCurrentNursery = nurseries[i].blocks;
-        capabilities[i].r.rCurrentAlloc   = NULL;
+        assignNurseryToCapability(&capabilities[i], next_nursery++);
     }
 }
 
 static void
 allocNurseries (nat from, nat to)
 { 
-    nat i;
+    nat i, blocks;
+
+    if (RtsFlags.GcFlags.nurseryChunkSize == 0) {
+        blocks = RtsFlags.GcFlags.minAllocAreaSize;
+    } else {
+        blocks = nurseryChunkBlocks();
+    }
 
+    // nursery n usually goes to Capability n after GC, so put it on
+    // that Capability's NUMA node
     for (i = from; i < to; i++) {
-        nurseries[i].blocks =
-            allocNursery(NULL, RtsFlags.GcFlags.minAllocAreaSize);
-        nurseries[i].n_blocks =
-            RtsFlags.GcFlags.minAllocAreaSize;
+        nurseries[i].blocks = allocNursery(capNoToNumaNode(i), NULL, blocks);
+        nurseries[i].n_blocks = blocks;
     }
-    assignNurseriesToCapabilities(from, to);
 }
       
 lnat // words allocated
@@ -503,10 +572,16 @@ clearNurseries (void)
     nat i;
     bdescr *bd;
 
+    // the nursery each Capability is using now; the ones it used
+    // before that were counted by getNewNursery()
     for (i = 0; i < n_capabilities; i++) {
+        capabilities[i].total_allocated +=
+            countOccupied(capabilities[i].r.rNursery->blocks);
+    }
+
+    for (i = 0; i < n_nurseries; i++) {
         for (bd = nurseries[i].blocks; bd; bd = bd->link) {
-            allocated                       += (lnat)(bd->free - bd->start);
-            capabilities[i].total_allocated += (lnat)(bd->free - bd->start);
+            allocated += (lnat)(bd->free - bd->start);
             bd->free = bd->start;
             ASSERT(bd->gen_no == 0);
             ASSERT(bd->gen == g0);
@@ -520,23 +595,72 @@ clearNurseries (void)
 void
 resetNurseries (void)
 {
+    next_nursery = 0;
     assignNurseriesToCapabilities(0, n_capabilities);
 }
 
+/* -----------------------------------------------------------------------------
+   getNewNursery()
+
+   The Capability has filled its nursery: give it the next unused one,
+   if there is one.  Returns rtsFalse if there isn't, in which case
+   it's time to GC.  The Capability must not be running Haskell code,
+   because we change CurrentNursery.
+   -------------------------------------------------------------------------- */
+
+rtsBool
+getNewNursery (Capability *cap)
+{
+    StgWord i;
+
+    for (;;) {
+        i = next_nursery;
+        if (i >= n_nurseries) {
+            return rtsFalse;
+        }
+        if (cas(&next_nursery, i, i+1) == i) {
+            cap->total_allocated += countOccupied(cap->r.rNursery->blocks);
+            assignNurseryToCapability(cap, i);
+            debugTrace(DEBUG_gc, "cap %d: new nursery %d", cap->no, (int)i);
+            return rtsTrue;
+        }
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   nurseryUsedSinceGC()
+
+   Has this Capability filled a block of its nursery since the last
+   GC?  resetNurseries() leaves Capability n at the first block of
+   nursery n with no rCurrentAlloc block, and a Capability only moves
+   on from there when it has used the block up.  
+
+   This is called without owning the Capability, so the answer might
+   be out of date by the time we get it; it is only a hint.
+   -------------------------------------------------------------------------- */
+
+rtsBool
+nurseryUsedSinceGC (Capability *cap)
+{
+    return cap->r.rNursery != &nurseries[cap->no]
+        || cap->r.rCurrentNursery != nurseries[cap->no].blocks
+        || cap->r.rCurrentAlloc != NULL;
+}
+
 lnat
 countNurseryBlocks (void)
 {
     nat i;
     lnat blocks = 0;
 
-    for (i = 0; i < n_capabilities; i++) {
+    for (i = 0; i < n_nurseries; i++) {
         blocks += nurseries[i].n_blocks;
     }
     return blocks;
 }
 
 static void
-resizeNursery (nursery *nursery, nat blocks)
+resizeNursery (nursery *nursery, nat node, nat blocks)
 {
   bdescr *bd;
   nat nursery_blocks;
@@ -547,7 +671,8 @@ resizeNursery (nursery *nursery, nat blocks)
   if (nursery_blocks < blocks) {
       debugTrace(DEBUG_gc, "increasing size of nursery to %d blocks", 
                  blocks);
-    nursery->blocks = allocNursery(nursery->blocks, blocks-nursery_blocks);
+    nursery->blocks = allocNursery(node, nursery->blocks,
+                                   blocks-nursery_blocks);
   } 
   else {
     bdescr *next_bd;
@@ -567,7 +692,8 @@ resizeNursery (nursery *nursery, nat blocks)
     // might have gone just under, by freeing a large block, so make
     // up the difference.
     if (nursery_blocks < blocks) {
-        nursery->blocks = allocNursery(nursery->blocks, blocks-nursery_blocks);
+        nursery->blocks = allocNursery(node, nursery->blocks,
+                                       blocks-nursery_blocks);
     }
   }
   
@@ -575,16 +701,23 @@ resizeNursery (nursery *nursery, nat blocks)
   ASSERT(countBlocks(nursery->blocks) == nursery->n_blocks);
 }
 
+static void
+resizeNurseriesEach (nat blocks)
+{
+    nat i;
+    for (i = 0; i < n_nurseries; i++) {
+        resizeNursery(&nurseries[i], capNoToNumaNode(i), blocks);
+    }
+}
+
 // 
-// Resize each of the nurseries to the specified size.
+// Resize the nurseries so that each Capability has an allocation
+// area of the specified size.
 //
 void
 resizeNurseriesFixed (nat blocks)
 {
-    nat i;
-    for (i = 0; i < n_capabilities; i++) {
-        resizeNursery(&nurseries[i], blocks);
-    }
+    resizeNurseriesEach(stg_max(1, (blocks * n_capabilities) / n_nurseries));
 }
 
 // 
@@ -595,7 +728,7 @@ resizeNurseries (nat blocks)
 {
     // If there are multiple nurseries, then we just divide the number
     // of available blocks between them.
-    resizeNurseriesFixed(blocks / n_capabilities);
+    resizeNurseriesEach(stg_max(1, blocks / n_nurseries));
 }
 
 
@@ -614,6 +747,21 @@ move_STACK (StgStack *src, StgStack *dest)
     dest->sp = (StgPtr)dest->sp + diff;
 }
 
+// g0->n_new_large_words is shared by all the Capabilities, and MAYBE_GC()
+// reads it to decide whether to GC.
+STATIC_INLINE void
+add_new_large_words (lnat n)
+{
+#if defined(THREADED_RTS)
+    StgWord old;
+    do {
+        old = g0->n_new_large_words;
+    } while (cas((StgVolatilePtr)&g0->n_new_large_words, old, old + n) != old);
+#else
+    g0->n_new_large_words += n;
+#endif
+}
+
 /* -----------------------------------------------------------------------------
    allocate()
 
@@ -656,12 +804,17 @@ allocate (Capability *cap, lnat n)
             stg_exit(EXIT_HEAPOVERFLOW);
         }
 
-        ACQUIRE_SM_LOCK
-        bd = allocGroup(req_blocks);
-        dbl_link_onto(bd, &g0->large_objects);
-        g0->n_large_blocks += bd->blocks; // might be larger than req_blocks
-        g0->n_new_large_words += n;
-        RELEASE_SM_LOCK;
+        // Reuse the group of a large object of the same size that
+        // died in the last GC if we can; otherwise small groups come
+        // from this Capability's block cache.  The object goes on
+        // cap->large_objects until the next GC, so we don't need
+        // sm_mutex at all unless the caches are empty.
+        bd = takeLargeGroup(&cap->large_cache, req_blocks);
+        if (bd == NULL) {
+            bd = allocGroupOnCap_lock(cap, req_blocks);
+        }
+        dbl_link_onto(bd, &cap->large_objects);
+        add_new_large_words(n);
         initBdescr(bd, g0, g0);
         bd->flags = BF_LARGE;
         bd->free = bd->start + n;
@@ -682,10 +835,8 @@ allocate (Capability *cap, lnat n)
         if (bd == NULL || bd->free + n > bd->start + BLOCK_SIZE_W) {
             // The nursery is empty, or the next block is already
             // full: allocate a fresh block (we can't fail here).
-            ACQUIRE_SM_LOCK;
-            bd = allocBlock();
+            bd = allocBlockOnCap_lock(cap);
             cap->r.rNursery->n_blocks++;
-            RELEASE_SM_LOCK;
             initBdescr(bd, g0, g0);
             bd->flags = 0;
             // If we had to allocate a new block, then we'll GC
@@ -730,6 +881,9 @@ allocate (Capability *cap, lnat n)
    mostly-copying techniques).  But since we're restricting ourselves
    to pinned ByteArrays, not scavenging is ok.
 
+   With --reuse-pinned, we also allocate into the holes left by dead
+   objects in older blocks of pinned objects; see Pinned.c.
+
    This function is called by newPinnedByteArray# which immediately
    fills the allocated memory with a MutableByteArray#.
    ------------------------------------------------------------------------- */
@@ -755,13 +909,22 @@ allocatePinned (Capability *cap, lnat n)
     
     // If we don't have a block of pinned objects yet, or the current
     // one isn't large enough to hold the new object, get a new one.
-    if (bd == NULL || (bd->free + n) > (bd->start + BLOCK_SIZE_W)) {
+    if (bd == NULL || (bd->free + n) > cap->pinned_object_limit) {
 
         // stash the old block on cap->pinned_object_blocks.  On the
         // next GC cycle these objects will be moved to
-        // g0->large_objects.
-        if (bd != NULL) {
+        // g0->large_objects.  A block whose holes we were reusing is
+        // already on the large_objects list of its generation.
+        if (bd != NULL && !(bd->flags & BF_PINNED_REUSED)) {
             dbl_link_onto(bd, &cap->pinned_object_blocks);
+            cap->pinned_object_block = NULL;
+        }
+
+        // With --reuse-pinned, try the holes in the pinned blocks that
+        // the last GCs found to be mostly empty (see Pinned.c).
+        p = allocateReusedPinned(cap, n);
+        if (p != NULL) {
+            return p;
         }
 
         // We need to find another block.  We could just allocate one,
@@ -786,9 +949,7 @@ allocatePinned (Capability *cap, lnat n)
             // counted towards allocation, and we're already counting
             // our pinned obects as allocation in
             // collect_pinned_object_blocks in the GC.
-            ACQUIRE_SM_LOCK;
-            bd = allocBlock();
-            RELEASE_SM_LOCK;
+            bd = allocBlockOnCap_lock(cap);
             initBdescr(bd, g0, g0);
         } else {
             // we have a block in the nursery: steal it
@@ -800,6 +961,7 @@ allocatePinned (Capability *cap, lnat n)
         }
 
         cap->pinned_object_block = bd;
+        cap->pinned_object_limit = bd->start + BLOCK_SIZE_W;
         bd->flags  = BF_PINNED | BF_LARGE | BF_EVACUATED;
 
         // The pinned_object_block remains attached to the capability
@@ -909,7 +1071,7 @@ dirty_MVAR(StgRegTable *reg, StgClosure *p)
  *
  * Update the per-cap total_allocated numbers with an approximation of
  * the amount of memory used in each cap's nursery. Also return the
- * total across all caps.
+ * total across all nurseries.
  * 
  * Since this update is also performed by clearNurseries() then we only
  * need this function for the final stats when the RTS is shutting down.
@@ -922,9 +1084,12 @@ updateNurseriesStats (void)
     nat i;
 
     for (i = 0; i < n_capabilities; i++) {
-        int cap_allocated = countOccupied(nurseries[i].blocks);
-        capabilities[i].total_allocated += cap_allocated;
-        allocated                       += cap_allocated;
+        capabilities[i].total_allocated +=
+            countOccupied(capabilities[i].r.rNursery->blocks);
+    }
+
+    for (i = 0; i < n_nurseries; i++) {
+        allocated += countOccupied(nurseries[i].blocks);
     }
 
     return allocated;
@@ -29,10 +29,12 @@ void storageAddCapabilities (nat from, nat to);
    Storage manager state
    -------------------------------------------------------------------------- */
 
+rtsBool getNewNursery (Capability *cap);
+
 INLINE_HEADER rtsBool
 doYouWantToGC( Capability *cap )
 {
-  return (cap->r.rCurrentNursery->link == NULL ||
+  return ((cap->r.rCurrentNursery->link == NULL && !getNewNursery(cap)) ||
           g0->n_new_large_words >= large_alloc_lim);
 }
 
@@ -79,12 +81,14 @@ void dirty_MVAR(StgRegTable *reg, StgClosure *p);
    -------------------------------------------------------------------------- */
 
 extern nursery *nurseries;
+extern nat n_nurseries;
 
 void     resetNurseries       ( void );
 lnat     clearNurseries       ( void );
 void     resizeNurseries      ( nat blocks );
 void     resizeNurseriesFixed ( nat blocks );
 lnat     countNurseryBlocks   ( void );
+rtsBool  nurseryUsedSinceGC   ( Capability *cap );
 
 /* -----------------------------------------------------------------------------
    Stats 'n' DEBUG stuff
@@ -18,15 +18,86 @@
 #include "Sweep.h"
 #include "Trace.h"
 
+// A block is fragmented if fewer than this many words of its mark
+// bitmap have anything marked in them.
+#define FRAGMENTED_RESID ((BLOCK_SIZE_W * 3) / (BITS_IN(W_) * 4))
+
+STATIC_INLINE nat
+block_resid (bdescr *bd)
+{
+    nat i, resid;
+
+    resid = 0;
+    for (i = 0; i < BLOCK_SIZE_W / BITS_IN(W_); i++)
+    {
+        if (bd->u.bitmap[i] != 0) resid++;
+    }
+    return resid;
+}
+
+/* -----------------------------------------------------------------------------
+   With --compact-budget, the next major GC doesn't copy out all the
+   fragmented blocks, only the emptiest ones: as many as we expect to
+   hold no more than the budget of live data.  Each major GC copies out
+   some more, so a fragmented generation is defragmented a piece at a
+   time, and the cost of it in any one GC is bounded.
+
+   resid_count[r] is the number of fragmented blocks with residency r.
+   Returns the number of blocks selected.
+   -------------------------------------------------------------------------- */
+
+static nat
+select_fragmented (generation *gen, nat resid_count[], lnat budget)
+{
+    bdescr *bd;
+    nat resid, cutoff, extra, selected;
+    lnat words, cost;
+
+    // Select all the blocks with residency below 'cutoff', and 'extra'
+    // of those with residency 'cutoff'.
+    words = 0;
+    for (cutoff = 1; cutoff < FRAGMENTED_RESID; cutoff++) {
+        cost = (lnat)resid_count[cutoff] * cutoff * BITS_IN(W_);
+        if (words + cost > budget) break;
+        words += cost;
+    }
+    extra = 0;
+    if (cutoff < FRAGMENTED_RESID) {
+        extra = (budget - words) / (cutoff * BITS_IN(W_));
+    }
+
+    selected = 0;
+    for (bd = gen->old_blocks; bd != NULL; bd = bd->link)
+    {
+        if (!(bd->flags & BF_MARKED)) continue;
+
+        resid = block_resid(bd);
+        if (resid < cutoff || (resid == cutoff && extra > 0)) {
+            if (resid == cutoff) extra--;
+            bd->flags |= BF_FRAGMENTED;
+            selected++;
+        }
+    }
+
+    return selected;
+}
+
 void
 sweep(generation *gen)
 {
     bdescr *bd, *prev, *next;
     nat i;
     nat freed, resid, fragd, blocks, live;
+    nat resid_count[FRAGMENTED_RESID];
+    lnat budget; // in words
     
     ASSERT(countBlocks(gen->old_blocks) == gen->n_old_blocks);
 
+    budget = (lnat)RtsFlags.GcFlags.compactBudget * BLOCK_SIZE_W;
+    for (i = 0; i < FRAGMENTED_RESID; i++) {
+        resid_count[i] = 0;
+    }
+
     live = 0; // estimate of live data in this gen
     freed = 0;
     fragd = 0;
@@ -42,11 +113,7 @@ sweep(generation *gen)
         }
 
         blocks++;
-        resid = 0;
-        for (i = 0; i < BLOCK_SIZE_W / BITS_IN(W_); i++)
-        {
-            if (bd->u.bitmap[i] != 0) resid++;
-        }
+        resid = block_resid(bd);
         live += resid * BITS_IN(W_);
 
         if (resid == 0)
@@ -63,15 +130,23 @@ sweep(generation *gen)
         else
         {
             prev = bd;
-            if (resid < (BLOCK_SIZE_W * 3) / (BITS_IN(W_) * 4)) {
-                fragd++;
-                bd->flags |= BF_FRAGMENTED;
+            if (resid < FRAGMENTED_RESID) {
+                if (budget == 0) {
+                    fragd++;
+                    bd->flags |= BF_FRAGMENTED;
+                } else {
+                    resid_count[resid]++;
+                }
             }
 
             bd->flags |= BF_SWEPT;
         }
     }
 
+    if (budget != 0) {
+        fragd = select_fragmented(gen, resid_count, budget);
+    }
+
     gen->live_estimate = live;
 
     debugTrace(DEBUG_gc, "sweeping: %d blocks, %d were copied, %d freed (%d%%), %d are fragmented, live estimate: %ld%%",
@@ -365,6 +365,16 @@ osFreeAllMBlocks(void)
     }
 }
 
+void osDecommitMemory (void *at, lnat size, rtsBool lazy STG_UNUSED)
+{
+    // MEM_RESET is like MADV_FREE: the contents may be discarded, but
+    // the memory stays committed and can be reused without another
+    // VirtualAlloc.
+    if (VirtualAlloc(at, size, MEM_RESET, PAGE_READWRITE) == NULL) {
+        sysErrorBelch("osDecommitMemory: VirtualAlloc MEM_RESET failed");
+    }
+}
+
 lnat getPageSize (void)
 {
     static lnat pagesize = 0;
@@ -390,3 +400,41 @@ void setExecutable (void *p, lnat len, rtsBool exec)
         stg_exit(EXIT_FAILURE);
     }
 }
+
+/* -----------------------------------------------------------------------------
+   osCacheSize
+
+   Not implemented on Windows yet: we don't know the cache sizes.
+   -------------------------------------------------------------------------- */
+
+lnat osCacheSize (nat level STG_UNUSED)
+{
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+   NUMA
+
+   Not supported on Windows yet: there is one node, and binding memory
+   to it is a no-op.
+   -------------------------------------------------------------------------- */
+
+rtsBool osNumaAvailable (void)
+{
+    return rtsFalse;
+}
+
+nat osNumaNodes (void)
+{
+    return 1;
+}
+
+StgWord osNumaMask (void)
+{
+    return 1;
+}
+
+void osBindMBlocksToNode (void *addr STG_UNUSED, lnat size STG_UNUSED,
+                          nat node STG_UNUSED)
+{
+}
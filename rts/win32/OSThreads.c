@@ -280,6 +280,12 @@ setThreadAffinity (nat n, nat m) // cap N of M
     }
 }
 
+void
+setThreadNode (nat node STG_UNUSED)
+{
+    // NUMA is not supported on Windows yet
+}
+
 typedef BOOL (WINAPI *PCSIO)(HANDLE);
 
 void